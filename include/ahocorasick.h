@@ -0,0 +1,38 @@
+#ifndef AHOCORASICK_H
+#define AHOCORASICK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
+
+// Size of the direct lookup table for the root's transitions. Command lines are mostly ASCII so this saves a lot of searching.
+#define AC_ROOT_TABLE_SIZE 128
+
+// An Aho-Corasick automaton for finding many patterns in a single pass over a string.
+// The whole automaton lives in one block of memory which starts with this header, so freeing it is a single call
+// and it contains no pointers.
+typedef struct
+{
+    size_t size; // Size of the whole block in bytes, including this header.
+    uint32_t npatterns;
+    uint32_t nnodes;
+    uint32_t nedges;
+    uint32_t nodesOffset;
+    uint32_t edgesOffset;
+    uint32_t patternNextOffset;
+    uint32_t rootTable[AC_ROOT_TABLE_SIZE];
+} AhoCorasick;
+
+// Called for every occurrence of a pattern in the scanned string. Return nonzero to stop the scan.
+typedef char (*AhoCorasickCallback)(uint32_t pattern, void *ctx);
+
+// Builds an automaton over the given patterns. Patterns are identified by their index in the arrays.
+// Empty patterns are ignored. Returns NULL if memory ran out.
+AhoCorasick *AhoCorasickBuild(const wchar_t *const *patterns, const size_t *lens, size_t npatterns);
+
+// Scans text once, calling onMatch for every pattern occurrence. Returns nonzero if onMatch stopped the scan.
+char AhoCorasickScan(const AhoCorasick *ac, const wchar_t *text, size_t len, AhoCorasickCallback onMatch, void *ctx);
+
+void AhoCorasickFree(AhoCorasick *ac);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef BATCHITER_H
+#define BATCHITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum
+{
+    BATCH_ITEM,
+    BATCH_END,
+    BATCH_ERROR,
+} BatchResult;
+
+typedef enum
+{
+    FETCH_MORE,    // There may be more items after these.
+    FETCH_TIMEOUT, // The timeout passed before the batch filled up. There may be more items after these, which may be none.
+    FETCH_END,     // These are the last items.
+    FETCH_ERROR,   // Any items fetched anyway are released.
+} BatchFetchResult;
+
+// Fetches up to max items into items, waiting at most timeoutMs for them, and sets nfetched to how many it got.
+typedef BatchFetchResult (*BatchFetchCallback)(void *ctx, void **items, size_t max, uint32_t timeoutMs, size_t *nfetched);
+
+// Releases an item that was fetched but never handed out.
+typedef void (*BatchReleaseCallback)(void *ctx, void *item);
+
+// Hands out the items of an enumerator one at a time while fetching them from it in batches, so each round trip to it brings back many items.
+// It knows nothing about what it enumerates, the enumerator is only reached through the callbacks. Zero-initialize, then BatchIteratorInit.
+typedef struct
+{
+    BatchFetchCallback fetch;
+    BatchReleaseCallback release;
+    void *ctx;
+    size_t batchSize;
+    uint32_t timeoutMs;
+    uint32_t maxIdleMs; // Fetches that keep timing out without items for this long mean the enumerator is hung.
+
+    // The last batch, and how much of it was handed out.
+    void **items;
+    size_t nitems;
+    size_t pos;
+
+    uint32_t idleMs;
+    char isEnded;  // The last batch was the last one.
+    char isFailed;
+} BatchIterator;
+
+// Returns zero if memory ran out.
+char BatchIteratorInit(BatchIterator *it, size_t batchSize, uint32_t timeoutMs, uint32_t maxIdleMs, BatchFetchCallback fetch, BatchReleaseCallback release, void *ctx);
+
+// Hands out the next item, which is the caller's from then on. Once it returns BATCH_END or BATCH_ERROR it keeps returning it until restarted.
+BatchResult BatchIteratorNext(BatchIterator *it, void **item);
+
+// Releases the items that weren't handed out, so the iterator can go over a new enumeration. Call it before the enumerator the callbacks use is released.
+void BatchIteratorRestart(BatchIterator *it);
+
+// Restarts the iterator and frees it. Safe to call with a zero-initialized iterator.
+void BatchIteratorFree(BatchIterator *it);
+
+#endif
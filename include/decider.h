@@ -0,0 +1,52 @@
+#ifndef DECIDER_H
+#define DECIDER_H
+
+#include "pollsched.h"
+#include <stdint.h>
+
+// Decides what the fixer does each cycle: whether to toggle Instant Replay, when it's in conflict with another program, and how long to wait.
+// It's all in here and none of it touches Shadowplay, the processes or the clock, so it behaves the same in a simulation as it does for real.
+typedef struct
+{
+    uint32_t conflictBackoffSec; // How long to leave Shadowplay alone once in conflict.
+    PollScheduler scheduler;
+
+    int toggleStreak;         // Toggles in a row, each one undone by the time of the next cycle.
+    uint64_t conflictStartMs;
+    char lastPolledState;     // What the last poll saw, to tell when it changes. -1 before the first poll.
+} Decider;
+
+// What the fixer saw this cycle.
+typedef struct
+{
+    uint64_t nowMs;    // Any monotonic clock, so long as it's always the same one.
+    char isWoken;      // The main thread woke the fixer up for a command.
+    char isReloaded;   // The whitelist, or everything, was reloaded.
+    char isDisabled;
+    char isExclusiveExists;
+
+    // Only looked at if the cycle is observing, see DeciderIsObserving.
+    char isInstantReplayOn;
+    char isPolled; // Whether the processes were polled. They can be skipped when Instant Replay is on and there's no exclusives list.
+    char isWhitelistedRunning;
+    char isExclusiveRunning;
+} DeciderInputs;
+
+// What the fixer should do about it.
+typedef struct
+{
+    char isToggling;
+    char isConflictEntered;  // The toggle was wanted, but it was held back because the fixer is in conflict.
+    char isConflictRetried;  // The fixer is making an attempt to break out of conflict.
+    uint32_t intervalSec;    // How long to wait until the next cycle.
+} DeciderActions;
+
+void DeciderInit(Decider *decider, uint32_t minIntervalSec, uint32_t maxIntervalSec, uint32_t conflictBackoffSec);
+
+// Whether this cycle needs to know if Instant Replay is on and which processes are running. If not, the step doesn't look at them.
+char DeciderIsObserving(const Decider *decider, const DeciderInputs *inputs);
+
+// Moves the decider on to the next cycle.
+DeciderActions DeciderStep(Decider *decider, const DeciderInputs *inputs);
+
+#endif
@@ -1,8 +1,20 @@
 #ifndef DEFINES_H
 #define DEFINES_H
 
+#ifdef _WIN32
 #include <winsock2.h>
 #include <windows.h>
+#else
+// The modules which don't talk to Windows are also built into the command line tools, which have to build anywhere.
+// This is as much of windows.h as they need.
+#define TRUE 1
+#define FALSE 0
+#define TEXT(s) s
+#define _countof(arr) (sizeof(arr) / sizeof(*(arr)))
+#define _stprintf_s snprintf
+typedef char TCHAR;
+#endif
+
 #include <stdio.h>
 #include <pthread.h>
 
@@ -81,11 +93,15 @@ typedef struct
 {
     char isDisabled;
     char isRefresh;
+    char isWakeRequested; // Set along with signaling wake, so a request made while the fixer is busy isn't missed.
+    struct timespec wakeRequestTime; // On the monotonic clock, for logging how long requests take to handle.
+    char isNotified; // Like isWakeRequested, for something the fixer listens to rather than a command.
     char fixerDied;
     char issueWarning;
     TCHAR errorMsg[MSG_LEN];
     TCHAR warningMsg[MSG_LEN];
     pthread_mutex_t lock; // Lock for all the above.
+    pthread_cond_t wake;  // Wakes the fixer up between cycles to act on a change to the above. Waited on with lock.
 
     FILE *logfile;
     pthread_mutex_t loglock; // Lock for logfile.
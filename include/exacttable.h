@@ -0,0 +1,34 @@
+#ifndef EXACTTABLE_H
+#define EXACTTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
+
+#define EXACT_NOT_FOUND -1
+
+// A hash table for looking up wide strings by exact value. Each key also has a tag, and a lookup only finds keys with the same tag.
+// Like AhoCorasick, the whole table (keys included) lives in one block of memory which starts with this header.
+typedef struct
+{
+    size_t size; // Size of the whole block in bytes, including this header.
+    uint32_t nkeys;
+    uint32_t nbuckets; // Always a power of 2.
+    uint32_t bucketsOffset;
+    uint32_t keysOffset;
+    uint32_t charsOffset;
+} ExactTable;
+
+// Builds a table of the given keys. Keys are identified by their index in the arrays. Returns NULL if memory ran out.
+// If tags is NULL, every key gets the tag 0.
+ExactTable *ExactTableBuild(const wchar_t *const *keys, const size_t *lens, const uint32_t *tags, size_t nkeys);
+
+// Returns the first key equal to (tag, key), or EXACT_NOT_FOUND.
+int32_t ExactTableFind(const ExactTable *table, uint32_t tag, const wchar_t *key, size_t len);
+
+// Returns the next key equal to the one with the given id, or EXACT_NOT_FOUND. Duplicates are returned in the order they were given.
+int32_t ExactTableNext(const ExactTable *table, int32_t id);
+
+void ExactTableFree(ExactTable *table);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef FDNOTIFY_H
+#define FDNOTIFY_H
+
+#ifndef _WIN32
+
+// Calls back from a thread of its own whenever something new arrives on a file descriptor, so whoever reads it needn't check it every so often.
+// It only tells of arrivals: whatever is left unread doesn't call back again until more comes. This is what the Linux backends of the
+// process events and the file watch tell their listeners with, Windows has its own ways.
+typedef struct FdNotifier FdNotifier;
+
+typedef void (*FdNotifyCallback)(void *ctx);
+
+// Starts calling onArrival for the descriptor, which must stay open until the notifier is stopped. Returns NULL if it couldn't be started.
+// If something is already waiting to be read it may call back right away.
+FdNotifier *FdNotifierStart(int fd, FdNotifyCallback onArrival, void *ctx);
+
+// Stops calling back, and waits for a callback that's in progress to return. Safe to call with NULL.
+void FdNotifierStop(FdNotifier *fn);
+
+#endif
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef FILEWATCH_H
+#define FILEWATCH_H
+
+// Watches one file for changes using the OS's change notifications: ReadDirectoryChangesW on Windows and inotify elsewhere.
+// The file's directory is what's actually watched, so the file may be deleted, replaced or created after the watch starts.
+typedef struct FileWatch FileWatch;
+
+// Called from another thread when something in the directory changed, so the watcher can poll right away instead of every so often.
+// It mustn't use the FileWatch, only tell its own thread to. FileWatchPoll tells whether it was the file that changed.
+typedef void (*FileWatchCallback)(void *ctx);
+
+// Starts watching the file with the given name in dir, with onChange called on changes. It may be NULL. Returns NULL if the watch couldn't be started.
+FileWatch *FileWatchOpen(const char *dir, const char *name, FileWatchCallback onChange, void *ctx);
+
+// Returns nonzero if the file changed since the last call (or since the watch started). Doesn't block.
+char FileWatchPoll(FileWatch *fw);
+
+// Stops watching. Once it returns onChange isn't called anymore. Safe to call with NULL.
+void FileWatchClose(FileWatch *fw);
+
+#endif
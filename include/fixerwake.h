@@ -0,0 +1,20 @@
+#ifndef FIXERWAKE_H
+#define FIXERWAKE_H
+
+#include <stdint.h>
+
+// How the main thread, or anything else the fixer listens to, gets it to act between cycles instead of at the next one.
+// It only uses glbl and pthreads, so it builds anywhere.
+
+// Wakes the fixer up. Call it with glbl.lock held, right after making the change.
+void FixerWake();
+
+// Wakes the fixer up to look at something it listens to, like process events. Unlike FixerWake it's not a command, so FixerWaitForCycle
+// doesn't report it and the fixer finds out what happened on its own. Takes glbl.lock itself, and can be passed as the sources' callback.
+void FixerNotify(void *ctx);
+
+// Waits for the interval to pass or for FixerWake or FixerNotify, whichever comes first. Returns nonzero if FixerWake did. Takes glbl.lock for the wait.
+// A wake that came while the fixer wasn't waiting isn't lost, the next wait returns right away.
+char FixerWaitForCycle(uint32_t intervalSec);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef POLLSCHED_H
+#define POLLSCHED_H
+
+#include <stdint.h>
+
+// Decides how long to wait between polls. Right after something changes it's the shortest interval, since more changes tend to follow
+// (a toggle has to be confirmed, a game that started may have a launcher that exits), and while nothing changes it doubles up to the longest one.
+typedef struct
+{
+    uint32_t minSec;
+    uint32_t maxSec;
+    uint32_t intervalSec; // The last interval given out.
+} PollScheduler;
+
+// The first interval is the shortest one.
+void PollSchedulerInit(PollScheduler *ps, uint32_t minSec, uint32_t maxSec);
+
+// Returns how long to wait until the next poll, given whether anything changed since the last one was scheduled.
+uint32_t PollSchedulerNext(PollScheduler *ps, char isChanged);
+
+#endif
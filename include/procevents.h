@@ -0,0 +1,54 @@
+#ifndef PROCEVENTS_H
+#define PROCEVENTS_H
+
+#include "procsource.h"
+#include <stdint.h>
+
+// Passed as the creation time of exits when the system doesn't say, in which case the process is known by its PID alone.
+#define PROCESS_ANY_CREATE_TIME UINT64_MAX
+
+typedef enum
+{
+    PROCEVENT_START,
+    PROCEVENT_EXIT,
+} ProcessEventKind;
+
+typedef struct
+{
+    ProcessEventKind kind;
+    ProcessInfo process; // Only starts have fields. They're valid until the next ProcessEventsNext.
+} ProcessEvent;
+
+// Tells when processes start and exit, so the running processes only have to be enumerated once and then kept up to date.
+// On Windows the events come from WMI, elsewhere from the kernel's process connector (which needs CAP_NET_ADMIN).
+// Events are queued from the moment the source is opened, so a snapshot taken after opening it misses nothing.
+typedef struct ProcessEvents ProcessEvents;
+
+// Called from another thread when events arrive, so the listener can get to them without checking every so often. It mustn't use the
+// ProcessEvents, only tell its own thread to. Calls may come in bunches, or one for a few events.
+typedef void (*ProcessEventsCallback)(void *ctx);
+
+// Starts listening, with onArrival called whenever events arrive. It may be NULL. Returns NULL if the system won't deliver process events.
+// On Windows COM must already be initialized on this thread.
+// WMI finds out about processes by polling for them itself every withinSec seconds, so events can be that late. The kernel's are never late.
+ProcessEvents *ProcessEventsOpen(uint32_t withinSec, ProcessEventsCallback onArrival, void *ctx);
+
+// Returns nonzero and fills event with the next event, or zero if there are none right now. Doesn't block.
+// Events of the same process come in the order they happened, but a process may start again (e.g. exec on Linux) without exiting first.
+char ProcessEventsNext(ProcessEvents *pe, ProcessEvent *event);
+
+// Returns nonzero if events were lost since the last call, in which case only a new snapshot can tell which processes are running.
+char ProcessEventsWereLost(ProcessEvents *pe);
+
+// Stops listening. Once it returns onArrival isn't called anymore. Safe to call with NULL.
+void ProcessEventsClose(ProcessEvents *pe);
+
+#ifndef _WIN32
+
+// Reads the process connector's messages from a socket that's already subscribed to them and is nonblocking, and takes ownership of it.
+// ProcessEventsOpen is this with a netlink socket, the tests feed it messages of their own when they can't have one. Returns NULL on failure.
+ProcessEvents *ProcessEventsFromSocket(int sock, ProcessEventsCallback onArrival, void *ctx);
+
+#endif
+
+#endif
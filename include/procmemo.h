@@ -0,0 +1,60 @@
+#ifndef PROCMEMO_H
+#define PROCMEMO_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Pass as the creation time to ProcessMemoRemove to remove the process with the PID whatever its creation time.
+#define PROCESS_MEMO_ANY_TIME UINT64_MAX
+
+// A process is identified by its PID together with its creation time, because PIDs get reused.
+typedef struct
+{
+    uint64_t createTime;
+    uint32_t pid;
+    uint32_t lastSeen;  // The cycle in which the process was last seen.
+    char verdict;       // Whatever the caller wants to remember about the process.
+    char isUsed;
+} ProcessMemoSlot;
+
+// Remembers a verdict for every running process so it only has to be computed once per process.
+// Each polling cycle is wrapped in ProcessMemoBeginCycle and ProcessMemoEndCycle, and processes that weren't seen in a cycle are evicted.
+// Zero-initialize to get an empty memo.
+typedef struct
+{
+    ProcessMemoSlot *slots;
+    ProcessMemoSlot *spare; // Same capacity as slots. Evicting rebuilds the table into it, so a cycle never needs to allocate.
+    size_t capacity;        // Always 0 or a power of 2.
+    size_t count;
+    uint32_t cycle;
+    size_t bitCounts[CHAR_BIT]; // How many processes have each bit of their verdict set. Kept up to date as processes come and go.
+} ProcessMemo;
+
+// Returns what a memoized verdict should become.
+typedef char (*ProcessMemoRemapCallback)(char verdict, void *ctx);
+
+void ProcessMemoBeginCycle(ProcessMemo *memo);
+
+// Returns nonzero and fills verdict if the process is in the memo, and marks it as seen in this cycle.
+char ProcessMemoLookup(ProcessMemo *memo, uint32_t pid, uint64_t createTime, char *verdict);
+
+// Adds a process that was seen in this cycle. Returns zero if memory ran out.
+char ProcessMemoInsert(ProcessMemo *memo, uint32_t pid, uint64_t createTime, char verdict);
+
+// Removes a process that exited. Returns zero if it wasn't in the memo.
+char ProcessMemoRemove(ProcessMemo *memo, uint32_t pid, uint64_t createTime);
+
+// Evicts all processes that weren't seen since ProcessMemoBeginCycle. Returns how many were evicted.
+size_t ProcessMemoEndCycle(ProcessMemo *memo);
+
+// Replaces the verdict of every process with what the callback returns for it.
+void ProcessMemoRemap(ProcessMemo *memo, ProcessMemoRemapCallback cb, void *ctx);
+
+// Returns the bitwise OR of the verdicts of all the processes. Doesn't go over the processes, it's read off bitCounts.
+char ProcessMemoVerdictUnion(const ProcessMemo *memo);
+
+// Frees the memo's memory, leaving it empty and ready for reuse.
+void ProcessMemoFree(ProcessMemo *memo);
+
+#endif
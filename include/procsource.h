@@ -0,0 +1,76 @@
+#ifndef PROCSOURCE_H
+#define PROCSOURCE_H
+
+#include "whitelist.h"
+#include <stdint.h>
+
+// A running process as far as the whitelist is concerned.
+typedef struct
+{
+    uint32_t pid;
+    uint64_t createTime;
+    char isIdentified; // If not, pid and createTime mean nothing and the process can't be told apart from others.
+    WideSpan fields[PROCFIELD_NUMOF]; // Trimmed. Fields the process doesn't have get a NULL str.
+} ProcessInfo;
+
+typedef enum
+{
+    PROCSOURCE_PROCESS,
+    PROCSOURCE_END,
+    PROCSOURCE_ERROR,
+} ProcessSourceResult;
+
+typedef struct ProcessSource ProcessSource;
+
+// Enumerates the running processes. Every backend starts its struct with a ProcessSource, and is used through its vtbl like a COM object.
+// Enumerating is done in two phases because command lines are by far the most expensive field to get (WMI reads them out of each process's memory).
+// begin goes over all the processes but only promises their names, and beginSome goes over a few of them again with their command lines.
+typedef struct
+{
+    // Starts going over all the running processes. Returns zero if they can't be enumerated.
+    char (*begin)(ProcessSource *source);
+
+    // Starts going over the processes with the given PIDs which are still running, in any order. Their command lines can be read as well.
+    // Returns zero if they can't be enumerated. The PIDs are copied.
+    char (*beginSome)(ProcessSource *source, const uint32_t *pids, size_t npids);
+
+    // Fills in the identity of the next process. Its fields are only read if asked for with readField, since most processes are already known by their identity.
+    ProcessSourceResult (*next)(ProcessSource *source, ProcessInfo *process);
+
+    // Fills in one field of the process next just returned. It stays valid until next is called again.
+    void (*readField)(ProcessSource *source, ProcessInfo *process, ProcessField field);
+
+    void (*close)(ProcessSource *source);
+} ProcessSourceVtbl;
+
+struct ProcessSource
+{
+    const ProcessSourceVtbl *vtbl;
+};
+
+#ifndef _WIN32
+
+// Reads processes out of /proc, into buffers that are reused from one process to the next. Zero-initialize.
+typedef struct
+{
+    char *raw;
+    size_t rawSize;
+    wchar_t *wide[PROCFIELD_NUMOF];
+    size_t wideSize[PROCFIELD_NUMOF];
+} ProcfsReader;
+
+// Fills in the identity of the process from its stat. procfd is an open /proc directory.
+// Returns zero if the process is gone or is a kernel thread, which can't be whitelisted since it has no command line.
+char ProcfsReadIdentity(ProcfsReader *reader, int procfd, uint32_t pid, ProcessInfo *process);
+
+// Fills in a field of the process from its comm or cmdline. It stays valid until the reader reads the same field of another process.
+void ProcfsReadField(ProcfsReader *reader, int procfd, ProcessInfo *process, ProcessField field);
+
+void ProcfsReaderFree(ProcfsReader *reader);
+
+// A process source that goes over /proc. Returns NULL if /proc can't be opened.
+ProcessSource *ProcfsSourceOpen();
+
+#endif
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef REGEXSET_H
+#define REGEXSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
+
+// Where and why a pattern failed to compile.
+typedef struct
+{
+    const char *msg;
+    size_t pattern;     // Index of the bad pattern.
+    size_t pos;         // Character in the pattern where the problem was found.
+} RegexError;
+
+// Many regular expressions compiled into one automaton, so a string is scanned once no matter how many patterns there are.
+// Patterns are matched anywhere in the string unless anchored with ^ and $. The supported syntax is literals, '.', '[...]' classes
+// with ranges and negation, '\d', '\w', '\s' and their negations, grouping with '(...)', '|', '*', '+' and '?'.
+// Any other character can be escaped with a backslash to match it literally.
+//
+// The automaton is a lazy DFA: its states are built from the NFA the first time a scan needs them and cached,
+// so scanning takes linear time and almost never has to look at the NFA. The cache has a fixed budget and is flushed when it's full.
+// Since scanning fills the cache, a set mustn't be scanned by two threads at once.
+typedef struct RegexSet RegexSet;
+
+// Called for the patterns that match. Return nonzero to stop the scan.
+typedef char (*RegexSetCallback)(uint32_t pattern, void *ctx);
+
+// Compiles the patterns into a set. Patterns are identified by their index in the arrays.
+// Returns NULL and fills error if a pattern is invalid or memory ran out.
+RegexSet *RegexSetBuild(const wchar_t *const *patterns, const size_t *lens, size_t npatterns, RegexError *error);
+
+// Returns nonzero if the pattern compiles, otherwise fills error.
+char RegexCheck(const wchar_t *pattern, size_t len, RegexError *error);
+
+// Scans text once, calling onMatch for the patterns that match it. A pattern may be reported more than once.
+// Returns nonzero if onMatch stopped the scan.
+char RegexSetScan(RegexSet *rs, const wchar_t *text, size_t len, RegexSetCallback onMatch, void *ctx);
+
+// Returns the number of bytes the set is using, including its cache.
+size_t RegexSetSize(const RegexSet *rs);
+
+void RegexSetFree(RegexSet *rs);
+
+#endif
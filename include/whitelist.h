@@ -0,0 +1,114 @@
+#ifndef WHITELIST_H
+#define WHITELIST_H
+
+#include "ahocorasick.h"
+#include "exacttable.h"
+#include "regexset.h"
+#include "wildcard.h"
+#include "widestr.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Bit flags for which lists a set of whitelist entries belongs to.
+#define LIST_WHITELIST 0x1
+#define LIST_EXCLUSIVE 0x2
+
+typedef enum
+{
+    PROCFIELD_NAME,
+    PROCFIELD_CMDLINE,
+    PROCFIELD_NUMOF,
+} ProcessField;
+
+typedef enum
+{
+    MATCHKIND_EXACT,
+    MATCHKIND_SUBSTRING,
+    MATCHKIND_GLOB,
+    MATCHKIND_REGEX,
+    MATCHKIND_NUMOF,
+} MatchKind;
+
+// Not just any str rep will do, it needs to be the name that Win32_Process knows the field by.
+extern const wchar_t *const procfield_str[PROCFIELD_NUMOF];
+
+// All the entries with the same field and match kind. They're a contiguous range of the entry arrays,
+// so matching a group is a tight loop that doesn't need to look at each entry's flags.
+typedef struct
+{
+    uint32_t start; // Index of the group's first entry.
+    uint32_t count;
+    char lists;     // LIST_* flags of all the entries in the group.
+
+    // Substring groups with enough entries get an automaton and exact groups get a hash table.
+    // If it's NULL the group's entries are checked one by one.
+    AhoCorasick *automaton;
+    ExactTable *table;
+
+    // Glob groups always have their patterns split into segments, and regex groups are always compiled into one set.
+    WildcardSet *wildcards;
+    RegexSet *regexes;
+
+    char isBuilt; // Set once the matchers above are built or adopted from a previous whitelist.
+} WhitelistGroup;
+
+// Which lists gained or lost entries between two versions of the whitelist, as LIST_* flags.
+typedef struct
+{
+    char added;
+    char removed;
+} WhitelistDiff;
+
+// Called for every entry WhitelistMatch finds a match for.
+typedef void (*WhitelistMatchCallback)(size_t entry, ProcessField field, void *ctx);
+
+// The whitelist as the matcher wants it: a struct of arrays, sorted into groups, with all the values in one arena.
+// It's one block of memory (not counting the automatons and tables) which starts with this header.
+typedef struct
+{
+    size_t size;        // Size of the whole block in bytes, including this header.
+    size_t nentries;
+    size_t nchars;      // Characters of the arena in use.
+    uint32_t *offsets;  // Where each entry's value starts in the arena.
+    uint32_t *lens;
+    uint32_t *linenums; // Line of each entry in the whitelist file, for logging.
+    char *lists;        // LIST_* flag of each entry.
+    wchar_t *arena;
+    char isExclusiveExists;
+    WhitelistMatchCallback onMatch; // NULL unless the caller wants to know which entries matched, not just which lists.
+    void *onMatchCtx;
+    WhitelistGroup groups[PROCFIELD_NUMOF][MATCHKIND_NUMOF];
+} CompiledWhitelist;
+
+// Allocates an empty whitelist with room for counts[field][kind] entries in each group and nchars characters of values.
+// Returns NULL if memory ran out.
+CompiledWhitelist *WhitelistAlloc(const size_t counts[PROCFIELD_NUMOF][MATCHKIND_NUMOF], size_t nchars);
+
+// Adds an entry to its group. The group must have room for it, as promised to WhitelistAlloc.
+void WhitelistAddEntry(CompiledWhitelist *cw, ProcessField field, MatchKind kind, char list, uint32_t linenum, const wchar_t *value, size_t len);
+
+// Like WhitelistAddEntry, but instead of copying the value it returns where in the arena the caller should write its len characters.
+wchar_t *WhitelistReserveEntry(CompiledWhitelist *cw, ProcessField field, MatchKind kind, char list, uint32_t linenum, size_t len);
+
+// Takes the matchers of every group that has exactly the same entries in old and doesn't have its own yet, so WhitelistBuildMatchers only builds the groups that changed.
+// Call it once all the entries are in. Returns which lists gained or lost entries. Afterwards old can only be freed.
+WhitelistDiff WhitelistAdoptMatchers(CompiledWhitelist *cw, CompiledWhitelist *old);
+
+// Builds the automatons, tables, wildcard sets and regex sets of the groups that don't have them yet, once all the entries are in. If an automaton or table can't be built
+// its group is still matched, only slower. Returns zero if a wildcard or regex set couldn't be built, since then its group can't be matched at all.
+char WhitelistBuildMatchers(CompiledWhitelist *cw);
+
+// Returns the LIST_* flags of the lists the fields match. Only entries of the wanted lists are checked.
+// Fields with a NULL str are treated as missing and match nothing.
+char WhitelistMatch(const CompiledWhitelist *cw, const WideSpan *fields, char wanted);
+
+// Returns the LIST_* flags of the lists that have entries on the field. A process can't be matched to the other lists by that field, so it needn't be read for them.
+char WhitelistFieldLists(const CompiledWhitelist *cw, ProcessField field);
+
+// Returns the value of an entry.
+WideSpan WhitelistEntryValue(const CompiledWhitelist *cw, size_t entry);
+
+// Frees the whitelist along with its automatons and tables. Safe to call with NULL.
+void WhitelistFree(CompiledWhitelist *cw);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef WHITELISTCACHE_H
+#define WHITELISTCACHE_H
+
+#include "whitelist.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// Bump this whenever the layout of the compiled whitelist or any of its matchers changes, so old caches are ignored.
+#define WHITELIST_CACHE_VERSION 3
+
+// The cache holds a compiled whitelist together with its flat matchers (automatons, tables and wildcard sets),
+// keyed by a hash of the file it was compiled from. Regex sets aren't flat so they're always built again after loading.
+
+// Hashes the whitelist file. This is what the cache is keyed by.
+uint64_t WhitelistCacheHash(const void *data, size_t size);
+
+// Writes the whitelist to the file as the cache of the source with the given hash. Returns zero if writing failed.
+char WhitelistCacheSave(const CompiledWhitelist *cw, uint64_t sourceHash, FILE *file);
+
+// Loads a whitelist from a cache which was read or mapped to memory. Returns NULL if the cache is of another source or version, or is corrupt.
+// The whitelist has its own copy of everything, so the data can be let go of right after. Its regex groups still need WhitelistBuildMatchers.
+CompiledWhitelist *WhitelistCacheLoad(const void *data, size_t size, uint64_t sourceHash);
+
+#endif
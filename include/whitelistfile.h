@@ -0,0 +1,20 @@
+#ifndef WHITELISTFILE_H
+#define WHITELISTFILE_H
+
+#include "whitelist.h"
+#include <stddef.h>
+
+// Why the whitelist couldn't be parsed.
+typedef struct
+{
+    char isOutOfMemory; // If not set, the whitelist is invalid and msg says why.
+    int linenum;
+    char msg[256];
+} WhitelistParseError;
+
+// Parses the contents of a whitelist file into a compiled whitelist, without its matchers. Every line is checked first
+// and measured, so the whitelist is allocated once and each command is converted straight into its arena.
+// Returns NULL and fills error if the whitelist is invalid or memory ran out.
+CompiledWhitelist *WhitelistParse(const char *data, size_t size, WhitelistParseError *error);
+
+#endif
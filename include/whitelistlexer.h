@@ -0,0 +1,26 @@
+#ifndef WHITELISTLEXER_H
+#define WHITELISTLEXER_H
+
+#include <stddef.h>
+
+typedef enum
+{
+    LINE_EMPTY,         // Nothing but whitespace.
+    LINE_ENTRY,         // A command, maybe with flags.
+    LINE_MISSING_FLAGS, // Starts with ?? but has no flags after it.
+} LineKind;
+
+// A whitelist line split into its parts. The parts point into the line.
+typedef struct
+{
+    const char *flags;      // The flag characters after the ??, or NULL if the line doesn't start with ??.
+    size_t nflags;
+    const char *command;    // The command without surrounding whitespace. May be empty if the line has flags.
+    size_t ncommand;
+} WhitelistLine;
+
+// Splits one line of the whitelist (without its line break) in a single pass. The line looks like "??<flags> <command>" or just "<command>",
+// with any amount of whitespace around the parts.
+LineKind WhitelistLexLine(const char *line, size_t len, WhitelistLine *out);
+
+#endif
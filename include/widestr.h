@@ -0,0 +1,27 @@
+#ifndef WIDESTR_H
+#define WIDESTR_H
+
+#include <stddef.h>
+#include <wchar.h>
+
+// A view of part of a wide string. It doesn't have to be null-terminated, so trimming and matching never need to copy anything.
+typedef struct
+{
+    const wchar_t *str;
+    size_t len;
+} WideSpan;
+
+// Returns the span without its leading and trailing whitespace.
+WideSpan WideSpanTrim(WideSpan span);
+
+// Returns the first occurrence of needle in haystack, or NULL if there is none. Neither string needs to be null-terminated.
+// Uses SSE2 or AVX2 when the CPU has them, which makes a big difference for long command lines.
+const wchar_t *WideSearch(const wchar_t *haystack, size_t hlen, const wchar_t *needle, size_t nlen);
+
+// Portable version of WideSearch, exposed for comparing against the vectorized ones.
+const wchar_t *WideSearchScalar(const wchar_t *haystack, size_t hlen, const wchar_t *needle, size_t nlen);
+
+// Returns the name of the implementation WideSearch dispatches to, for logging.
+const char *WideSearchImplName();
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef WILDCARD_H
+#define WILDCARD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
+
+// A part of a pattern between two '*'s. It may contain '?'s, which match any single character.
+typedef struct
+{
+    uint32_t charsIdx;  // Index of the segment's first character in the chars array.
+    uint32_t len;
+    uint32_t runIdx;    // The longest run of the segment without a '?', relative to the segment. It's what gets searched for.
+    uint32_t runLen;
+} WildcardSegment;
+
+typedef struct
+{
+    uint32_t firstSegment;
+    uint32_t nsegments;
+    uint32_t minLen;        // A string shorter than the segments put together can't match.
+    char isAnchoredStart;   // The pattern doesn't start with a '*', so its first segment must be at the start of the string.
+    char isAnchoredEnd;     // Same for the end.
+} WildcardPattern;
+
+// Patterns with '*' and '?' wildcards, split into the literal segments between the '*'s when they're built.
+// A pattern has to match the whole string, which is checked by finding its segments one after the other with WideSearch.
+// Since each segment is found as early as possible and the search never goes back, that takes a single pass over the string.
+// Like ExactTable, everything lives in one block of memory which starts with this header.
+typedef struct
+{
+    size_t size; // Size of the whole block in bytes, including this header.
+    uint32_t npatterns;
+    uint32_t nsegments;
+    uint32_t patternsOffset;
+    uint32_t segmentsOffset;
+    uint32_t charsOffset;
+} WildcardSet;
+
+// Splits the patterns into segments. Patterns are identified by their index in the arrays. Returns NULL if memory ran out.
+WildcardSet *WildcardSetBuild(const wchar_t *const *patterns, const size_t *lens, size_t npatterns);
+
+// Returns nonzero if the pattern matches the whole text.
+char WildcardSetMatch(const WildcardSet *ws, uint32_t pattern, const wchar_t *text, size_t len);
+
+void WildcardSetFree(WildcardSet *ws);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef WMIPROCESS_H
+#define WMIPROCESS_H
+
+#include "procsource.h"
+#include "whitelist.h"
+#include <stdint.h>
+#include <wbemidl.h>
+
+// Reads what the whitelist needs out of Win32_Process objects, whether they came from a query or from an event.
+
+// Processes are identified by PID together with creation time, because PIDs get reused. Returns zero if the process can't be identified.
+char WmiGetProcessIdentity(IWbemClassObject *process, uint32_t *pid, uint64_t *createTime);
+
+// Sets span to the trimmed field of the process, or a NULL str if it doesn't have it. The span points into variant, which must be cleared with VariantClear
+// once the field isn't needed anymore unless it's VT_EMPTY.
+void WmiGetProcessField(IWbemClassObject *process, ProcessField field, VARIANT *variant, WideSpan *span);
+
+// Fills fields with the trimmed fields of the process. Fields the process doesn't have get a NULL str.
+// The spans point into variants, which must be passed to WmiClearProcessFields once the fields aren't needed anymore.
+void WmiGetProcessFields(IWbemClassObject *process, VARIANT variants[PROCFIELD_NUMOF], WideSpan fields[PROCFIELD_NUMOF]);
+
+void WmiClearProcessFields(VARIANT variants[PROCFIELD_NUMOF]);
+
+// A process source that queries Win32_Process. Command lines are only selected by beginSome. The services must outlive it. Returns NULL if memory ran out.
+ProcessSource *WmiProcessSourceOpen(IWbemServices *services);
+
+// Makes the source only select what the whitelist needs, and have WMI leave out the processes it can't match (see WqlPlanQuery).
+// The source only keeps the query, so the whitelist needn't outlive it. Returns zero if memory ran out, in which case every process is enumerated.
+char WmiProcessSourcePlan(ProcessSource *source, const CompiledWhitelist *cw);
+
+#endif
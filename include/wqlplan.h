@@ -0,0 +1,16 @@
+#ifndef WQLPLAN_H
+#define WQLPLAN_H
+
+#include "whitelist.h"
+#include <wchar.h>
+
+// Entries on the name beyond this many aren't worth filtering by, WMI takes longer to check a long WHERE than we take to match the names.
+#define WQLPLAN_MAX_FILTER_ENTRIES 64
+
+// Builds the WQL query that enumerates the processes the whitelist could match. Names are only selected if the whitelist has entries on them,
+// and if every entry is on the name and can be put as a LIKE, WMI filters out the processes that can't match before sending them back.
+// The filter only has to let through every process that could match, so it's fine that WMI compares without case while we don't.
+// Command lines are never selected, they're read separately for the few processes that need them. Returns a string to free, or NULL if memory ran out.
+wchar_t *WqlPlanQuery(const CompiledWhitelist *cw);
+
+#endif
@@ -0,0 +1,313 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "ahocorasick.h"
+#include <stdlib.h>     // For malloc and qsort.
+#include <string.h>     // For memset.
+
+#define NO_NODE UINT32_MAX
+#define NO_PATTERN -1
+
+typedef struct
+{
+    uint32_t firstEdge;
+    uint32_t nedges;
+    uint32_t fail;
+    int32_t firstPattern;   // First pattern which ends at this node, NO_PATTERN if none.
+    int32_t dictLink;       // Closest node along the fail chain which has patterns ending at it, NO_PATTERN if none.
+} AcNode;
+
+typedef struct
+{
+    uint32_t c;
+    uint32_t target;
+} AcEdge;
+
+// The trie while it's being built, before it's flattened into the final block.
+typedef struct
+{
+    int32_t firstChild;
+    int32_t firstPattern;
+} TrieNode;
+
+typedef struct
+{
+    uint32_t c;
+    uint32_t target;
+    int32_t nextSibling;
+} TrieEdge;
+
+static uint32_t TrieFindChild(const TrieNode *nodes, const TrieEdge *edges, uint32_t node, uint32_t c);
+static uint32_t FindChild(const AcNode *nodes, const AcEdge *edges, uint32_t node, uint32_t c);
+static int CompareEdges(const void *a, const void *b);
+static void *GrowArray(void *arr, size_t *capacity, size_t needed, size_t elemsz);
+
+AhoCorasick *AhoCorasickBuild(const wchar_t *const *patterns, const size_t *lens, size_t npatterns)
+{
+    AhoCorasick *ac = NULL;
+    TrieNode *tnodes = NULL;
+    TrieEdge *tedges = NULL;
+    int32_t *patternNext = NULL;
+    uint32_t *queue = NULL;
+    size_t nodesCap = 0, edgesCap = 0;
+    uint32_t nnodes = 1, nedges = 0;
+
+    if ((patternNext = malloc(npatterns * sizeof(*patternNext) + 1)) == NULL) goto cleanup;
+    if ((tnodes = GrowArray(NULL, &nodesCap, 1, sizeof(*tnodes))) == NULL) goto cleanup;
+    tnodes[0].firstChild = -1;
+    tnodes[0].firstPattern = NO_PATTERN;
+
+    // Phase 1: build a plain trie of all the patterns.
+    for (size_t p = 0; p < npatterns; p++)
+    {
+        uint32_t node = 0;
+        patternNext[p] = NO_PATTERN;
+
+        if (lens[p] == 0) continue;
+
+        for (size_t i = 0; i < lens[p]; i++)
+        {
+            uint32_t c = (uint32_t)patterns[p][i];
+            uint32_t child = TrieFindChild(tnodes, tedges, node, c);
+
+            if (child == NO_NODE)
+            {
+                TrieNode *newNodes = GrowArray(tnodes, &nodesCap, nnodes + 1, sizeof(*tnodes));
+                if (newNodes == NULL) goto cleanup;
+                tnodes = newNodes;
+
+                TrieEdge *newEdges = GrowArray(tedges, &edgesCap, nedges + 1, sizeof(*tedges));
+                if (newEdges == NULL) goto cleanup;
+                tedges = newEdges;
+
+                child = nnodes++;
+                tnodes[child].firstChild = -1;
+                tnodes[child].firstPattern = NO_PATTERN;
+
+                tedges[nedges].c = c;
+                tedges[nedges].target = child;
+                tedges[nedges].nextSibling = tnodes[node].firstChild;
+                tnodes[node].firstChild = nedges++;
+            }
+
+            node = child;
+        }
+
+        // Chain the pattern to the end of the node's list so they're reported in the order they were given.
+        int32_t *link = &tnodes[node].firstPattern;
+        while (*link != NO_PATTERN) link = &patternNext[*link];
+        *link = p;
+    }
+
+    // Phase 2: flatten the trie into one block, with each node's edges contiguous and sorted for binary searching.
+    size_t nodesOffset = sizeof(AhoCorasick);
+    size_t edgesOffset = nodesOffset + nnodes * sizeof(AcNode);
+    size_t patternNextOffset = edgesOffset + nedges * sizeof(AcEdge);
+    size_t size = patternNextOffset + npatterns * sizeof(int32_t);
+
+    if ((ac = malloc(size)) == NULL) goto cleanup;
+
+    memset(ac, 0, sizeof(*ac));
+    ac->size = size;
+    ac->npatterns = npatterns;
+    ac->nnodes = nnodes;
+    ac->nedges = nedges;
+    ac->nodesOffset = nodesOffset;
+    ac->edgesOffset = edgesOffset;
+    ac->patternNextOffset = patternNextOffset;
+
+    AcNode *nodes = (AcNode *)((char *)ac + nodesOffset);
+    AcEdge *edges = (AcEdge *)((char *)ac + edgesOffset);
+    memcpy((char *)ac + patternNextOffset, patternNext, npatterns * sizeof(int32_t));
+
+    for (uint32_t n = 0, e = 0; n < nnodes; n++)
+    {
+        nodes[n].firstEdge = e;
+        nodes[n].nedges = 0;
+        nodes[n].fail = 0;
+        nodes[n].firstPattern = tnodes[n].firstPattern;
+        nodes[n].dictLink = NO_PATTERN;
+
+        for (int32_t te = tnodes[n].firstChild; te != -1; te = tedges[te].nextSibling, e++, nodes[n].nedges++)
+        {
+            edges[e].c = tedges[te].c;
+            edges[e].target = tedges[te].target;
+        }
+
+        qsort(&edges[nodes[n].firstEdge], nodes[n].nedges, sizeof(*edges), CompareEdges);
+    }
+
+    // Phase 3: compute the fail and dictionary links breadth-first, so a node's links are ready before its children need them.
+    if ((queue = malloc(nnodes * sizeof(*queue))) == NULL)
+    {
+        free(ac);
+        ac = NULL;
+        goto cleanup;
+    }
+
+    size_t head = 0, tail = 0;
+    queue[tail++] = 0;
+
+    while (head < tail)
+    {
+        uint32_t parent = queue[head++];
+
+        for (uint32_t e = nodes[parent].firstEdge; e < nodes[parent].firstEdge + nodes[parent].nedges; e++)
+        {
+            uint32_t child = edges[e].target;
+            uint32_t fail = 0;
+
+            if (parent != 0)
+            {
+                uint32_t f = nodes[parent].fail;
+                uint32_t next;
+
+                while ((next = FindChild(nodes, edges, f, edges[e].c)) == NO_NODE && f != 0) f = nodes[f].fail;
+                fail = next == NO_NODE ? 0 : next;
+            }
+
+            nodes[child].fail = fail;
+            nodes[child].dictLink = nodes[fail].firstPattern != NO_PATTERN ? (int32_t)fail : nodes[fail].dictLink;
+            queue[tail++] = child;
+        }
+    }
+
+    // The root never fails, so its transitions are known upfront for every character.
+    for (uint32_t c = 0; c < AC_ROOT_TABLE_SIZE; c++)
+    {
+        uint32_t next = FindChild(nodes, edges, 0, c);
+        ac->rootTable[c] = next == NO_NODE ? 0 : next;
+    }
+
+cleanup:
+    free(queue);
+    free(patternNext);
+    free(tedges);
+    free(tnodes);
+    return ac;
+}
+
+char AhoCorasickScan(const AhoCorasick *ac, const wchar_t *text, size_t len, AhoCorasickCallback onMatch, void *ctx)
+{
+    const AcNode *nodes = (const AcNode *)((const char *)ac + ac->nodesOffset);
+    const AcEdge *edges = (const AcEdge *)((const char *)ac + ac->edgesOffset);
+    const int32_t *patternNext = (const int32_t *)((const char *)ac + ac->patternNextOffset);
+    uint32_t state = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        uint32_t c = (uint32_t)text[i];
+
+        for (;;)
+        {
+            if (state == 0)
+            {
+                if (c < AC_ROOT_TABLE_SIZE)
+                {
+                    state = ac->rootTable[c];
+                }
+                else
+                {
+                    uint32_t next = FindChild(nodes, edges, 0, c);
+                    state = next == NO_NODE ? 0 : next;
+                }
+
+                break;
+            }
+
+            uint32_t next = FindChild(nodes, edges, state, c);
+
+            if (next != NO_NODE)
+            {
+                state = next;
+                break;
+            }
+
+            state = nodes[state].fail;
+        }
+
+        // Report every pattern ending here: the ones at this node and the ones at its suffixes.
+        int32_t out = nodes[state].firstPattern != NO_PATTERN ? (int32_t)state : nodes[state].dictLink;
+
+        for (; out != NO_PATTERN; out = nodes[out].dictLink)
+        {
+            for (int32_t p = nodes[out].firstPattern; p != NO_PATTERN; p = patternNext[p])
+            {
+                if (onMatch(p, ctx)) return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+void AhoCorasickFree(AhoCorasick *ac)
+{
+    free(ac);
+}
+
+static uint32_t TrieFindChild(const TrieNode *nodes, const TrieEdge *edges, uint32_t node, uint32_t c)
+{
+    for (int32_t e = nodes[node].firstChild; e != -1; e = edges[e].nextSibling)
+    {
+        if (edges[e].c == c) return edges[e].target;
+    }
+
+    return NO_NODE;
+}
+
+static uint32_t FindChild(const AcNode *nodes, const AcEdge *edges, uint32_t node, uint32_t c)
+{
+    const AcEdge *lo = &edges[nodes[node].firstEdge];
+    size_t n = nodes[node].nedges;
+
+    while (n > 0)
+    {
+        size_t half = n / 2;
+
+        if (lo[half].c < c)
+        {
+            lo += half + 1;
+            n -= half + 1;
+        }
+        else
+        {
+            n = half;
+        }
+    }
+
+    return lo != &edges[nodes[node].firstEdge + nodes[node].nedges] && lo->c == c ? lo->target : NO_NODE;
+}
+
+static int CompareEdges(const void *a, const void *b)
+{
+    uint32_t ca = ((const AcEdge *)a)->c;
+    uint32_t cb = ((const AcEdge *)b)->c;
+    return (ca > cb) - (ca < cb);
+}
+
+// Doubles the capacity of arr until it fits needed elements. Returns NULL (and leaves arr untouched) on failure.
+static void *GrowArray(void *arr, size_t *capacity, size_t needed, size_t elemsz)
+{
+    if (needed <= *capacity) return arr;
+
+    size_t newCapacity = *capacity == 0 ? 16 : *capacity;
+    while (newCapacity < needed) newCapacity *= 2;
+
+    void *newArr = realloc(arr, newCapacity * elemsz);
+    if (newArr != NULL) *capacity = newCapacity;
+    return newArr;
+}
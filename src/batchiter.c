@@ -0,0 +1,103 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "batchiter.h"
+#include <stdlib.h>     // For malloc.
+#include <string.h>     // For memset.
+
+static void ReleaseRemaining(BatchIterator *it);
+
+char BatchIteratorInit(BatchIterator *it, size_t batchSize, uint32_t timeoutMs, uint32_t maxIdleMs, BatchFetchCallback fetch, BatchReleaseCallback release, void *ctx)
+{
+    memset(it, 0, sizeof(*it));
+
+    if ((it->items = malloc(batchSize * sizeof(*it->items))) == NULL)
+    {
+        return 0;
+    }
+
+    it->fetch = fetch;
+    it->release = release;
+    it->ctx = ctx;
+    it->batchSize = batchSize;
+    it->timeoutMs = timeoutMs;
+    it->maxIdleMs = maxIdleMs;
+    return 1;
+}
+
+BatchResult BatchIteratorNext(BatchIterator *it, void **item)
+{
+    while (it->pos == it->nitems)
+    {
+        if (it->isFailed) return BATCH_ERROR;
+        if (it->isEnded) return BATCH_END;
+
+        size_t nfetched = 0;
+        BatchFetchResult res = it->fetch(it->ctx, it->items, it->batchSize, it->timeoutMs, &nfetched);
+
+        it->nitems = nfetched;
+        it->pos = 0;
+
+        if (res == FETCH_ERROR)
+        {
+            ReleaseRemaining(it);
+            it->isFailed = 1;
+        }
+        else if (res == FETCH_END)
+        {
+            it->isEnded = 1;
+        }
+        else if (res == FETCH_TIMEOUT && nfetched == 0)
+        {
+            // A slow enumerator gets more time, but one that sends nothing for too long is given up on instead of waited on forever.
+            it->idleMs += it->timeoutMs;
+            it->isFailed = it->idleMs >= it->maxIdleMs;
+        }
+        else
+        {
+            it->idleMs = 0;
+        }
+    }
+
+    *item = it->items[it->pos++];
+    return BATCH_ITEM;
+}
+
+void BatchIteratorRestart(BatchIterator *it)
+{
+    ReleaseRemaining(it);
+    it->idleMs = 0;
+    it->isEnded = 0;
+    it->isFailed = 0;
+}
+
+void BatchIteratorFree(BatchIterator *it)
+{
+    if (it->items != NULL) BatchIteratorRestart(it);
+    free(it->items);
+    memset(it, 0, sizeof(*it));
+}
+
+static void ReleaseRemaining(BatchIterator *it)
+{
+    for (; it->pos < it->nitems; it->pos++)
+    {
+        it->release(it->ctx, it->items[it->pos]);
+    }
+
+    it->pos = 0;
+    it->nitems = 0;
+}
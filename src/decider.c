@@ -0,0 +1,105 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "decider.h"
+
+// How many toggles in a row mean that another program is fighting us over Shadowplay.
+#define MIN_STREAK_FOR_CONFLICT 3
+_Static_assert(MIN_STREAK_FOR_CONFLICT >= 2, "At least 2 attempts (1 retry) are needed to identify a conflict.");
+
+static char IsInConflict(const Decider *decider, uint64_t nowMs);
+
+void DeciderInit(Decider *decider, uint32_t minIntervalSec, uint32_t maxIntervalSec, uint32_t conflictBackoffSec)
+{
+    decider->conflictBackoffSec = conflictBackoffSec;
+    PollSchedulerInit(&decider->scheduler, minIntervalSec, maxIntervalSec);
+    decider->toggleStreak = 0;
+    decider->conflictStartMs = 0;
+    decider->lastPolledState = -1;
+}
+
+char DeciderIsObserving(const Decider *decider, const DeciderInputs *inputs)
+{
+    return !inputs->isDisabled && !IsInConflict(decider, inputs->nowMs);
+}
+
+DeciderActions DeciderStep(Decider *decider, const DeciderInputs *inputs)
+{
+    DeciderActions actions = {0};
+
+    // Whatever the user asked for should be followed up on soon, and so should a new whitelist.
+    char isChanged = inputs->isWoken || inputs->isReloaded;
+
+    if (inputs->isDisabled) goto end_streak;
+
+    // If we find ourselves in conflict with some program that also tries to control Shadowplay,
+    // we'll "yield" by leaving it alone for a while so we don't fight it as much.
+    if (decider->toggleStreak >= MIN_STREAK_FOR_CONFLICT)
+    {
+        if (IsInConflict(decider, inputs->nowMs)) goto schedule; // Keeps the streak.
+
+        // On cycles where we want to make an attempt despite being in a streak, we'll need 2 attempts to know if we are still in conflict.
+        decider->toggleStreak = MIN_STREAK_FOR_CONFLICT - 2;
+        actions.isConflictRetried = 1;
+    }
+
+    // Processes are only left unpolled when Instant Replay is on and there's no exclusives list, in which case there's nothing to toggle.
+    if (!inputs->isPolled) goto end_streak;
+
+    // Only a change in what the decision is made from counts. Processes come and go all the time without making a difference.
+    char polledState = inputs->isInstantReplayOn | inputs->isWhitelistedRunning << 1 | inputs->isExclusiveRunning << 2;
+
+    if (polledState != decider->lastPolledState)
+    {
+        decider->lastPolledState = polledState;
+        isChanged = 1;
+    }
+
+    // Whitelist disables AlwaysShadow, taking precedence over Exclusives list.
+    if (inputs->isWhitelistedRunning) goto end_streak;
+
+    char isOn = inputs->isInstantReplayOn;
+
+    if ((!isOn && (!inputs->isExclusiveExists || inputs->isExclusiveRunning)) || // Conditions for toggling ON.
+        (isOn && inputs->isExclusiveExists && !inputs->isExclusiveRunning)) // Conditions for toggling OFF.
+    {
+        if (++decider->toggleStreak == MIN_STREAK_FOR_CONFLICT)
+        {
+            actions.isConflictEntered = 1;
+            decider->conflictStartMs = inputs->nowMs;
+        }
+        else
+        {
+            // The next poll confirms that the toggle went through.
+            actions.isToggling = 1;
+            isChanged = 1;
+        }
+
+        goto schedule; // Skip ending the streak.
+    }
+
+end_streak:
+    decider->toggleStreak = 0;
+
+schedule:
+    actions.intervalSec = PollSchedulerNext(&decider->scheduler, isChanged);
+    return actions;
+}
+
+static char IsInConflict(const Decider *decider, uint64_t nowMs)
+{
+    return decider->toggleStreak >= MIN_STREAK_FOR_CONFLICT && nowMs - decider->conflictStartMs < (uint64_t)decider->conflictBackoffSec * 1000;
+}
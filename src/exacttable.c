@@ -0,0 +1,142 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "exacttable.h"
+#include <stdlib.h>     // For malloc.
+#include <string.h>     // For memset.
+
+#define EMPTY_BUCKET UINT32_MAX
+
+typedef struct
+{
+    uint32_t hash;
+    uint32_t tag;
+    uint32_t len;
+    uint32_t charsIdx;  // Index of the key's first character in the chars array.
+    int32_t next;       // Next key with the same tag and value, EXACT_NOT_FOUND if none.
+} ExactKey;
+
+static uint32_t HashKey(uint32_t tag, const wchar_t *key, size_t len);
+static char IsKeyEqual(const ExactKey *k, const wchar_t *chars, uint32_t hash, uint32_t tag, const wchar_t *key, size_t len);
+
+ExactTable *ExactTableBuild(const wchar_t *const *keys, const size_t *lens, const uint32_t *tags, size_t nkeys)
+{
+    // Keep the load factor at most 1/2 so probe sequences stay short.
+    uint32_t nbuckets = 16;
+    while (nbuckets < nkeys * 2) nbuckets *= 2;
+
+    size_t nchars = 0;
+    for (size_t i = 0; i < nkeys; i++) nchars += lens[i];
+
+    size_t bucketsOffset = sizeof(ExactTable);
+    size_t keysOffset = bucketsOffset + nbuckets * sizeof(uint32_t);
+    size_t charsOffset = keysOffset + nkeys * sizeof(ExactKey);
+    size_t size = charsOffset + nchars * sizeof(wchar_t);
+    ExactTable *table = malloc(size);
+
+    if (table == NULL)
+    {
+        return NULL;
+    }
+
+    memset(table, 0, sizeof(*table));
+    table->size = size;
+    table->nkeys = nkeys;
+    table->nbuckets = nbuckets;
+    table->bucketsOffset = bucketsOffset;
+    table->keysOffset = keysOffset;
+    table->charsOffset = charsOffset;
+
+    uint32_t *buckets = (uint32_t *)((char *)table + bucketsOffset);
+    ExactKey *tkeys = (ExactKey *)((char *)table + keysOffset);
+    wchar_t *chars = (wchar_t *)((char *)table + charsOffset);
+    memset(buckets, 0xff, nbuckets * sizeof(*buckets));
+
+    for (uint32_t i = 0, charsIdx = 0; i < nkeys; charsIdx += lens[i], i++)
+    {
+        ExactKey *k = &tkeys[i];
+        k->tag = tags == NULL ? 0 : tags[i];
+        k->hash = HashKey(k->tag, keys[i], lens[i]);
+        k->len = lens[i];
+        k->charsIdx = charsIdx;
+        k->next = EXACT_NOT_FOUND;
+        wmemcpy(&chars[charsIdx], keys[i], lens[i]);
+
+        uint32_t b = k->hash & (nbuckets - 1);
+
+        for (; buckets[b] != EMPTY_BUCKET; b = (b + 1) & (nbuckets - 1))
+        {
+            ExactKey *other = &tkeys[buckets[b]];
+
+            // Duplicates don't take a bucket of their own, they're chained to the end of the first one.
+            if (IsKeyEqual(other, chars, k->hash, k->tag, keys[i], lens[i]))
+            {
+                while (other->next != EXACT_NOT_FOUND) other = &tkeys[other->next];
+                other->next = i;
+                break;
+            }
+        }
+
+        if (buckets[b] == EMPTY_BUCKET) buckets[b] = i;
+    }
+
+    return table;
+}
+
+int32_t ExactTableFind(const ExactTable *table, uint32_t tag, const wchar_t *key, size_t len)
+{
+    const uint32_t *buckets = (const uint32_t *)((const char *)table + table->bucketsOffset);
+    const ExactKey *keys = (const ExactKey *)((const char *)table + table->keysOffset);
+    const wchar_t *chars = (const wchar_t *)((const char *)table + table->charsOffset);
+    uint32_t hash = HashKey(tag, key, len);
+
+    for (uint32_t b = hash & (table->nbuckets - 1); buckets[b] != EMPTY_BUCKET; b = (b + 1) & (table->nbuckets - 1))
+    {
+        if (IsKeyEqual(&keys[buckets[b]], chars, hash, tag, key, len)) return buckets[b];
+    }
+
+    return EXACT_NOT_FOUND;
+}
+
+int32_t ExactTableNext(const ExactTable *table, int32_t id)
+{
+    const ExactKey *keys = (const ExactKey *)((const char *)table + table->keysOffset);
+    return keys[id].next;
+}
+
+void ExactTableFree(ExactTable *table)
+{
+    free(table);
+}
+
+// FNV-1a over the tag and the characters.
+static uint32_t HashKey(uint32_t tag, const wchar_t *key, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    hash = (hash ^ tag) * 16777619u;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ (uint32_t)key[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static char IsKeyEqual(const ExactKey *k, const wchar_t *chars, uint32_t hash, uint32_t tag, const wchar_t *key, size_t len)
+{
+    return k->hash == hash && k->tag == tag && k->len == len && wmemcmp(&chars[k->charsIdx], key, len) == 0;
+}
@@ -0,0 +1,118 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _WIN32
+
+#include "fdnotify.h"
+#include <errno.h>      // For waiting again when interrupted.
+#include <pthread.h>    // For the thread that waits.
+#include <stdint.h>     // For uint64_t.
+#include <stdlib.h>     // For malloc.
+#include <unistd.h>     // For close.
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+struct FdNotifier
+{
+    int epollfd;
+    int stopfd; // Becomes readable when it's time for the thread to stop.
+    pthread_t thread;
+    FdNotifyCallback onArrival;
+    void *ctx;
+};
+
+static void *NotifyLoop(void *arg);
+static void CloseFds(FdNotifier *fn);
+
+FdNotifier *FdNotifierStart(int fd, FdNotifyCallback onArrival, void *ctx)
+{
+    FdNotifier *fn = malloc(sizeof(*fn));
+
+    if (fn == NULL)
+    {
+        return NULL;
+    }
+
+    fn->onArrival = onArrival;
+    fn->ctx = ctx;
+    fn->stopfd = -1;
+
+    // Edge triggered, so what waits to be read until its reader gets to it isn't told of over and over.
+    struct epoll_event arrival = { .events = EPOLLIN | EPOLLET, .data.fd = fd };
+    struct epoll_event stop = { .events = EPOLLIN };
+
+    if ((fn->epollfd = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+        (fn->stopfd = stop.data.fd = eventfd(0, EFD_CLOEXEC)) == -1 ||
+        epoll_ctl(fn->epollfd, EPOLL_CTL_ADD, fd, &arrival) == -1 ||
+        epoll_ctl(fn->epollfd, EPOLL_CTL_ADD, fn->stopfd, &stop) == -1 ||
+        pthread_create(&fn->thread, NULL, NotifyLoop, fn) != 0)
+    {
+        CloseFds(fn);
+        free(fn);
+        return NULL;
+    }
+
+    return fn;
+}
+
+void FdNotifierStop(FdNotifier *fn)
+{
+    uint64_t one = 1;
+
+    if (fn == NULL)
+    {
+        return;
+    }
+
+    // Waiting is a cancellation point, so the thread can be stopped that way too if the eventfd can't be written.
+    if (write(fn->stopfd, &one, sizeof(one)) != sizeof(one)) pthread_cancel(fn->thread);
+
+    pthread_join(fn->thread, NULL);
+    CloseFds(fn);
+    free(fn);
+}
+
+static void *NotifyLoop(void *arg)
+{
+    FdNotifier *fn = arg;
+    struct epoll_event events[2];
+
+    for (;;)
+    {
+        int n = epoll_wait(fn->epollfd, events, 2, -1);
+
+        // If waiting fails there are no more callbacks, but the reader still gets to what arrived whenever it reads next.
+        if (n == -1 && errno != EINTR)
+        {
+            return NULL;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.fd == fn->stopfd) return NULL;
+        }
+
+        if (n > 0) fn->onArrival(fn->ctx);
+    }
+}
+
+static void CloseFds(FdNotifier *fn)
+{
+    if (fn->epollfd >= 0) close(fn->epollfd);
+    if (fn->stopfd >= 0) close(fn->stopfd);
+}
+
+#endif
@@ -0,0 +1,238 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "filewatch.h"
+#include <stdlib.h>     // For malloc.
+#include <string.h>     // For comparing names.
+
+#ifdef _WIN32
+
+#include <windows.h>    // For ReadDirectoryChangesW.
+
+struct FileWatch
+{
+    HANDLE dir;
+    HANDLE event;
+    HANDLE wait; // Calls onChange when the event is set.
+    FileWatchCallback onChange;
+    void *ctx;
+    OVERLAPPED overlapped;
+    char isArmed; // A read of the changes is in flight.
+    WCHAR name[MAX_PATH];
+    size_t nameLen;
+    DWORD buffer[1 << 12]; // ReadDirectoryChangesW wants it DWORD aligned.
+};
+
+static char Arm(FileWatch *fw);
+static char HasName(const FileWatch *fw, DWORD nbytes);
+static VOID CALLBACK OnEventSet(PVOID arg, BOOLEAN isTimedOut);
+
+FileWatch *FileWatchOpen(const char *dir, const char *name, FileWatchCallback onChange, void *ctx)
+{
+    FileWatch *fw = malloc(sizeof(*fw));
+
+    if (fw == NULL)
+    {
+        return NULL;
+    }
+
+    fw->event = NULL;
+    fw->wait = NULL;
+    fw->onChange = onChange;
+    fw->ctx = ctx;
+    fw->isArmed = 0;
+    fw->dir = CreateFileA(dir, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+
+    // The event resets itself once the wait sees it, so each read that completes calls back once. Polls don't wait on it.
+    if (fw->dir == INVALID_HANDLE_VALUE ||
+        (fw->event = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL ||
+        (fw->nameLen = MultiByteToWideChar(CP_ACP, 0, name, -1, fw->name, MAX_PATH)) == 0 ||
+        !Arm(fw))
+    {
+        FileWatchClose(fw);
+        return NULL;
+    }
+
+    if (onChange != NULL && !RegisterWaitForSingleObject(&fw->wait, fw->event, OnEventSet, fw, INFINITE, WT_EXECUTEDEFAULT))
+    {
+        fw->wait = NULL;
+        FileWatchClose(fw);
+        return NULL;
+    }
+
+    fw->nameLen--; // Not counting the null terminator.
+    return fw;
+}
+
+char FileWatchPoll(FileWatch *fw)
+{
+    char isChanged = 0;
+    DWORD nbytes;
+
+    // Changes that happen between reads are buffered by the system, so none are missed by re-arming after each one.
+    while (fw->isArmed && GetOverlappedResult(fw->dir, &fw->overlapped, &nbytes, FALSE))
+    {
+        // Zero bytes means there were too many changes to fit in the buffer, so the file may be one of them.
+        if (nbytes == 0 || HasName(fw, nbytes)) isChanged = 1;
+        Arm(fw);
+    }
+
+    return isChanged;
+}
+
+void FileWatchClose(FileWatch *fw)
+{
+    if (fw == NULL)
+    {
+        return;
+    }
+
+    // Waits for a callback in progress to return.
+    if (fw->wait != NULL) UnregisterWaitEx(fw->wait, INVALID_HANDLE_VALUE);
+
+    if (fw->isArmed)
+    {
+        DWORD nbytes;
+        CancelIo(fw->dir);
+        GetOverlappedResult(fw->dir, &fw->overlapped, &nbytes, TRUE); // The buffer can't be freed while the read is still writing to it.
+    }
+
+    if (fw->dir != INVALID_HANDLE_VALUE) CloseHandle(fw->dir);
+    if (fw->event != NULL) CloseHandle(fw->event);
+    free(fw);
+}
+
+static char Arm(FileWatch *fw)
+{
+    memset(&fw->overlapped, 0, sizeof(fw->overlapped));
+    fw->overlapped.hEvent = fw->event;
+    fw->isArmed = ReadDirectoryChangesW(fw->dir, fw->buffer, sizeof(fw->buffer), FALSE,
+        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE, NULL, &fw->overlapped, NULL) != 0;
+    return fw->isArmed;
+}
+
+static VOID CALLBACK OnEventSet(PVOID arg, BOOLEAN isTimedOut)
+{
+    FileWatch *fw = arg;
+    fw->onChange(fw->ctx);
+}
+
+// Returns nonzero if one of the changes in the buffer is to the watched file. File names on Windows are case insensitive.
+static char HasName(const FileWatch *fw, DWORD nbytes)
+{
+    const char *pos = (const char *)fw->buffer;
+
+    while (pos < (const char *)fw->buffer + nbytes)
+    {
+        const FILE_NOTIFY_INFORMATION *info = (const FILE_NOTIFY_INFORMATION *)pos;
+
+        if (info->FileNameLength / sizeof(WCHAR) == fw->nameLen && _wcsnicmp(info->FileName, fw->name, fw->nameLen) == 0)
+        {
+            return 1;
+        }
+
+        if (info->NextEntryOffset == 0) break;
+        pos += info->NextEntryOffset;
+    }
+
+    return 0;
+}
+
+#else
+
+#include "fdnotify.h"   // For telling the watcher of changes.
+#include <limits.h>     // For NAME_MAX.
+#include <sys/inotify.h>
+#include <unistd.h>     // For read and close.
+
+struct FileWatch
+{
+    int fd;
+    FdNotifier *notifier;
+    char name[NAME_MAX + 1];
+};
+
+FileWatch *FileWatchOpen(const char *dir, const char *name, FileWatchCallback onChange, void *ctx)
+{
+    FileWatch *fw = malloc(sizeof(*fw));
+
+    if (fw == NULL)
+    {
+        return NULL;
+    }
+
+    if (strlen(name) >= sizeof(fw->name))
+    {
+        free(fw);
+        return NULL;
+    }
+
+    strcpy(fw->name, name);
+    fw->notifier = NULL;
+
+    // Editors either write the file in place, or write a new one and rename it over the old one.
+    if ((fw->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0 ||
+        inotify_add_watch(fw->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0 ||
+        (onChange != NULL && (fw->notifier = FdNotifierStart(fw->fd, onChange, ctx)) == NULL))
+    {
+        FileWatchClose(fw);
+        return NULL;
+    }
+
+    return fw;
+}
+
+char FileWatchPoll(FileWatch *fw)
+{
+    char buffer[1 << 12] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char isChanged = 0;
+    ssize_t nbytes;
+
+    // Reads fail with EAGAIN once there are no more events.
+    while ((nbytes = read(fw->fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (const char *pos = buffer; pos < buffer + nbytes;)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)pos;
+
+            // On overflow some events were dropped, so the file may be one of them.
+            if ((event->mask & IN_Q_OVERFLOW) || (event->len > 0 && strcmp(event->name, fw->name) == 0))
+            {
+                isChanged = 1;
+            }
+
+            pos += sizeof(*event) + event->len;
+        }
+    }
+
+    return isChanged;
+}
+
+void FileWatchClose(FileWatch *fw)
+{
+    if (fw == NULL)
+    {
+        return;
+    }
+
+    // The notifier waits on the inotify descriptor, so it has to stop before it's closed.
+    FdNotifierStop(fw->notifier);
+    if (fw->fd >= 0) close(fw->fd);
+    free(fw);
+}
+
+#endif
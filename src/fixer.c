@@ -16,51 +16,123 @@
 
 #include "defines.h"
 #include "cJSON.h"      // For parsing the file with the port and secret for Shadowplay's local server.
+#include "whitelist.h"  // For the compiled whitelist and matching processes against it.
+#include "widestr.h"    // For trimming process fields without copying them.
+#include "whitelistfile.h" // For parsing the whitelist.
+#include "procmemo.h"   // For remembering which processes match the whitelist.
+#include "filewatch.h"  // For reloading the whitelist when it changes.
+#include "whitelistcache.h" // For loading the compiled whitelist without parsing it.
+#include "procevents.h" // For keeping up with processes as they start and exit instead of enumerating them all every poll.
+#include "procsource.h" // For enumerating the running processes.
+#include "wmiprocess.h" // For enumerating the running processes through WMI.
+#include "decider.h"    // For deciding what to do each cycle and how long to wait between them.
+#include "fixerwake.h"  // For waiting between cycles.
 #include <tchar.h>      // For dealing with unicode and ANSI strings.
 #include <pthread.h>    // For multithreading.
 #include <unistd.h>     // For sleep.
+#include <errno.h>      // For telling why the whitelist cache couldn't be saved.
+#include <time.h>       // For timing cycles.
 #include <wbemidl.h>    // For getting the command line of running processes.
 #include <oleauto.h>    // For working with BSTRs.
-#include <regex.h>      // For parsing the whitelist.
+#include <shlobj.h>     // For getting the LocalAppData path where the whitelist cache is kept.
 #include <curl/curl.h>  // For sending requests to Shadowplay's local server which toggles recording on and off.
 
 #define _WIN32_DCOM // This came with the whitelisting function which I dare not touch.
 
-#define MIN_STREAK_FOR_CONFLICT 3
-_Static_assert(MIN_STREAK_FOR_CONFLICT >= 2, "At least 2 attempts (1 retry) are needed to identify a conflict.");
-
 // Support high frequency polling option for debugging.
+// Polls come at the shortest interval after anything changes, and back off to the longest one while nothing does. Starting processes
+// and changing the whitelist wake the fixer right away, so the longest interval is only how long it sleeps while nothing happens.
+// The shortest interval has to leave Shadowplay time to act on a toggle, or the poll after it would toggle again.
 #ifdef HIGH_FREQUENCY_POLLING
-#define POLLING_FREQUENCY_SEC 5
+#define POLLING_MIN_INTERVAL_SEC 5
+#define POLLING_DEFAULT_MAX_INTERVAL_SEC 10
 #define POLLING_FREQUENCY_IN_CONFLICT_SEC 30
 #else
-#define POLLING_FREQUENCY_SEC 10
+#define POLLING_MIN_INTERVAL_SEC 5
+#define POLLING_DEFAULT_MAX_INTERVAL_SEC 40
 #define POLLING_FREQUENCY_IN_CONFLICT_SEC 800
 #endif
 
-typedef enum
+// The longest interval can be set at build time, since it's a tradeoff between waking up less and noticing games sooner.
+#ifndef POLLING_MAX_INTERVAL_SEC
+#define POLLING_MAX_INTERVAL_SEC POLLING_DEFAULT_MAX_INTERVAL_SEC
+#endif
+
+// Memoized verdicts hold the LIST_* flags a process matched in the low bits, and the lists it was checked against in the high bits.
+// They're not always the same because checks which can't change the outcome are skipped.
+#define VERDICT_CHECKED(lists) ((lists) << 4)
+#define VERDICT_CHECKED_LISTS(verdict) (((verdict) >> 4) & (LIST_WHITELIST | LIST_EXCLUSIVE))
+
+// Which bit of the verdict a single LIST_* flag is, for reading the memo's counts.
+#define VERDICT_BIT(list) (__builtin_ctz(list))
+
+#define WHITELIST_CACHE_FILENAME L"Whitelist.cache"
+
+// Polling statistics are logged once per this many polls.
+#define STATS_LOG_INTERVAL_POLLS 360
+
+// Wakeup statistics are logged once per this many wakeups.
+#define STATS_LOG_INTERVAL_WAKEUPS 360
+
+// What polls went through to decide the outcome.
+typedef struct
 {
-    PROCFIELD_NAME,
-    PROCFIELD_CMDLINE,
-    PROCFIELD_NUMOF,
-} ProcessField;
+    size_t examined;     // Processes gone through before the outcome was decided.
+    size_t evaluated;    // Examined processes which had to be matched against the whitelist.
+    size_t cmdlinesRead; // Evaluated processes whose command line had to be read. The rest were decided by their name alone.
+} PollCounts;
 
 typedef struct
 {
-    BSTR checkValue;
-    ProcessField checkField;
-    char isSubstring;
-    char isExclusive;
-} WhitelistEntry;
+    size_t npolls;
+    PollCounts total;
+    size_t lastExamined;
+} PollStats;
+
+// How often the thread wakes up, whether to poll or because the main thread woke it.
+typedef struct
+{
+    size_t nwakeups;
+    struct timespec since; // Monotonic.
+} WakeupStats;
+
+// A process whose name didn't decide its verdict, waiting for the second phase of the enumeration to read its command line.
+typedef struct
+{
+    uint32_t pid;
+    uint64_t createTime;
+    char verdict;   // What the name matched.
+    char unchecked; // The lists it's being checked against.
+    char needed;    // The lists only its command line can still match. Cleared as they're checked.
+    char isSeen;    // Whether the second phase found it still running.
+} PendingProcess;
 
 typedef struct
 {
     size_t ninputs;
     INPUT *inputs;
 
-    size_t nwhitelist;
-    WhitelistEntry *whitelist;
+    CompiledWhitelist *whitelist; // NULL when there's no whitelist.
     char isExclusiveExists;
+    FileWatch *whitelistWatch; // NULL if changes to the whitelist can't be watched.
+
+    // The verdict of every running process, so each one is matched against the whitelist only once.
+    ProcessMemo memo;
+
+    // NULL if we can't be told when processes start and exit, in which case every poll enumerates all the processes.
+    // Otherwise the memo is kept up to date by the events, and processes are only enumerated when it isn't.
+    ProcessEvents *processEvents;
+    char isMemoStale;
+    char isProcessEventsFailed; // Opening them is only tried again on refresh.
+    PollStats stats;
+
+    Decider decider; // Decides what to do each cycle, and how long to wait for the next one.
+    WakeupStats wakeups;
+
+    // Processes enumerated by name which need their command lines too. Reused from one enumeration to the next.
+    PendingProcess *pending;
+    size_t npending;
+    size_t pendingCapacity;
 
     struct curl_slist *headers;
     CURL *curl;
@@ -68,12 +140,18 @@ typedef struct
     char comInitialized;
     IWbemLocator *wbemLocator;
     IWbemServices *wbemServices;
+    ProcessSource *processSource; // Enumerates processes through wbemServices.
 } FixerCb;
 
 static void Panic(LPTSTR msg);
 static void Warn(LPTSTR msg);
 static void ReleaseResources(char freeWmi);
 static void LoadResources(char loadWmi);
+static void ReleaseWhitelist();
+static void LoadWhitelist();
+static void ReloadWhitelist();
+static void PlanProcessQuery();
+static char RemapVerdict(char verdict, void *ctx);
 static char IsInstantReplayOn();
 
 static INPUT *FetchToggleShortcut(size_t *ninputs);
@@ -86,17 +164,21 @@ static char FetchServerInfo(CURL **handleOut, struct curl_slist **headersOut);
 static char SetInstantReplayByPostRequest(char state);
 
 static void InitializeWmi();
-static WhitelistEntry *FetchWhitelist(LPTSTR filename, size_t *nwhitelist);
-static char IsExclusiveExists(WhitelistEntry *whitelist, size_t nwhitelist);
-static void PollRunningProcesses(WhitelistEntry *whitelist, size_t nwhitelist, char *isWhitelistedRunning, char *isExclusiveRunning);
-static wchar_t *StripLeadingTrailingWhitespaceWide(wchar_t *str);
-static char IsWhitelistMatch(BSTR *fields, WhitelistEntry *entry);
-
-// Not just any str rep will do, it needs to be the name that Win32_Process knows the field by.
-static const wchar_t* procfield_str[] = {
-    [PROCFIELD_NAME]        L"Name",
-    [PROCFIELD_CMDLINE]     L"CommandLine",
-};
+static CompiledWhitelist *FetchWhitelist(LPTSTR filename, CompiledWhitelist *previous, WhitelistDiff *diff);
+static char GetWhitelistCachePath(wchar_t *path, size_t len);
+static CompiledWhitelist *LoadCachedWhitelist(uint64_t sourceHash);
+static void SaveCachedWhitelist(const CompiledWhitelist *whitelist, uint64_t sourceHash);
+static void PollRunningProcesses(CompiledWhitelist *whitelist, char *isWhitelistedRunning, char *isExclusiveRunning);
+static char EnumerateRunningProcesses(CompiledWhitelist *whitelist, char isExhaustive, char *lists, PollCounts *counts);
+static char ReadPendingCommandLines(CompiledWhitelist *whitelist, char isExhaustive, char *wanted, char *lists, PollCounts *counts);
+static char AddPendingProcess(const ProcessInfo *process, char verdict, char unchecked, char needed);
+static int ComparePendingProcesses(const void *a, const void *b);
+static void MemoizeProcess(uint32_t pid, uint64_t createTime, char verdict);
+static void UpdateProcessEvents(char isWanted);
+static void ApplyProcessEvents(CompiledWhitelist *whitelist, PollCounts *counts);
+static void UpdatePollStats(const PollCounts *counts);
+static void UpdateWakeupStats();
+static double SecondsSince(const struct timespec *since);
 
 static FixerCb cb = {0};
 
@@ -107,9 +189,6 @@ static FixerCb cb = {0};
 
 void *FixerLoop(void *arg)
 {
-    int toggleStreak = 0;
-    int conflictStart = 0;
-
     // Making thread cancellable.
     pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
     pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
@@ -117,13 +196,20 @@ void *FixerLoop(void *arg)
     // Loading whitelist, shortcut, wmi, everything.
     LoadResources(TRUE);
 
-    for (int cycle = 0;; cycle++)
+    DeciderInit(&cb.decider, POLLING_MIN_INTERVAL_SEC, POLLING_MAX_INTERVAL_SEC, POLLING_FREQUENCY_IN_CONFLICT_SEC);
+    clock_gettime(CLOCK_MONOTONIC, &cb.wakeups.since);
+
+    // The interval is measured from the end of the last cycle, so a slow poll never leaves the next one due right away.
+    for (uint32_t intervalSec = POLLING_MIN_INTERVAL_SEC;;)
     {
-        sleep(POLLING_FREQUENCY_SEC);
+        DeciderInputs inputs = {0};
+        inputs.isWoken = FixerWaitForCycle(intervalSec);
+        UpdateWakeupStats();
 
         pthread_mutex_lock(&glbl.lock);
         char isRefresh = glbl.isRefresh;
-        char isDisabled = glbl.isDisabled;
+        inputs.isDisabled = glbl.isDisabled;
+        struct timespec wakeRequestTime = glbl.wakeRequestTime;
         glbl.isRefresh = FALSE;
         pthread_mutex_unlock(&glbl.lock);
 
@@ -132,58 +218,94 @@ void *FixerLoop(void *arg)
             LOG("Received refresh signal. Refreshing.");
             ReleaseResources(FALSE);
             LoadResources(FALSE);
+            inputs.isReloaded = TRUE;
+        }
+        else if (cb.whitelistWatch != NULL && FileWatchPoll(cb.whitelistWatch))
+        {
+            // Nothing else depends on the whitelist, so there's no need for a full refresh.
+            LOG("The whitelist changed. Reloading it.");
+            ReloadWhitelist();
+            inputs.isReloaded = TRUE;
         }
 
-        if (isDisabled) goto end_streak_and_continue;
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        inputs.nowMs = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+        inputs.isExclusiveExists = cb.isExclusiveExists;
 
-        // If we find ourselves in conflict with some program that also tries to control Shadowplay,
-        // we'll "yield" by reducing the polling frequency so we don't fight it as much.
-        if (toggleStreak >= MIN_STREAK_FOR_CONFLICT)
+        if (inputs.isWoken)
         {
-            // Skip many cycles, written this way because we can't just sleep for longer between cycles; I don't want to stall Refresh so much.
-            if ((cycle - conflictStart) * POLLING_FREQUENCY_SEC < POLLING_FREQUENCY_IN_CONFLICT_SEC) continue;
-
-            // On cycles where we want to make an attempt despite being in a streak, we'll need 2 attempts to know if we are still in conflict.
-            toggleStreak = MIN_STREAK_FOR_CONFLICT - 2;
-            LOG("Attempting to break out of conflict. cycle=%d", cycle);
+            LOG("Woke up for a request from the main thread, it took %.1f ms to get to it (isRefresh %d, isDisabled %d).",
+                (now.tv_sec - wakeRequestTime.tv_sec) * 1000.0 + (now.tv_nsec - wakeRequestTime.tv_nsec) / 1e6, isRefresh, inputs.isDisabled);
         }
 
-        char isInstantReplayOn = IsInstantReplayOn();
+        // The decider tells us what to look at, and then what to do about it.
+        char isObserving = DeciderIsObserving(&cb.decider, &inputs);
+        UpdateProcessEvents(isObserving && cb.whitelist != NULL && cb.whitelist->nentries > 0);
 
-        // When these conditions are met there is no reason to waste cpu time polling running processes.
-        if (!cb.isExclusiveExists && isInstantReplayOn) goto end_streak_and_continue;
+        if (isObserving)
+        {
+            inputs.isInstantReplayOn = IsInstantReplayOn();
 
-        char isWhitelistedRunning, isExclusiveRunning;
-        PollRunningProcesses(cb.whitelist, cb.nwhitelist, &isWhitelistedRunning, &isExclusiveRunning);
+            // When these conditions are met there is no reason to waste cpu time polling running processes.
+            // Events still have to be drained though, or they'd pile up for as long as Instant Replay stays on.
+            if (cb.isExclusiveExists || !inputs.isInstantReplayOn || cb.processEvents != NULL)
+            {
+                PollRunningProcesses(cb.whitelist, &inputs.isWhitelistedRunning, &inputs.isExclusiveRunning);
+                inputs.isPolled = TRUE;
+            }
+        }
 
-        // Whitelist disables AlwaysShadow, taking precedence over Exclusives list.
-        if (isWhitelistedRunning) goto end_streak_and_continue;
+        DeciderActions actions = DeciderStep(&cb.decider, &inputs);
+        intervalSec = actions.intervalSec;
 
-        if ((!isInstantReplayOn && (!cb.isExclusiveExists || isExclusiveRunning)) || // Conditions for toggling ON.
-            (isInstantReplayOn && cb.isExclusiveExists && !isExclusiveRunning)) // Conditions for toggling OFF.
+        if (actions.isConflictRetried)
         {
-            LOG("Should toggle because: isInstantReplayOn %d, isExclusiveExists %d, isExclusiveRunning %d", isInstantReplayOn, cb.isExclusiveExists, isExclusiveRunning);
+            LOG("Attempting to break out of conflict.");
+        }
 
-            if (++toggleStreak == MIN_STREAK_FOR_CONFLICT)
-            {
-                LOG("Entered into conflict! Won't toggle. cycle=%d", cycle);
-                conflictStart = cycle;
-            }
-            else
-            {
-                ToggleInstantReplay(isInstantReplayOn);
-            }
-            
-            continue; // Skip ending the streak.
+        if (actions.isToggling || actions.isConflictEntered)
+        {
+            LOG("Should toggle because: isInstantReplayOn %d, isExclusiveExists %d, isExclusiveRunning %d",
+                inputs.isInstantReplayOn, inputs.isExclusiveExists, inputs.isExclusiveRunning);
         }
 
-end_streak_and_continue:
-        toggleStreak = 0;
+        if (actions.isConflictEntered)
+        {
+            LOG("Entered into conflict! Won't toggle.");
+        }
+
+        if (actions.isToggling)
+        {
+            ToggleInstantReplay(inputs.isInstantReplayOn);
+        }
     }
     
     return 0;
 }
 
+static void UpdateWakeupStats()
+{
+    if (++cb.wakeups.nwakeups < STATS_LOG_INTERVAL_WAKEUPS)
+    {
+        return;
+    }
+
+    double hours = SecondsSince(&cb.wakeups.since) / 3600;
+    LOG("Woke up %.1f times per hour over the last %lld wakeups, the poll interval is at %u seconds (%u to %u).",
+        cb.wakeups.nwakeups / hours, (long long)cb.wakeups.nwakeups, cb.decider.scheduler.intervalSec, cb.decider.scheduler.minSec, cb.decider.scheduler.maxSec);
+
+    cb.wakeups.nwakeups = 0;
+    clock_gettime(CLOCK_MONOTONIC, &cb.wakeups.since);
+}
+
+static double SecondsSince(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
 static void Panic(LPTSTR msg)
 {
     ReleaseResources(TRUE);
@@ -233,12 +355,18 @@ static void ReleaseResources(char freeWmi)
     // When the main thread has an error, we don't clean up shit.
     // When the program exits normally, we clean up the main thread's shit, but not this thread's.
     // But you know what? Fuck it.
+    // The events come from WMI so they have to go first.
+    ProcessEventsClose(cb.processEvents);
+    cb.processEvents = NULL;
+
     if (freeWmi)
     {
+        if (cb.processSource != NULL) cb.processSource->vtbl->close(cb.processSource);
         if (cb.wbemServices != NULL) cb.wbemServices->lpVtbl->Release(cb.wbemServices);
         if (cb.wbemLocator != NULL) cb.wbemLocator->lpVtbl->Release(cb.wbemLocator);
         if (cb.comInitialized) CoUninitialize();
 
+        cb.processSource = NULL;
         cb.wbemServices = NULL;
         cb.wbemLocator = NULL;
         cb.comInitialized = FALSE;
@@ -246,25 +374,99 @@ static void ReleaseResources(char freeWmi)
 
     ReleaseCurlResources();
 
-    for (size_t i = 0; i < cb.nwhitelist; i++) SysFreeString(cb.whitelist[i].checkValue);
-    free(cb.whitelist);
+    ReleaseWhitelist();
+    FileWatchClose(cb.whitelistWatch);
     free(cb.inputs);
+    free(cb.pending);
 
-    cb.whitelist = NULL;
+    cb.whitelistWatch = NULL;
     cb.inputs = NULL;
-    cb.nwhitelist = 0;
     cb.ninputs = 0;
+    cb.pending = NULL;
+    cb.npending = 0;
+    cb.pendingCapacity = 0;
 }
 
 static void LoadResources(char loadWmi)
 {
     if (loadWmi) InitializeWmi();
     cb.inputs = FetchToggleShortcut(&cb.ninputs);
-    cb.whitelist = FetchWhitelist(TEXT("Whitelist.txt"), &cb.nwhitelist);
-    cb.isExclusiveExists = IsExclusiveExists(cb.whitelist, cb.nwhitelist);
+
+    // Process events are listened for once there's a use for them, see UpdateProcessEvents.
+    cb.isProcessEventsFailed = FALSE;
+    cb.isMemoStale = TRUE;
+
+    // Watching starts before loading so that a change made while loading isn't missed. Changes wake us up so they're picked up right away,
+    // and changes to other files in the directory only cost a cycle. Nothing of ours is written there, the log and cache are in LocalAppData.
+    if ((cb.whitelistWatch = FileWatchOpen(".", "Whitelist.txt", FixerNotify, NULL)) == NULL)
+    {
+        LOG_WARN("Couldn't watch the whitelist for changes, it will only be reloaded on refresh.");
+    }
+
+    LoadWhitelist();
     FetchServerInfo(&cb.curl, &cb.headers);
 }
 
+static void ReleaseWhitelist()
+{
+    // The verdicts are only good for the whitelist they were made with.
+    ProcessMemoFree(&cb.memo);
+    cb.isMemoStale = TRUE;
+    WhitelistFree(cb.whitelist);
+    cb.whitelist = NULL;
+    cb.isExclusiveExists = FALSE;
+}
+
+static void LoadWhitelist()
+{
+    cb.whitelist = FetchWhitelist(TEXT("Whitelist.txt"), NULL, NULL);
+    cb.isExclusiveExists = cb.whitelist != NULL && cb.whitelist->isExclusiveExists;
+    PlanProcessQuery();
+}
+
+// Like releasing and loading the whitelist, except whatever the new whitelist has in common with the old one isn't redone.
+static void ReloadWhitelist()
+{
+    WhitelistDiff diff;
+    CompiledWhitelist *old = cb.whitelist;
+
+    cb.whitelist = FetchWhitelist(TEXT("Whitelist.txt"), old, &diff);
+    cb.isExclusiveExists = cb.whitelist != NULL && cb.whitelist->isExclusiveExists;
+    PlanProcessQuery();
+
+    if (old == NULL || cb.whitelist == NULL)
+    {
+        ProcessMemoFree(&cb.memo);
+    }
+    else
+    {
+        ProcessMemoRemap(&cb.memo, RemapVerdict, &diff);
+    }
+
+    // The processes whose verdicts went stale have to be matched again, and only an enumeration can give us their fields.
+    cb.isMemoStale = TRUE;
+
+    WhitelistFree(old);
+}
+
+// Has WMI only send back the processes the whitelist could match, instead of all of them.
+static void PlanProcessQuery()
+{
+    if (cb.whitelist != NULL && !WmiProcessSourcePlan(cb.processSource, cb.whitelist))
+    {
+        LOG_WARN("Failed to plan the process query, all processes will be enumerated.");
+    }
+}
+
+// A verdict about a list only goes stale if the process matched it and entries were removed from it,
+// or if it didn't match it and entries were added to it. Stale lists are unchecked so the process is matched against them again.
+static char RemapVerdict(char verdict, void *ctx)
+{
+    const WhitelistDiff *diff = ctx;
+    char stale = (verdict & diff->removed) | (VERDICT_CHECKED_LISTS(verdict) & ~verdict & diff->added);
+    return verdict & ~stale & ~VERDICT_CHECKED(stale);
+}
+
 #pragma region Checking-Active
 
 static char IsInstantReplayOn()
@@ -527,331 +729,533 @@ static void InitializeWmi()
         LOG_ERROR("ConnectServer failed with res %ld.", res);
         PANIC(error, TEXT("ConnectServer"), res);
     }
-}
 
-// fmt must end with a %s where the error string goes.
-#define LOG_REGERROR(errcode, compiled, fmt, ...)                                   \
-    do {                                                                            \
-        char bufLogRegerror[MSG_LEN];                                               \
-        regerror((errcode), (compiled), bufLogRegerror, sizeof(bufLogRegerror));    \
-        LOG_WARN(fmt, ##__VA_ARGS__, bufLogRegerror);                               \
-    } while (FALSE)
+    if ((cb.processSource = WmiProcessSourceOpen(cb.wbemServices)) == NULL)
+    {
+        LOG_ERROR("Failed to allocate the process source.");
+        PANIC(TEXT("Failed to initialize WMI because memory ran out. Quitting."));
+    }
+}
 
-static WhitelistEntry *FetchWhitelist(LPTSTR filename, size_t *nwhitelist)
+// If previous isn't NULL, the matchers of the groups that didn't change are taken from it and diff is filled in. Either way the caller still has to free it.
+static CompiledWhitelist *FetchWhitelist(LPTSTR filename, CompiledWhitelist *previous, WhitelistDiff *diff)
 {
-    FILE *file = NULL;
-    WhitelistEntry *whitelist = NULL;
-    // Have to initialize these to *something* that isn't REG_OK.
-    int emptylineCompRes = REG_BADPAT;
-    int modlineCompRes = REG_BADPAT;
-    int normlineCompRes = REG_BADPAT;
-    int res;
-    *nwhitelist = 0;
-
-    if ((res = _tfopen_s(&file, filename, TEXT("r"))) != 0)
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mapHandle = NULL;
+    const char *view = NULL;
+    size_t size = 0;
+    CompiledWhitelist *whitelist = NULL;
+    LARGE_INTEGER fileSize;
+    WhitelistParseError parseError;
+    char *error;
+
+    // Writers are locked out while the file is mapped, so it can't change between the two passes.
+    fileHandle = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (fileHandle == INVALID_HANDLE_VALUE)
     {
-        LOG_WARN("Couldn't open whitelist with error: %s.", strerror(res));
-        if (res != ENOENT) WARN(NULL, TEXT("Failed to open whitelist: ") T_TCS_FMT TEXT(". Fix the problem then refresh."), _tcserror(res));
-        file = NULL; // Just to be sure.
+        DWORD err = GetLastError();
+        error = GetLastErrorStaticStr();
+        LOG_WARN("Couldn't open whitelist with error: %s", error);
+        if (err != ERROR_FILE_NOT_FOUND) WARN(NULL, TEXT("Failed to open whitelist: %hs Fix the problem then refresh."), error);
         goto error;
     }
 
-    regex_t emptylineRegex;
-    regex_t modlineRegex;
-    regex_t normlineRegex;
-    emptylineCompRes = regcomp(&emptylineRegex, "^\\s*$", REG_EXTENDED | REG_NOSUB);
-    modlineCompRes = regcomp(&modlineRegex, "^\\s*\\?\\?(\\S*)\\s*((\\s*\\S*)*)\\s*$", REG_EXTENDED);
-    normlineCompRes = regcomp(&normlineRegex, "^\\s*(\\S+(\\s*\\S+)*)\\s*$", REG_EXTENDED);
-
-    if (emptylineCompRes != REG_OK || modlineCompRes != REG_OK || normlineCompRes != REG_OK)
+    if (!GetFileSizeEx(fileHandle, &fileSize))
     {
-        LOG_REGERROR(emptylineCompRes, &emptylineRegex, "emptylineRegex compilation result: %s.");
-        LOG_REGERROR(modlineCompRes, &modlineRegex, "modlineRegex compilation result: %s.");
-        LOG_REGERROR(normlineCompRes, &normlineRegex, "normlineRegex compilation result: %s.");
-        WARN(NULL, TEXT("Failed to load whitelist due to an internal problem. You can retry by hitting refresh."));
+        error = GetLastErrorStaticStr();
+        LOG_WARN("Couldn't get the size of the whitelist with error: %s", error);
+        WARN(NULL, TEXT("Failed to read whitelist: %hs Fix the problem then refresh."), error);
         goto error;
     }
 
-    char buffer[1 << 13];
-    wchar_t wbuffer[_countof(buffer)];
-    int linenum = 0;
+    size = fileSize.QuadPart;
 
-    // Iterate over the file line by line.
-    while (fgets(buffer, sizeof(buffer), file) != NULL)
+    // An empty file can't be mapped, but there's nothing to scan in it anyway.
+    if (size > 0)
     {
-        linenum++;
+        if ((mapHandle = CreateFileMapping(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL)) == NULL ||
+            (view = MapViewOfFile(mapHandle, FILE_MAP_READ, 0, 0, 0)) == NULL)
+        {
+            error = GetLastErrorStaticStr();
+            LOG_WARN("Couldn't map the whitelist with error: %s", error);
+            WARN(NULL, TEXT("Failed to read whitelist: %hs Fix the problem then refresh."), error);
+            goto error;
+        }
+    }
 
-        // fgets writes a newline to the buffer and this is the easiest way I was able to shake it off.
-        for (int i = strlen(buffer) - 1; i >= 0 && (buffer[i] == '\n' || buffer[i] == '\r'); i--) buffer[i] = '\0';
-        LOG("Checking whitelist line: %d line length: %lld contents: '%s'.", linenum, strlen(buffer), buffer);
+    LARGE_INTEGER start, stop, frequency;
+    QueryPerformanceCounter(&start);
 
-        // Check for empty lines, skip them.
-        res = regexec(&emptylineRegex, buffer, 0, NULL, 0);
+    // A cache of this exact file spares parsing it and building most of its matchers.
+    uint64_t sourceHash = WhitelistCacheHash(view, size);
+    char isCached = (whitelist = LoadCachedWhitelist(sourceHash)) != NULL;
 
-        if (res == REG_OK)
+    if (!isCached && (whitelist = WhitelistParse(view, size, &parseError)) == NULL)
+    {
+        if (parseError.isOutOfMemory)
         {
-            LOG("Skipping line %d because it is empty.", linenum);
-            continue;
+            LOG_WARN("Failed to allocate the compiled whitelist.");
+            WARN(NULL, TEXT("Failed to load the whitelist because memory ran out. You can retry by hitting refresh."));
         }
-
-        if (res != REG_NOMATCH)
+        else
         {
-            LOG_REGERROR(res, &emptylineRegex, "Line %d emptylineRegex exec result: %s.", linenum);
-            WARN(NULL, TEXT("Failed to load the whitelist due to an internal problem at line: %d. You can retry by hitting refresh."), linenum);
-            goto error;
+            LOG_WARN("%s", parseError.msg);
+            WARN(NULL, TEXT("%hs Fix the problem then refresh."), parseError.msg);
         }
 
-        // We'll write the entry to this variable then create a dynamically allocated copy.
-        // The reason is so if we get an error in the middle we don't have to worry about freeing that allocation.
-        WhitelistEntry entry = {0};
-        entry.checkField = PROCFIELD_CMDLINE;
+        goto error;
+    }
 
-        // Plenty of array size just to be safe.
-        regmatch_t matches[16];
-        regmatch_t *commandMatch = NULL;
-        res = regexec(&modlineRegex, buffer, _countof(matches), matches, 0);
+    if (previous != NULL)
+    {
+        *diff = WhitelistAdoptMatchers(whitelist, previous);
+    }
 
-        if (res == REG_OK)
-        {
-            regmatch_t *flagsMatch = &matches[1];
-            commandMatch = &matches[2];
+    if (!WhitelistBuildMatchers(whitelist))
+    {
+        LOG_WARN("Failed to build the matchers of the whitelist.");
+        WARN(NULL, TEXT("Failed to load the whitelist because memory ran out. You can retry by hitting refresh."));
+        goto error;
+    }
 
-            if (flagsMatch->rm_so == flagsMatch->rm_eo)
-            {
-                LOG_WARN("Line %d in the whitelist starts with ?? but has no flags.", linenum);
-                WARN(NULL, TEXT("Invalid whitelist line: %d - line starts with ?? but has no flags. Fix the problem then refresh."), linenum);
-                goto error;
-            }
+    QueryPerformanceCounter(&stop);
+    QueryPerformanceFrequency(&frequency);
+    LOG("Loaded the whitelist from the %s in %.3f ms: entries: %lld, characters: %lld, size: %lld bytes.", isCached ? "cache" : "file",
+        (stop.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart, (long long)whitelist->nentries,
+        (long long)whitelist->nchars, (long long)whitelist->size);
 
-            char isComment = FALSE;
+    if (!isCached) SaveCachedWhitelist(whitelist, sourceHash);
+    goto cleanup;
 
-            for (char *c = &buffer[flagsMatch->rm_so]; c != &buffer[flagsMatch->rm_eo]; c++)
-            {
-                switch (*c)
-                {
-                    case 'S':
-                        entry.isSubstring = TRUE;
-                        break;
-                    case 'E':
-                        entry.isExclusive = TRUE;
-                        break;
-                    case 'N':
-                        entry.checkField = PROCFIELD_NAME;
-                        break;
-                    case 'I':
-                        // Keep iterating over flag characters even if this is a comment.
-                        isComment = TRUE;
-                        break;
-                    default:
-                        LOG_WARN("Invalid flag character: %c in line: %d.", *c, linenum);
-                        WARN(NULL, TEXT("Invalid whitelist line: %d - flag character: '%c' is unrecognized. Fix the problem then refresh."), linenum, *c);
-                        goto error;
-                }
-            }
+error:
+    WhitelistFree(whitelist);
+    whitelist = NULL;
 
-            // If this is a comment line, skip it.
-            if (isComment)
-            {
-                LOG("Skipping line %d because it is a comment.", linenum);
-                continue;
-            }
+cleanup:
+    if (view != NULL) UnmapViewOfFile(view);
+    if (mapHandle != NULL) CloseHandle(mapHandle);
+    if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+    return whitelist;
+}
 
-            if (commandMatch->rm_so == commandMatch->rm_eo)
-            {
-                LOG_WARN("Line %d in the whitelist has flags but no command.", linenum);
-                WARN(NULL, TEXT("Invalid whitelist line: %d - command is missing. Fix the problem then refresh."), linenum);
-                goto error;
-            }
-        }
-        else if (res != REG_NOMATCH)
-        {
-            LOG_REGERROR(res, &modlineRegex, "Line %d modlineRegex exec result: %s.", linenum);
-            WARN(NULL, TEXT("Failed to load the whitelist due to an internal problem at line: %d. You can retry by hitting refresh."), linenum);
-            goto error;
-        }
-        else // res == REG_NOMATCH. We'll try normlineRegex.
-        {
-            res = regexec(&normlineRegex, buffer, _countof(matches), matches, 0);
-            commandMatch = &matches[1];
+// The cache is kept next to the log.
+static char GetWhitelistCachePath(wchar_t *path, size_t len)
+{
+    wchar_t *localAppDataPath;
+    HRESULT hr = SHGetKnownFolderPath(&FOLDERID_LocalAppData, 0, NULL, &localAppDataPath);
 
-            if (res != REG_OK)
-            {
-                LOG_REGERROR(res, &modlineRegex, "Line %d normlineRegex exec result: %s.", linenum);
-                WARN(NULL, TEXT("Failed to load the whitelist due to an internal problem at line: %d. You can retry by hitting refresh."), linenum);
-                goto error;
-            }
-        }
+    if (FAILED(hr))
+    {
+        LOG_WARN("Failed to obtain LocalAppData path for the whitelist cache with error code %#lx.", hr);
+        return FALSE;
+    }
 
-        // Converting command to wchar.
-        if ((res = mbstowcs_s(NULL, wbuffer, _countof(wbuffer), &buffer[commandMatch->rm_so], commandMatch->rm_eo - commandMatch->rm_so)) != 0)
-        {
-            LOG_WARN("Received error '%s' when trying to convert line %d command %.*s.",
-                strerror(res), linenum, commandMatch->rm_eo - commandMatch->rm_so, &buffer[commandMatch->rm_so]);
-            WARN(NULL, TEXT("Failed to load the whitelist due to a problem at line: %d. It may contain unsupported characters. Fix the problem then refresh."), linenum);
-            goto error;
-        }
+    swprintf_s(path, len, L"%ls\\AlwaysShadow\\" WHITELIST_CACHE_FILENAME, localAppDataPath);
+    CoTaskMemFree(localAppDataPath);
+    return TRUE;
+}
 
-        entry.checkValue = SysAllocString(wbuffer);
+// Returns NULL if there's no cache of the whitelist with this hash. That's never a problem, it just means parsing the whitelist.
+static CompiledWhitelist *LoadCachedWhitelist(uint64_t sourceHash)
+{
+    wchar_t path[1 << 13];
+    HANDLE fileHandle;
+    HANDLE mapHandle = NULL;
+    const void *view = NULL;
+    LARGE_INTEGER fileSize;
+    CompiledWhitelist *whitelist = NULL;
+
+    if (!GetWhitelistCachePath(path, _countof(path)))
+    {
+        return NULL;
+    }
 
-        // Allocate new whitelist entry.
-        whitelist = realloc(whitelist, ((*nwhitelist) + 1) * sizeof(*whitelist));
-        whitelist[*nwhitelist] = entry;
-        (*nwhitelist)++;
+    if ((fileHandle = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE)
+    {
+        LOG("Couldn't open the whitelist cache: %s", GetLastErrorStaticStr());
+        return NULL;
+    }
 
-        LOG("Added to the whitelist: line: %d, isSubstring: %d, isExclusive: %d, field: %ls, value length: %lld value: '%ls'.",
-            linenum, entry.isSubstring, entry.isExclusive, procfield_str[entry.checkField], wcslen(wbuffer), wbuffer);
+    if (GetFileSizeEx(fileHandle, &fileSize) && fileSize.QuadPart > 0 &&
+        (mapHandle = CreateFileMapping(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL)) != NULL &&
+        (view = MapViewOfFile(mapHandle, FILE_MAP_READ, 0, 0, 0)) != NULL)
+    {
+        whitelist = WhitelistCacheLoad(view, fileSize.QuadPart, sourceHash);
     }
 
-    // Skip bad.
-    goto exit;
+    if (whitelist == NULL)
+    {
+        LOG("The whitelist cache is stale or corrupt, the whitelist will be parsed.");
+    }
 
-error:
-    // Safe to pass NULL to SysFreeString (also to free).
-    for (size_t i = 0; whitelist != NULL && i < *nwhitelist; i++) SysFreeString(whitelist[i].checkValue);
-    free(whitelist);
-    *nwhitelist = 0;
-    whitelist = NULL;
-exit:
-    if (emptylineCompRes == REG_OK) regfree(&emptylineRegex);
-    if (modlineCompRes == REG_OK) regfree(&modlineRegex);
-    if (normlineCompRes == REG_OK) regfree(&normlineRegex);
-    if (file != NULL) fclose(file);
+    if (view != NULL) UnmapViewOfFile(view);
+    if (mapHandle != NULL) CloseHandle(mapHandle);
+    CloseHandle(fileHandle);
     return whitelist;
 }
 
-static char IsExclusiveExists(WhitelistEntry *whitelist, size_t nwhitelist)
+static void SaveCachedWhitelist(const CompiledWhitelist *whitelist, uint64_t sourceHash)
 {
-    for (int i = 0; i < cb.nwhitelist; i++)
+    wchar_t path[1 << 13];
+    wchar_t tmpPath[_countof(path) + 4];
+    FILE *file;
+
+    if (!GetWhitelistCachePath(path, _countof(path)))
     {
-        if (whitelist[i].isExclusive) return TRUE;
+        return;
+    }
+
+    swprintf_s(tmpPath, _countof(tmpPath), L"%ls.tmp", path);
+
+    if ((file = _wfopen(tmpPath, L"wb")) == NULL)
+    {
+        LOG_WARN("Couldn't create the whitelist cache with error: %s.", strerror(errno));
+        return;
+    }
+
+    char isSaved = WhitelistCacheSave(whitelist, sourceHash, file);
+    isSaved = fclose(file) == 0 && isSaved;
+
+    // It's written to the side and moved over the old one so a half written cache is never loaded.
+    if (!isSaved || !MoveFileExW(tmpPath, path, MOVEFILE_REPLACE_EXISTING))
+    {
+        LOG_WARN("Couldn't save the whitelist cache: %s", isSaved ? GetLastErrorStaticStr() : "write failed.");
+        DeleteFileW(tmpPath);
+        return;
     }
 
-    return FALSE;
+    LOG("Saved the whitelist cache.");
 }
 
-// Thank god for StackOverflow for delivering this holy function : https://stackoverflow.com/a/9589788/12553917.
-static void PollRunningProcesses(WhitelistEntry *whitelist, size_t nwhitelist, char *isWhitelistedRunning, char *isExclusiveRunning)
+static void PollRunningProcesses(CompiledWhitelist *whitelist, char *isWhitelistedRunning, char *isExclusiveRunning)
 {
+    char lists = 0;
+    PollCounts counts = {0};
+
     *isWhitelistedRunning = FALSE;
     *isExclusiveRunning = FALSE;
     
-    if (nwhitelist == 0)
+    if (whitelist == NULL || whitelist->nentries == 0)
     {
         return;
     }
 
-    // Run the WQL Query.
-    // TODO: instead of iterating over all processes, be informed when a process is created or destroyed. Some interesting reading material on that:
-    // https://stackoverflow.com/questions/3556048/how-to-detect-win32-process-creation-termination-in-c
-    // https://www.codeproject.com/Articles/11985/Hooking-the-native-API-and-controlling-process-cre
-    // https://docs.microsoft.com/en-us/windows/win32/wmisdk/example--receiving-event-notifications-through-wmi-?redirectedfrom=MSDN
-    // If this is too difficult to do from C, I can write it in C++ and call it from C. It shouldn't be too hard to set up.
-    IEnumWbemClassObject *enumWbem = NULL;
+    if (cb.processEvents == NULL)
+    {
+        EnumerateRunningProcesses(whitelist, FALSE, &lists, &counts);
+    }
+    else
+    {
+        // Missed events can only be made up for by going over all the processes again. After that only the processes which started or exited are looked at.
+        if (ProcessEventsWereLost(cb.processEvents))
+        {
+            LOG_WARN("Process events were lost. Enumerating all processes again.");
+            cb.isMemoStale = TRUE;
+        }
+
+        if (cb.isMemoStale) cb.isMemoStale = !EnumerateRunningProcesses(whitelist, TRUE, &lists, &counts);
+
+        // Events that were queued during the enumeration are still applied, they only repeat what it saw or come after it.
+        ApplyProcessEvents(whitelist, &counts);
+
+        // The memo counts how many running processes match each list as they start and exit, so this doesn't look at any of them.
+        lists |= ProcessMemoVerdictUnion(&cb.memo);
+    }
+
+    *isWhitelistedRunning = (lists & LIST_WHITELIST) != 0;
+    *isExclusiveRunning = (lists & LIST_EXCLUSIVE) != 0;
+    UpdatePollStats(&counts);
+}
 
-    // CBA to compose this string using procfield_str.
-    if (FAILED(cb.wbemServices->lpVtbl->ExecQuery(cb.wbemServices, L"WQL", L"SELECT Name,CommandLine FROM Win32_Process", WBEM_FLAG_FORWARD_ONLY, NULL, &enumWbem)))
+// Thank god for StackOverflow for delivering this holy function : https://stackoverflow.com/a/9589788/12553917.
+// Matches the running processes against the whitelist and sets lists to the LIST_* flags of the lists they match. Returns TRUE if every process was seen.
+// Unless it's exhaustive it stops as soon as the outcome is decided, and each process is only matched against the lists that could still change it.
+// Command lines are expensive to read, so it goes in two phases: every process is matched by its name first, and only the processes whose name
+// didn't decide them have their command lines read afterwards. If the names alone decide the outcome, no command lines are read at all.
+static char EnumerateRunningProcesses(CompiledWhitelist *whitelist, char isExhaustive, char *lists, PollCounts *counts)
+{
+    ProcessSource *source = cb.processSource;
+    *lists = 0;
+    cb.npending = 0;
+
+    if (!source->vtbl->begin(source))
     {
-        return;
+        return FALSE;
     }
 
-    // Iterate over the enumerator.
-    IWbemClassObject *result = NULL;
-    ULONG returnedCount = 0;
+    ProcessInfo process;
+    ProcessSourceResult res;
+    ProcessMemoBeginCycle(&cb.memo);
+
+    // The lists whose outcome can still change, and the lists a command line can change at all.
+    char wanted = LIST_WHITELIST | (cb.isExclusiveExists ? LIST_EXCLUSIVE : 0);
+    char cmdlineLists = WhitelistFieldLists(whitelist, PROCFIELD_CMDLINE);
 
-    while (enumWbem->lpVtbl->Next(enumWbem, WBEM_INFINITE, 1, &result, &returnedCount) == S_OK)
+    while ((res = source->vtbl->next(source, &process)) == PROCSOURCE_PROCESS)
     {
-        VARIANT field_variants[PROCFIELD_NUMOF];
-        BSTR field_bstrs[PROCFIELD_NUMOF] = {0};
-        BSTR field_trimmed_bstrs[PROCFIELD_NUMOF] = {0};
+        char verdict = 0;
+        counts->examined++;
 
-        for (int i = 0; i < PROCFIELD_NUMOF; i++)
+        // Almost every process was already running last cycle, so only new ones need to be matched against the whitelist.
+        // A memoized verdict is only good for the lists it was checked against though.
+        if (process.isIdentified) ProcessMemoLookup(&cb.memo, process.pid, process.createTime, &verdict);
+        char unchecked = wanted & ~VERDICT_CHECKED_LISTS(verdict);
+
+        if (unchecked != 0)
         {
-            if (FAILED(result->lpVtbl->Get(result, procfield_str[i], 0, &field_variants[i], 0, 0)))
+            source->vtbl->readField(source, &process, PROCFIELD_NAME);
+            verdict |= WhitelistMatch(whitelist, process.fields, unchecked);
+            counts->evaluated++;
+
+            // The command line only matters for the lists the name didn't already match.
+            char needed = unchecked & ~verdict & cmdlineLists;
+
+            // A process that can't be identified can't be found again in the second phase, so it makes do with whatever command line this one has.
+            if (needed != 0 && !(process.isIdentified && AddPendingProcess(&process, verdict, unchecked, needed)))
             {
-                // Mark failed fields empty so we know not to free them.
-                field_variants[i].vt = VT_EMPTY;
-                continue;
+                source->vtbl->readField(source, &process, PROCFIELD_CMDLINE);
+                verdict |= WhitelistMatch(whitelist, process.fields, needed);
+                counts->cmdlinesRead++;
+                needed = 0;
             }
 
-            if (field_variants[i].vt == VT_NULL) {
-                // the bstr arrays default to NULL so leave it that way in this case.
-                continue;
+            if (needed == 0)
+            {
+                verdict |= VERDICT_CHECKED(unchecked);
+                if (process.isIdentified) MemoizeProcess(process.pid, process.createTime, verdict);
             }
-
-            field_bstrs[i] = SysAllocString(field_variants[i].bstrVal);
-            field_trimmed_bstrs[i] = StripLeadingTrailingWhitespaceWide(field_bstrs[i]);
         }
 
-        for (size_t i = 0; i < nwhitelist; i++)
+        *lists |= verdict & (LIST_WHITELIST | LIST_EXCLUSIVE);
+
+        // Events only tell us about the processes that change, so every other one needs a verdict for every list.
+        if (isExhaustive) continue;
+
+        // The whitelist wins, so once a whitelisted process is running the rest can't change anything.
+        if (*lists & LIST_WHITELIST) break;
+
+        // Once an exclusive is running, only the whitelist matters for the rest.
+        if (*lists & LIST_EXCLUSIVE) wanted &= ~LIST_EXCLUSIVE;
+    }
+
+    // The processes that weren't seen have exited, or come after the one that decided the outcome and will be matched again once they're reached.
+    // Either way they're evicted, so the memo never holds more than one enumeration's worth of processes. Only an error leaves the memo as it was.
+    if (res != PROCSOURCE_ERROR)
+    {
+        ProcessMemoEndCycle(&cb.memo);
+    }
+
+    // If the names already put a whitelisted process in the running, no command line can change the outcome.
+    char isSecondPhaseDone = FALSE;
+
+    if (cb.npending > 0 && (isExhaustive || !(*lists & LIST_WHITELIST)))
+    {
+        isSecondPhaseDone = ReadPendingCommandLines(whitelist, isExhaustive, &wanted, lists, counts);
+    }
+
+    for (size_t i = 0; i < cb.npending; i++)
+    {
+        PendingProcess *pending = &cb.pending[i];
+
+        // A process the second phase went looking for and didn't find has exited. The lists that weren't checked are left for next time.
+        if (isSecondPhaseDone && !pending->isSeen) continue;
+        MemoizeProcess(pending->pid, pending->createTime, pending->verdict | VERDICT_CHECKED(pending->unchecked & ~pending->needed));
+    }
+
+    // A memo that's kept up to date by events needs every verdict to be complete.
+    return res == PROCSOURCE_END && (cb.npending == 0 || isSecondPhaseDone);
+}
+
+// The second phase of the enumeration. Reads the command lines of the pending processes and matches them against the lists they still need.
+// Returns TRUE if every pending process was looked for.
+static char ReadPendingCommandLines(CompiledWhitelist *whitelist, char isExhaustive, char *wanted, char *lists, PollCounts *counts)
+{
+    ProcessSource *source = cb.processSource;
+    ProcessInfo process;
+    ProcessSourceResult res;
+
+    // Sorted by PID so the processes that come back can be found, whatever order they come in.
+    qsort(cb.pending, cb.npending, sizeof(*cb.pending), ComparePendingProcesses);
+
+    uint32_t *pids = malloc(cb.npending * sizeof(*pids));
+
+    if (pids == NULL)
+    {
+        return FALSE;
+    }
+
+    for (size_t i = 0; i < cb.npending; i++) pids[i] = cb.pending[i].pid;
+    char success = source->vtbl->beginSome(source, pids, cb.npending);
+    free(pids);
+
+    if (!success)
+    {
+        return FALSE;
+    }
+
+    while ((res = source->vtbl->next(source, &process)) == PROCSOURCE_PROCESS)
+    {
+        PendingProcess key = { .pid = process.pid };
+        PendingProcess *pending = bsearch(&key, cb.pending, cb.npending, sizeof(*cb.pending), ComparePendingProcesses);
+
+        // The PID may have been reused since the first phase.
+        if (!process.isIdentified || pending == NULL || pending->createTime != process.createTime)
         {
-            WhitelistEntry *entry = &whitelist[i];
+            continue;
+        }
 
-            if (IsWhitelistMatch(field_trimmed_bstrs, entry))
-            {
-                if (entry->isExclusive)
-                {
-                    *isExclusiveRunning = TRUE;
-                }
-                else
-                {
-                    *isWhitelistedRunning = TRUE;
-                }
-            }
+        pending->isSeen = TRUE;
+
+        // Lists the outcome was decided for since the process was added are skipped.
+        char toCheck = pending->needed & *wanted;
+
+        if (toCheck != 0)
+        {
+            source->vtbl->readField(source, &process, PROCFIELD_CMDLINE);
+            pending->verdict |= WhitelistMatch(whitelist, process.fields, toCheck);
+            pending->needed &= ~toCheck;
+            counts->cmdlinesRead++;
         }
 
-        for (int i = 0; i < PROCFIELD_NUMOF; i++)
+        *lists |= pending->verdict & (LIST_WHITELIST | LIST_EXCLUSIVE);
+
+        if (isExhaustive) continue;
+        if (*lists & LIST_WHITELIST) return FALSE;
+        if (*lists & LIST_EXCLUSIVE) *wanted &= ~LIST_EXCLUSIVE;
+    }
+
+    return res == PROCSOURCE_END;
+}
+
+// Returns FALSE if there's no room for it, in which case its command line has to be read right away.
+static char AddPendingProcess(const ProcessInfo *process, char verdict, char unchecked, char needed)
+{
+    if (cb.npending == cb.pendingCapacity)
+    {
+        size_t capacity = cb.pendingCapacity == 0 ? 64 : cb.pendingCapacity * 2;
+        PendingProcess *grown = realloc(cb.pending, capacity * sizeof(*grown));
+
+        if (grown == NULL)
         {
-            if (field_bstrs[i] != NULL) SysFreeString(field_bstrs[i]);
-            if (field_variants[i].vt != VT_EMPTY) VariantClear(&field_variants[i]);
+            return FALSE;
         }
 
-        result->lpVtbl->Release(result);
+        cb.pending = grown;
+        cb.pendingCapacity = capacity;
     }
 
-    enumWbem->lpVtbl->Release(enumWbem);
+    cb.pending[cb.npending++] = (PendingProcess){ process->pid, process->createTime, verdict, unchecked, needed, FALSE };
+    return TRUE;
 }
 
-static wchar_t *StripLeadingTrailingWhitespaceWide(wchar_t *str)
+static int ComparePendingProcesses(const void *a, const void *b)
 {
-    while (iswspace(*str)) str++;
-    size_t len = wcslen(str);
+    uint32_t pidA = ((const PendingProcess *)a)->pid;
+    uint32_t pidB = ((const PendingProcess *)b)->pid;
+    return (pidA > pidB) - (pidA < pidB);
+}
 
-    if (len > 0)
+static void MemoizeProcess(uint32_t pid, uint64_t createTime, char verdict)
+{
+    if (!ProcessMemoInsert(&cb.memo, pid, createTime, verdict))
     {
-        wchar_t *endstr = str + (len - 1);
-        while (iswspace(*endstr)) *(endstr--) = L'\0';
+        LOG_WARN("Failed to memoize process %u, it will be matched again next cycle.", pid);
     }
-
-    return str;
 }
 
-static char IsWhitelistMatch(BSTR *fields, WhitelistEntry *entry)
+// Listens for processes starting and exiting only while the polls use the events. Otherwise nothing would read them and they'd pile up,
+// for as long as we're disabled, in conflict or without a whitelist.
+static void UpdateProcessEvents(char isWanted)
 {
-    BSTR field = fields[entry->checkField];
-    char isMatch;
+    if (!isWanted && cb.processEvents != NULL)
+    {
+        LOG("Stopped listening for processes starting and exiting.");
+        ProcessEventsClose(cb.processEvents);
+        cb.processEvents = NULL;
 
-    if (field == NULL)
+        // Nothing keeps the memo up to date anymore.
+        cb.isMemoStale = TRUE;
+    }
+    else if (isWanted && cb.processEvents == NULL && !cb.isProcessEventsFailed)
     {
-        return FALSE;
+        // WMI polls for the events in the background, as often as our own polls would right after a change. Each batch that comes wakes us up,
+        // so a game is noticed that soon even while our polls are backed off. Listening starts before the next enumeration so that processes
+        // which start in between aren't missed.
+        if ((cb.processEvents = ProcessEventsOpen(POLLING_MIN_INTERVAL_SEC, FixerNotify, NULL)) == NULL)
+        {
+            LOG_WARN("Couldn't listen for processes starting and exiting, all of them will be enumerated every poll.");
+            cb.isProcessEventsFailed = TRUE;
+        }
+        else
+        {
+            LOG("Started listening for processes starting and exiting.");
+        }
+
+        cb.isMemoStale = TRUE;
     }
+}
+
+// Brings the memo up to date with the processes that started and exited since the last poll. This only costs as much as there were starts and exits.
+static void ApplyProcessEvents(CompiledWhitelist *whitelist, PollCounts *counts)
+{
+    char wanted = LIST_WHITELIST | (cb.isExclusiveExists ? LIST_EXCLUSIVE : 0);
+    ProcessEvent event;
 
-    if (entry->isSubstring)
+    while (ProcessEventsNext(cb.processEvents, &event))
     {
-        isMatch = wcsstr(field, entry->checkValue) != NULL;
+        counts->examined++;
+
+        if (event.kind == PROCEVENT_EXIT)
+        {
+            ProcessMemoRemove(&cb.memo, event.process.pid, event.process.createTime == PROCESS_ANY_CREATE_TIME ? PROCESS_MEMO_ANY_TIME : event.process.createTime);
+            continue;
+        }
+
+        // A process may start again without exiting, so its verdict is replaced rather than looked up.
+        // Starts come with their command lines already read.
+        char verdict = WhitelistMatch(whitelist, event.process.fields, wanted) | VERDICT_CHECKED(wanted);
+        counts->evaluated++;
+        counts->cmdlinesRead++;
+
+        // A process that isn't in the memo is forgotten for good, since we won't hear about it again until it exits.
+        if (!ProcessMemoInsert(&cb.memo, event.process.pid, event.process.createTime, verdict))
+        {
+            LOG_WARN("Failed to memoize process %u. Enumerating all processes again.", event.process.pid);
+            cb.isMemoStale = TRUE;
+        }
     }
-    else
+}
+
+static void UpdatePollStats(const PollCounts *counts)
+{
+    cb.stats.npolls++;
+    cb.stats.total.examined += counts->examined;
+    cb.stats.total.evaluated += counts->evaluated;
+    cb.stats.total.cmdlinesRead += counts->cmdlinesRead;
+    cb.stats.lastExamined = counts->examined;
+
+    if (cb.stats.npolls < STATS_LOG_INTERVAL_POLLS)
     {
-        isMatch = wcscmp(field, entry->checkValue) == 0;
+        return;
     }
 
-    if (isMatch)
+    LOG("Poll stats over the last %lld polls: examined %.1f processes per poll (last poll: %lld), evaluated %.1f per poll.",
+        (long long)cb.stats.npolls, (double)cb.stats.total.examined / cb.stats.npolls, (long long)cb.stats.lastExamined,
+        (double)cb.stats.total.evaluated / cb.stats.npolls);
+
+    // Every evaluated process whose command line wasn't read was decided by its name alone.
+    LOG("Command lines over the last %lld polls: read %lld, avoided %lld.",
+        (long long)cb.stats.npolls, (long long)cb.stats.total.cmdlinesRead, (long long)(cb.stats.total.evaluated - cb.stats.total.cmdlinesRead));
+
+    // Only events keep the memo complete, without them it's just whatever the last poll got through.
+    if (cb.processEvents != NULL)
     {
-        LOG("Whitelist match! list type: %s, field: %ls,\n\tWhitelist: %ls\n\tProcess:   %ls",
-            entry->isExclusive ? "exclusive" : "whitelist", procfield_str[entry->checkField],
-            entry->checkValue, field);
+        LOG("Running processes: %lld, whitelisted: %lld, exclusive: %lld.", (long long)cb.memo.count,
+            (long long)cb.memo.bitCounts[VERDICT_BIT(LIST_WHITELIST)], (long long)cb.memo.bitCounts[VERDICT_BIT(LIST_EXCLUSIVE)]);
     }
 
-    return isMatch;
+    memset(&cb.stats, 0, sizeof(cb.stats));
 }
 
 #pragma endregion // Whitelisting.
@@ -0,0 +1,71 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "defines.h"
+#include "fixerwake.h"
+#include <pthread.h>    // For waiting on glbl.wake.
+#include <errno.h>      // For telling when a wait timed out.
+#include <time.h>       // For scheduling cycles.
+
+static void UnlockGlobal(void *arg);
+
+void FixerWake()
+{
+    glbl.isWakeRequested = TRUE;
+    clock_gettime(CLOCK_MONOTONIC, &glbl.wakeRequestTime);
+    pthread_cond_signal(&glbl.wake);
+}
+
+void FixerNotify(void *ctx)
+{
+    pthread_mutex_lock(&glbl.lock);
+    glbl.isNotified = TRUE;
+    pthread_cond_signal(&glbl.wake);
+    pthread_mutex_unlock(&glbl.lock);
+}
+
+char FixerWaitForCycle(uint32_t intervalSec)
+{
+    // pthread_cond_timedwait waits until a deadline on the wall clock, so turning the clock back during the wait stretches it by as much,
+    // and turning it forward cuts it short. A monotonic condattr would avoid that, but winpthreads always waits by the wall clock.
+    // It only ever delays one cycle though, and wakes still come through right away.
+    struct timespec due;
+    char isWoken;
+    clock_gettime(CLOCK_REALTIME, &due);
+    due.tv_sec += intervalSec;
+
+    pthread_mutex_lock(&glbl.lock);
+
+    // The thread is cancelled at exit while it waits, and it mustn't take the lock with it. The push and pop may open and close a block.
+    pthread_cleanup_push(UnlockGlobal, NULL);
+
+    // Wakes requested while the last cycle ran are acted on right away.
+    while (!glbl.isWakeRequested && !glbl.isNotified && pthread_cond_timedwait(&glbl.wake, &glbl.lock, &due) != ETIMEDOUT)
+    {
+        // Spurious wakeups just wait again.
+    }
+
+    isWoken = glbl.isWakeRequested;
+    glbl.isWakeRequested = FALSE;
+    glbl.isNotified = FALSE;
+    pthread_cleanup_pop(TRUE);
+    return isWoken;
+}
+
+static void UnlockGlobal(void *arg)
+{
+    pthread_mutex_unlock(&glbl.lock);
+}
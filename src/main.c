@@ -16,6 +16,7 @@
 
 #include "Resource.h"
 #include "defines.h"
+#include "fixerwake.h"  // For waking the fixer up when the user changes something.
 #include <winsock2.h>   // For libcurl, must be included before windows.h
 #include <windows.h>    // For winapi.
 #include <tchar.h>      // For dealing with unicode and ANSI strings.
@@ -141,11 +142,13 @@ GlobalCb glbl =
 {
     .isDisabled = FALSE,
     .isRefresh = FALSE,
+    .isWakeRequested = FALSE,
     .fixerDied = FALSE,
     .issueWarning = FALSE,
     .errorMsg = {0},
     .warningMsg = {0},
     .lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
 
     .logfile = NULL,
     .loglock = PTHREAD_ONCE_INIT,
@@ -414,6 +417,7 @@ static LRESULT CALLBACK MainWindowProcedure(HWND windowHandle, UINT msg, WPARAM
 
                     pthread_mutex_lock(&glbl.lock);
                     glbl.isDisabled = FALSE;
+                    FixerWake();
                     pthread_mutex_unlock(&glbl.lock);
                     break;
                 case FLUSH_LOGS_TIMER_ID:
@@ -464,6 +468,7 @@ static LRESULT ProcessMainWindowCommand(HWND windowHandle, WPARAM wparam, LPARAM
 
                 pthread_mutex_lock(&glbl.lock);
                 glbl.isDisabled = TRUE;
+                FixerWake();
                 pthread_mutex_unlock(&glbl.lock);
                 
                 LOG("Disabled self for custom duration of %d millis", cb.currentTimerDuration);
@@ -495,6 +500,7 @@ static LRESULT ProcessMainWindowCommand(HWND windowHandle, WPARAM wparam, LPARAM
 
             pthread_mutex_lock(&glbl.lock);
             glbl.isDisabled = TRUE;
+            FixerWake();
             pthread_mutex_unlock(&glbl.lock);
             break;
         case ENABLE_INDEFINITE:
@@ -504,6 +510,7 @@ static LRESULT ProcessMainWindowCommand(HWND windowHandle, WPARAM wparam, LPARAM
 
             pthread_mutex_lock(&glbl.lock);
             glbl.isDisabled = FALSE;
+            FixerWake();
             pthread_mutex_unlock(&glbl.lock);
             break;
         case PROGRAM_EXIT:
@@ -522,6 +529,7 @@ static LRESULT ProcessMainWindowCommand(HWND windowHandle, WPARAM wparam, LPARAM
             // Marking refresh for the fixer thread to detect.
             pthread_mutex_lock(&glbl.lock);
             glbl.isRefresh = TRUE;
+            FixerWake();
             pthread_mutex_unlock(&glbl.lock);
             break;
         case PROGRAM_REGISTER_STARTUP:
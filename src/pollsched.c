@@ -0,0 +1,38 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "pollsched.h"
+
+void PollSchedulerInit(PollScheduler *ps, uint32_t minSec, uint32_t maxSec)
+{
+    ps->minSec = minSec;
+    ps->maxSec = maxSec < minSec ? minSec : maxSec;
+    ps->intervalSec = 0;
+}
+
+uint32_t PollSchedulerNext(PollScheduler *ps, char isChanged)
+{
+    if (isChanged || ps->intervalSec == 0)
+    {
+        ps->intervalSec = ps->minSec;
+    }
+    else
+    {
+        ps->intervalSec = ps->intervalSec > ps->maxSec / 2 ? ps->maxSec : ps->intervalSec * 2;
+    }
+
+    return ps->intervalSec;
+}
@@ -0,0 +1,529 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "procevents.h"
+#include <stdlib.h>     // For malloc.
+#include <string.h>     // For memset.
+
+#ifdef _WIN32
+
+#include "wmiprocess.h" // For reading the processes out of the events.
+#include <oleauto.h>    // For working with BSTRs.
+#include <wchar.h>      // For swprintf_s.
+
+// Past this many unread events new ones are dropped, and a snapshot has to make up for them.
+#define MAX_QUEUED_EVENTS 4096
+
+// Takes the events as WMI hands them over on its own threads, and keeps them until ProcessEventsNext gets to them.
+// It's a COM object of our own, which WMI holds on to for as long as the query is on.
+typedef struct
+{
+    IWbemObjectSink sink; // WMI calls it through this, so it has to come first.
+    LONG nrefs;
+    CRITICAL_SECTION lock; // For all of the below.
+    IWbemClassObject **queue;
+    size_t capacity;
+    size_t first;   // The queued events are queue[first] to queue[first + nqueued - 1].
+    size_t nqueued;
+    char isLost;
+    char isEnded;   // The query stopped for good, so every poll has to enumerate.
+    ProcessEventsCallback onArrival;
+    void *ctx;
+} EventSink;
+
+struct ProcessEvents
+{
+    IWbemLocator *locator;
+    IWbemServices *services;
+    EventSink *sink;
+    VARIANT variants[PROCFIELD_NUMOF]; // The fields of the last start event.
+    char hasVariants;
+};
+
+static EventSink *NewEventSink(ProcessEventsCallback onArrival, void *ctx);
+static IWbemClassObject *Dequeue(EventSink *es);
+static char Enqueue(EventSink *es, IWbemClassObject *object);
+static HRESULT STDMETHODCALLTYPE SinkQueryInterface(IWbemObjectSink *sink, REFIID riid, void **object);
+static ULONG STDMETHODCALLTYPE SinkAddRef(IWbemObjectSink *sink);
+static ULONG STDMETHODCALLTYPE SinkRelease(IWbemObjectSink *sink);
+static HRESULT STDMETHODCALLTYPE SinkIndicate(IWbemObjectSink *sink, LONG count, IWbemClassObject **objects);
+static HRESULT STDMETHODCALLTYPE SinkSetStatus(IWbemObjectSink *sink, LONG flags, HRESULT res, BSTR param, IWbemClassObject *object);
+static void ClearEvent(ProcessEvents *pe);
+static char ReadEvent(ProcessEvents *pe, IWbemClassObject *object, ProcessEvent *event);
+
+static IWbemObjectSinkVtbl sinkVtbl = {
+    .QueryInterface = SinkQueryInterface,
+    .AddRef = SinkAddRef,
+    .Release = SinkRelease,
+    .Indicate = SinkIndicate,
+    .SetStatus = SinkSetStatus,
+};
+
+ProcessEvents *ProcessEventsOpen(uint32_t withinSec, ProcessEventsCallback onArrival, void *ctx)
+{
+    ProcessEvents *pe = calloc(1, sizeof(*pe));
+    wchar_t query[256];
+
+    if (pe == NULL)
+    {
+        return NULL;
+    }
+
+    swprintf_s(query, _countof(query), L"SELECT * FROM __InstanceOperationEvent WITHIN %u WHERE TargetInstance ISA 'Win32_Process' AND "
+        L"(__Class = '__InstanceCreationEvent' OR __Class = '__InstanceDeletionEvent')", withinSec);
+
+    // Creation and deletion go in the same query so that they come out in the order they happened.
+    // Modification events are left out on purpose, a process's properties change all the time.
+    // The query is asynchronous so that WMI tells us when events come, rather than us asking it every poll.
+    if ((pe->sink = NewEventSink(onArrival, ctx)) == NULL ||
+        FAILED(CoCreateInstance(&CLSID_WbemLocator, 0, CLSCTX_INPROC_SERVER, &IID_IWbemLocator, (LPVOID *)&pe->locator)) ||
+        FAILED(pe->locator->lpVtbl->ConnectServer(pe->locator, L"ROOT\\CIMV2", NULL, NULL, NULL, 0, NULL, NULL, &pe->services)) ||
+        FAILED(pe->services->lpVtbl->ExecNotificationQueryAsync(pe->services, L"WQL", query, 0, NULL, &pe->sink->sink)))
+    {
+        ProcessEventsClose(pe);
+        return NULL;
+    }
+
+    return pe;
+}
+
+char ProcessEventsNext(ProcessEvents *pe, ProcessEvent *event)
+{
+    IWbemClassObject *object;
+
+    ClearEvent(pe);
+
+    while ((object = Dequeue(pe->sink)) != NULL)
+    {
+        char isRead = ReadEvent(pe, object, event);
+        object->lpVtbl->Release(object);
+
+        if (isRead) return 1;
+    }
+
+    return 0;
+}
+
+char ProcessEventsWereLost(ProcessEvents *pe)
+{
+    EnterCriticalSection(&pe->sink->lock);
+    char isLost = pe->sink->isLost || pe->sink->isEnded;
+    pe->sink->isLost = 0;
+    LeaveCriticalSection(&pe->sink->lock);
+    return isLost;
+}
+
+void ProcessEventsClose(ProcessEvents *pe)
+{
+    if (pe == NULL)
+    {
+        return;
+    }
+
+    ClearEvent(pe);
+
+    if (pe->sink != NULL)
+    {
+        // WMI may still call the sink after the query is cancelled, so it's cut off from the callback first.
+        EnterCriticalSection(&pe->sink->lock);
+        pe->sink->onArrival = NULL;
+        LeaveCriticalSection(&pe->sink->lock);
+
+        if (pe->services != NULL) pe->services->lpVtbl->CancelAsyncCall(pe->services, &pe->sink->sink);
+        pe->sink->sink.lpVtbl->Release(&pe->sink->sink);
+    }
+
+    if (pe->services != NULL) pe->services->lpVtbl->Release(pe->services);
+    if (pe->locator != NULL) pe->locator->lpVtbl->Release(pe->locator);
+    free(pe);
+}
+
+static EventSink *NewEventSink(ProcessEventsCallback onArrival, void *ctx)
+{
+    EventSink *es = calloc(1, sizeof(*es));
+
+    if (es == NULL)
+    {
+        return NULL;
+    }
+
+    es->sink.lpVtbl = &sinkVtbl;
+    es->nrefs = 1;
+    es->onArrival = onArrival;
+    es->ctx = ctx;
+    InitializeCriticalSection(&es->lock);
+    return es;
+}
+
+// Returns the oldest event, or NULL if there are none. The caller releases it.
+static IWbemClassObject *Dequeue(EventSink *es)
+{
+    IWbemClassObject *object = NULL;
+
+    EnterCriticalSection(&es->lock);
+
+    if (es->nqueued > 0)
+    {
+        object = es->queue[es->first++];
+        if (--es->nqueued == 0) es->first = 0;
+    }
+
+    LeaveCriticalSection(&es->lock);
+    return object;
+}
+
+// Keeps a reference to the event. Returns zero if there's no room for it. Call with the lock held.
+static char Enqueue(EventSink *es, IWbemClassObject *object)
+{
+    if (es->first + es->nqueued == es->capacity)
+    {
+        if (es->first > 0)
+        {
+            memmove(es->queue, es->queue + es->first, es->nqueued * sizeof(*es->queue));
+            es->first = 0;
+        }
+        else
+        {
+            size_t capacity = es->capacity == 0 ? 64 : es->capacity * 2;
+            IWbemClassObject **queue;
+
+            if (capacity > MAX_QUEUED_EVENTS || (queue = realloc(es->queue, capacity * sizeof(*queue))) == NULL)
+            {
+                return 0;
+            }
+
+            es->queue = queue;
+            es->capacity = capacity;
+        }
+    }
+
+    object->lpVtbl->AddRef(object);
+    es->queue[es->first + es->nqueued++] = object;
+    return 1;
+}
+
+static HRESULT STDMETHODCALLTYPE SinkQueryInterface(IWbemObjectSink *sink, REFIID riid, void **object)
+{
+    if (!IsEqualIID(riid, &IID_IUnknown) && !IsEqualIID(riid, &IID_IWbemObjectSink))
+    {
+        *object = NULL;
+        return E_NOINTERFACE;
+    }
+
+    *object = sink;
+    SinkAddRef(sink);
+    return S_OK;
+}
+
+static ULONG STDMETHODCALLTYPE SinkAddRef(IWbemObjectSink *sink)
+{
+    return InterlockedIncrement(&((EventSink *)sink)->nrefs);
+}
+
+static ULONG STDMETHODCALLTYPE SinkRelease(IWbemObjectSink *sink)
+{
+    EventSink *es = (EventSink *)sink;
+    LONG nrefs = InterlockedDecrement(&es->nrefs);
+
+    if (nrefs == 0)
+    {
+        for (size_t i = 0; i < es->nqueued; i++)
+        {
+            es->queue[es->first + i]->lpVtbl->Release(es->queue[es->first + i]);
+        }
+
+        DeleteCriticalSection(&es->lock);
+        free(es->queue);
+        free(es);
+    }
+
+    return nrefs;
+}
+
+static HRESULT STDMETHODCALLTYPE SinkIndicate(IWbemObjectSink *sink, LONG count, IWbemClassObject **objects)
+{
+    EventSink *es = (EventSink *)sink;
+
+    EnterCriticalSection(&es->lock);
+
+    for (LONG i = 0; i < count; i++)
+    {
+        if (!Enqueue(es, objects[i])) es->isLost = 1;
+    }
+
+    // Called with the lock held, so that once ProcessEventsClose took it from the sink it's never called again.
+    if (es->onArrival != NULL) es->onArrival(es->ctx);
+
+    LeaveCriticalSection(&es->lock);
+    return WBEM_S_NO_ERROR;
+}
+
+static HRESULT STDMETHODCALLTYPE SinkSetStatus(IWbemObjectSink *sink, LONG flags, HRESULT res, BSTR param, IWbemClassObject *object)
+{
+    EventSink *es = (EventSink *)sink;
+
+    // An event query only completes if it fails or is cancelled, and no events come after that.
+    if (flags == WBEM_STATUS_COMPLETE)
+    {
+        EnterCriticalSection(&es->lock);
+        es->isEnded = 1;
+        if (es->onArrival != NULL) es->onArrival(es->ctx);
+        LeaveCriticalSection(&es->lock);
+    }
+
+    return WBEM_S_NO_ERROR;
+}
+
+static void ClearEvent(ProcessEvents *pe)
+{
+    if (pe->hasVariants) WmiClearProcessFields(pe->variants);
+    pe->hasVariants = 0;
+}
+
+// Returns zero if the event isn't about a process we can identify, in which case it's skipped.
+static char ReadEvent(ProcessEvents *pe, IWbemClassObject *object, ProcessEvent *event)
+{
+    VARIANT classVariant, targetVariant;
+    IWbemClassObject *process = NULL;
+    char success = 0;
+
+    VariantInit(&classVariant);
+    VariantInit(&targetVariant);
+
+    if (FAILED(object->lpVtbl->Get(object, L"__Class", 0, &classVariant, 0, 0)) || classVariant.vt != VT_BSTR ||
+        FAILED(object->lpVtbl->Get(object, L"TargetInstance", 0, &targetVariant, 0, 0)) || targetVariant.vt != VT_UNKNOWN ||
+        FAILED(targetVariant.punkVal->lpVtbl->QueryInterface(targetVariant.punkVal, &IID_IWbemClassObject, (void **)&process)) ||
+        !WmiGetProcessIdentity(process, &event->process.pid, &event->process.createTime))
+    {
+        goto cleanup;
+    }
+
+    event->kind = wcscmp(classVariant.bstrVal, L"__InstanceCreationEvent") == 0 ? PROCEVENT_START : PROCEVENT_EXIT;
+    event->process.isIdentified = 1;
+    memset(event->process.fields, 0, sizeof(event->process.fields));
+
+    // The fields are copied out of the process, so it can be released right away.
+    if (event->kind == PROCEVENT_START)
+    {
+        WmiGetProcessFields(process, pe->variants, event->process.fields);
+        pe->hasVariants = 1;
+    }
+
+    success = 1;
+
+cleanup:
+    if (process != NULL) process->lpVtbl->Release(process);
+    VariantClear(&classVariant);
+    VariantClear(&targetVariant);
+    return success;
+}
+
+#else
+
+#include "fdnotify.h"   // For telling the listener of arrivals.
+#include <errno.h>      // For telling why recv failed.
+#include <fcntl.h>      // For opening /proc.
+#include <unistd.h>     // For close.
+#include <sys/socket.h> // For talking to the kernel over netlink.
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+#define RECV_BUFFER_SIZE (1 << 14)
+
+struct ProcessEvents
+{
+    int sock;
+    int procfd;
+    char isLost;
+    FdNotifier *notifier;
+
+    // The messages of the last recv, and how far into them we've read.
+    size_t nreceived;
+    size_t pos;
+    char buffer[RECV_BUFFER_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+    ProcfsReader reader; // Holds the fields of the last start event.
+};
+
+static char Subscribe(int sock);
+static char NextMessage(ProcessEvents *pe, struct proc_event *ev);
+
+ProcessEvents *ProcessEventsOpen(uint32_t withinSec, ProcessEventsCallback onArrival, void *ctx)
+{
+    struct sockaddr_nl addr = { .nl_family = AF_NETLINK, .nl_groups = CN_IDX_PROC };
+    int sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+
+    if (sock == -1)
+    {
+        return NULL;
+    }
+
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 || !Subscribe(sock))
+    {
+        close(sock);
+        return NULL;
+    }
+
+    return ProcessEventsFromSocket(sock, onArrival, ctx);
+}
+
+ProcessEvents *ProcessEventsFromSocket(int sock, ProcessEventsCallback onArrival, void *ctx)
+{
+    ProcessEvents *pe = calloc(1, sizeof(*pe));
+
+    if (pe == NULL)
+    {
+        close(sock);
+        return NULL;
+    }
+
+    pe->sock = sock;
+
+    if ((pe->procfd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 ||
+        (onArrival != NULL && (pe->notifier = FdNotifierStart(sock, onArrival, ctx)) == NULL))
+    {
+        ProcessEventsClose(pe);
+        return NULL;
+    }
+
+    return pe;
+}
+
+char ProcessEventsNext(ProcessEvents *pe, ProcessEvent *event)
+{
+    struct proc_event ev;
+
+    while (NextMessage(pe, &ev))
+    {
+        // Only whole processes are interesting, not their threads. A process is only worth matching once it has exec'd,
+        // until then it's a copy of its parent. If it's gone by the time we read it, its exit is coming and there's nothing to match.
+        if (ev.what == PROC_EVENT_EXEC && ProcfsReadIdentity(&pe->reader, pe->procfd, ev.event_data.exec.process_tgid, &event->process))
+        {
+            event->kind = PROCEVENT_START;
+            ProcfsReadField(&pe->reader, pe->procfd, &event->process, PROCFIELD_NAME);
+            ProcfsReadField(&pe->reader, pe->procfd, &event->process, PROCFIELD_CMDLINE);
+            return 1;
+        }
+
+        if (ev.what == PROC_EVENT_EXIT && ev.event_data.exit.process_pid == ev.event_data.exit.process_tgid)
+        {
+            // The process is gone by now so its start time can't be read.
+            memset(event, 0, sizeof(*event));
+            event->kind = PROCEVENT_EXIT;
+            event->process.pid = ev.event_data.exit.process_tgid;
+            event->process.createTime = PROCESS_ANY_CREATE_TIME;
+            event->process.isIdentified = 1;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+char ProcessEventsWereLost(ProcessEvents *pe)
+{
+    char isLost = pe->isLost;
+    pe->isLost = 0;
+    return isLost;
+}
+
+void ProcessEventsClose(ProcessEvents *pe)
+{
+    if (pe == NULL)
+    {
+        return;
+    }
+
+    // The notifier waits on the socket, so it has to stop before the socket is closed.
+    FdNotifierStop(pe->notifier);
+    if (pe->sock >= 0) close(pe->sock);
+    if (pe->procfd >= 0) close(pe->procfd);
+    ProcfsReaderFree(&pe->reader);
+    free(pe);
+}
+
+static char Subscribe(int sock)
+{
+    struct __attribute__((aligned(NLMSG_ALIGNTO)))
+    {
+        struct nlmsghdr header;
+        struct __attribute__((packed))
+        {
+            struct cn_msg msg;
+            enum proc_cn_mcast_op op;
+        } body;
+    } request = {0};
+
+    request.header.nlmsg_len = sizeof(request);
+    request.header.nlmsg_type = NLMSG_DONE;
+    request.body.msg.id.idx = CN_IDX_PROC;
+    request.body.msg.id.val = CN_VAL_PROC;
+    request.body.msg.len = sizeof(request.body.op);
+    request.body.op = PROC_CN_MCAST_LISTEN;
+
+    return send(sock, &request, sizeof(request), 0) == sizeof(request);
+}
+
+// Copies out the next process event the kernel sent. Returns zero if there are none right now.
+static char NextMessage(ProcessEvents *pe, struct proc_event *ev)
+{
+    for (;;)
+    {
+        if (pe->pos >= pe->nreceived)
+        {
+            ssize_t n = recv(pe->sock, pe->buffer, sizeof(pe->buffer), 0);
+
+            if (n <= 0)
+            {
+                // ENOBUFS means the kernel had to drop events because we didn't read them fast enough.
+                if (n < 0 && errno == ENOBUFS)
+                {
+                    pe->isLost = 1;
+                    continue;
+                }
+
+                if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) pe->isLost = 1;
+                return 0;
+            }
+
+            pe->nreceived = n;
+            pe->pos = 0;
+        }
+
+        struct nlmsghdr *header = (struct nlmsghdr *)(pe->buffer + pe->pos);
+        size_t remaining = pe->nreceived - pe->pos;
+
+        if (!NLMSG_OK(header, remaining))
+        {
+            pe->pos = pe->nreceived;
+            continue;
+        }
+
+        pe->pos += NLMSG_ALIGN(header->nlmsg_len);
+        const struct cn_msg *msg = NLMSG_DATA(header);
+
+        if (header->nlmsg_len >= NLMSG_LENGTH(sizeof(*msg) + sizeof(struct proc_event)) &&
+            msg->id.idx == CN_IDX_PROC && msg->id.val == CN_VAL_PROC)
+        {
+            // The event isn't aligned in the message.
+            memcpy(ev, msg->data, sizeof(*ev));
+            return 1;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,226 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "procmemo.h"
+#include <stdlib.h>     // For calloc.
+#include <string.h>     // For memset.
+
+#define MIN_CAPACITY 256
+
+static size_t HashProcess(uint32_t pid, size_t capacity);
+static ProcessMemoSlot *FindSlot(ProcessMemoSlot *slots, size_t capacity, uint32_t pid, uint64_t createTime);
+static char Grow(ProcessMemo *memo);
+static void CountVerdict(ProcessMemo *memo, char verdict, int delta);
+
+void ProcessMemoBeginCycle(ProcessMemo *memo)
+{
+    memo->cycle++;
+}
+
+char ProcessMemoLookup(ProcessMemo *memo, uint32_t pid, uint64_t createTime, char *verdict)
+{
+    if (memo->capacity == 0) return 0;
+
+    ProcessMemoSlot *slot = FindSlot(memo->slots, memo->capacity, pid, createTime);
+    if (!slot->isUsed) return 0;
+
+    slot->lastSeen = memo->cycle;
+    *verdict = slot->verdict;
+    return 1;
+}
+
+char ProcessMemoInsert(ProcessMemo *memo, uint32_t pid, uint64_t createTime, char verdict)
+{
+    // Keep the load factor at most 3/4 so probe sequences stay short.
+    if ((memo->count + 1) * 4 > memo->capacity * 3 && !Grow(memo)) return 0;
+
+    ProcessMemoSlot *slot = FindSlot(memo->slots, memo->capacity, pid, createTime);
+
+    if (!slot->isUsed)
+    {
+        slot->isUsed = 1;
+        slot->pid = pid;
+        slot->createTime = createTime;
+        memo->count++;
+    }
+    else
+    {
+        CountVerdict(memo, slot->verdict, -1);
+    }
+
+    slot->lastSeen = memo->cycle;
+    slot->verdict = verdict;
+    CountVerdict(memo, verdict, 1);
+    return 1;
+}
+
+char ProcessMemoRemove(ProcessMemo *memo, uint32_t pid, uint64_t createTime)
+{
+    if (memo->capacity == 0) return 0;
+
+    size_t mask = memo->capacity - 1;
+    ProcessMemoSlot *slots = memo->slots;
+    size_t i = HashProcess(pid, memo->capacity);
+
+    while (slots[i].isUsed && (slots[i].pid != pid || (createTime != PROCESS_MEMO_ANY_TIME && slots[i].createTime != createTime)))
+    {
+        i = (i + 1) & mask;
+    }
+
+    if (!slots[i].isUsed) return 0;
+
+    CountVerdict(memo, slots[i].verdict, -1);
+
+    // Linear probing doesn't allow simply emptying the slot. Every process after it in the probe sequence that could have gone in it moves back instead.
+    for (size_t j = (i + 1) & mask; slots[j].isUsed; j = (j + 1) & mask)
+    {
+        size_t home = HashProcess(slots[j].pid, memo->capacity);
+
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+
+    memset(&slots[i], 0, sizeof(slots[i]));
+    memo->count--;
+    return 1;
+}
+
+size_t ProcessMemoEndCycle(ProcessMemo *memo)
+{
+    size_t nstale = 0;
+
+    for (size_t i = 0; i < memo->capacity; i++)
+    {
+        if (memo->slots[i].isUsed && memo->slots[i].lastSeen != memo->cycle)
+        {
+            CountVerdict(memo, memo->slots[i].verdict, -1);
+            nstale++;
+        }
+    }
+
+    if (nstale == 0) return 0;
+
+    // Linear probing doesn't allow simply emptying slots, so rebuild the table without the stale processes.
+    memset(memo->spare, 0, memo->capacity * sizeof(*memo->spare));
+
+    for (size_t i = 0; i < memo->capacity; i++)
+    {
+        ProcessMemoSlot *slot = &memo->slots[i];
+        if (slot->isUsed && slot->lastSeen == memo->cycle) *FindSlot(memo->spare, memo->capacity, slot->pid, slot->createTime) = *slot;
+    }
+
+    ProcessMemoSlot *tmp = memo->slots;
+    memo->slots = memo->spare;
+    memo->spare = tmp;
+    memo->count -= nstale;
+    return nstale;
+}
+
+void ProcessMemoRemap(ProcessMemo *memo, ProcessMemoRemapCallback cb, void *ctx)
+{
+    for (size_t i = 0; i < memo->capacity; i++)
+    {
+        if (!memo->slots[i].isUsed) continue;
+
+        CountVerdict(memo, memo->slots[i].verdict, -1);
+        memo->slots[i].verdict = cb(memo->slots[i].verdict, ctx);
+        CountVerdict(memo, memo->slots[i].verdict, 1);
+    }
+}
+
+char ProcessMemoVerdictUnion(const ProcessMemo *memo)
+{
+    unsigned char verdicts = 0;
+
+    for (int bit = 0; bit < CHAR_BIT; bit++)
+    {
+        if (memo->bitCounts[bit] > 0) verdicts |= 1u << bit;
+    }
+
+    return (char)verdicts;
+}
+
+void ProcessMemoFree(ProcessMemo *memo)
+{
+    free(memo->slots);
+    free(memo->spare);
+    memset(memo, 0, sizeof(*memo));
+}
+
+// splitmix64's finalizer, good enough to spread out PIDs which tend to be multiples of 4.
+// Only the PID is hashed so that a process can be found when its creation time isn't known.
+static size_t HashProcess(uint32_t pid, size_t capacity)
+{
+    uint64_t x = (uint64_t)pid << 32 | pid;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x & (capacity - 1);
+}
+
+// Returns the slot of the process, or the empty slot where it should go.
+static ProcessMemoSlot *FindSlot(ProcessMemoSlot *slots, size_t capacity, uint32_t pid, uint64_t createTime)
+{
+    size_t i = HashProcess(pid, capacity);
+
+    while (slots[i].isUsed && (slots[i].pid != pid || slots[i].createTime != createTime))
+    {
+        i = (i + 1) & (capacity - 1);
+    }
+
+    return &slots[i];
+}
+
+static char Grow(ProcessMemo *memo)
+{
+    size_t capacity = memo->capacity == 0 ? MIN_CAPACITY : memo->capacity * 2;
+    ProcessMemoSlot *slots = calloc(capacity, sizeof(*slots));
+    ProcessMemoSlot *spare = calloc(capacity, sizeof(*spare));
+
+    if (slots == NULL || spare == NULL)
+    {
+        free(slots);
+        free(spare);
+        return 0;
+    }
+
+    for (size_t i = 0; i < memo->capacity; i++)
+    {
+        ProcessMemoSlot *slot = &memo->slots[i];
+        if (slot->isUsed) *FindSlot(slots, capacity, slot->pid, slot->createTime) = *slot;
+    }
+
+    free(memo->slots);
+    free(memo->spare);
+    memo->slots = slots;
+    memo->spare = spare;
+    memo->capacity = capacity;
+    return 1;
+}
+
+// Adds delta to the count of every bit that's set in the verdict.
+static void CountVerdict(ProcessMemo *memo, char verdict, int delta)
+{
+    for (int bit = 0; bit < CHAR_BIT; bit++)
+    {
+        if ((unsigned char)verdict & (1u << bit)) memo->bitCounts[bit] += delta;
+    }
+}
@@ -0,0 +1,283 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// The WMI process source is in wmiprocess.c. This is the /proc one, which is what gets used everywhere else.
+
+#include "procsource.h"
+
+#ifndef _WIN32
+
+#include <dirent.h>     // For going over /proc.
+#include <fcntl.h>      // For openat.
+#include <stdio.h>      // For snprintf.
+#include <stdlib.h>     // For malloc.
+#include <string.h>     // For strrchr.
+#include <unistd.h>     // For pread.
+
+#define INITIAL_RAW_SIZE 512
+
+// From the kernel's sched.h, set in the flags of kernel threads.
+#define PF_KTHREAD 0x00200000
+
+typedef struct
+{
+    ProcessSource base;
+    int procfd;
+    DIR *dir; // Reads procfd, and is rewound for every enumeration.
+    ProcfsReader reader;
+
+    // The PIDs given to beginSome and how many were gone over, if isSome. Otherwise the whole directory is gone over.
+    uint32_t *pids;
+    size_t npids;
+    size_t pidsCapacity;
+    size_t pos;
+    char isSome;
+} ProcfsSource;
+
+static char ReadFile(ProcfsReader *reader, int procfd, uint32_t pid, const char *name, size_t *len);
+static void WidenField(ProcfsReader *reader, ProcessField field, size_t len, ProcessInfo *process);
+static char ProcfsBegin(ProcessSource *source);
+static char ProcfsBeginSome(ProcessSource *source, const uint32_t *pids, size_t npids);
+static ProcessSourceResult ProcfsNext(ProcessSource *source, ProcessInfo *process);
+static void ProcfsReadSourceField(ProcessSource *source, ProcessInfo *process, ProcessField field);
+static void ProcfsClose(ProcessSource *source);
+
+static const ProcessSourceVtbl procfsVtbl = { ProcfsBegin, ProcfsBeginSome, ProcfsNext, ProcfsReadSourceField, ProcfsClose };
+
+char ProcfsReadIdentity(ProcfsReader *reader, int procfd, uint32_t pid, ProcessInfo *process)
+{
+    size_t len;
+    unsigned int flags;
+    unsigned long long startTime;
+
+    if (!ReadFile(reader, procfd, pid, "stat", &len))
+    {
+        return 0;
+    }
+
+    // The flags and start time are the 9th and 22nd fields, and the name before them may have spaces and parentheses of its own.
+    const char *afterName = strrchr(reader->raw, ')');
+
+    if (afterName == NULL ||
+        sscanf(afterName + 1, " %*c %*d %*d %*d %*d %*d %u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu", &flags, &startTime) != 2 ||
+        (flags & PF_KTHREAD))
+    {
+        return 0;
+    }
+
+    process->pid = pid;
+    process->createTime = startTime;
+    process->isIdentified = 1;
+    memset(process->fields, 0, sizeof(process->fields));
+    return 1;
+}
+
+void ProcfsReadField(ProcfsReader *reader, int procfd, ProcessInfo *process, ProcessField field)
+{
+    size_t len;
+    process->fields[field] = (WideSpan){ NULL, 0 };
+
+    // comm is the name of the executable, cut to 15 bytes.
+    if (field == PROCFIELD_NAME && ReadFile(reader, procfd, process->pid, "comm", &len))
+    {
+        if (len > 0 && reader->raw[len - 1] == '\n') reader->raw[--len] = '\0';
+        WidenField(reader, PROCFIELD_NAME, len, process);
+    }
+
+    // Arguments are separated by null characters.
+    if (field == PROCFIELD_CMDLINE && ReadFile(reader, procfd, process->pid, "cmdline", &len))
+    {
+        while (len > 0 && reader->raw[len - 1] == '\0') len--;
+        for (size_t i = 0; i < len; i++) if (reader->raw[i] == '\0') reader->raw[i] = ' ';
+        reader->raw[len] = '\0';
+        WidenField(reader, PROCFIELD_CMDLINE, len, process);
+    }
+}
+
+void ProcfsReaderFree(ProcfsReader *reader)
+{
+    free(reader->raw);
+    for (int i = 0; i < PROCFIELD_NUMOF; i++) free(reader->wide[i]);
+    memset(reader, 0, sizeof(*reader));
+}
+
+ProcessSource *ProcfsSourceOpen()
+{
+    ProcfsSource *source = calloc(1, sizeof(*source));
+
+    if (source == NULL)
+    {
+        return NULL;
+    }
+
+    source->base.vtbl = &procfsVtbl;
+
+    // The directory stream gets its own descriptor so that closing it leaves procfd open for openat.
+    if ((source->procfd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 ||
+        (source->dir = opendir("/proc")) == NULL)
+    {
+        if (source->procfd != -1) close(source->procfd);
+        free(source);
+        return NULL;
+    }
+
+    return &source->base;
+}
+
+// Reads the whole file into the reader's buffer, null-terminated. Files in /proc don't know their size up front, so the buffer grows until it fits.
+static char ReadFile(ProcfsReader *reader, int procfd, uint32_t pid, const char *name, size_t *len)
+{
+    char path[32];
+    int fd;
+
+    snprintf(path, sizeof(path), "%u/%s", pid, name);
+
+    if ((fd = openat(procfd, path, O_RDONLY | O_CLOEXEC)) == -1)
+    {
+        return 0;
+    }
+
+    *len = 0;
+
+    for (;;)
+    {
+        if (reader->rawSize - *len < 2)
+        {
+            size_t size = reader->rawSize == 0 ? INITIAL_RAW_SIZE : reader->rawSize * 2;
+            char *raw = realloc(reader->raw, size);
+
+            if (raw == NULL)
+            {
+                close(fd);
+                return 0;
+            }
+
+            reader->raw = raw;
+            reader->rawSize = size;
+        }
+
+        ssize_t n = pread(fd, reader->raw + *len, reader->rawSize - *len - 1, *len);
+
+        if (n < 0)
+        {
+            close(fd);
+            return 0;
+        }
+
+        if (n == 0) break;
+        *len += n;
+    }
+
+    close(fd);
+    reader->raw[*len] = '\0';
+    return 1;
+}
+
+// Converts the first len bytes of the buffer. Fields that can't be converted are left NULL, they can't match anything either.
+static void WidenField(ProcfsReader *reader, ProcessField field, size_t len, ProcessInfo *process)
+{
+    // A character never takes less than a byte.
+    if (reader->wideSize[field] < len + 1)
+    {
+        wchar_t *wide = realloc(reader->wide[field], (len + 1) * sizeof(*wide));
+        if (wide == NULL) return;
+
+        reader->wide[field] = wide;
+        reader->wideSize[field] = len + 1;
+    }
+
+    size_t n = mbstowcs(reader->wide[field], reader->raw, len + 1);
+    if (n != (size_t)-1) process->fields[field] = WideSpanTrim((WideSpan){ reader->wide[field], n });
+}
+
+static char ProcfsBegin(ProcessSource *source)
+{
+    ProcfsSource *procfs = (ProcfsSource *)source;
+
+    procfs->isSome = 0;
+    rewinddir(procfs->dir);
+    return 1;
+}
+
+// Reading the command line costs the same here as reading anything else, so this only saves going over the whole directory.
+static char ProcfsBeginSome(ProcessSource *source, const uint32_t *pids, size_t npids)
+{
+    ProcfsSource *procfs = (ProcfsSource *)source;
+
+    if (procfs->pidsCapacity < npids)
+    {
+        uint32_t *grown = realloc(procfs->pids, npids * sizeof(*grown));
+        if (grown == NULL) return 0;
+
+        procfs->pids = grown;
+        procfs->pidsCapacity = npids;
+    }
+
+    if (npids > 0) memcpy(procfs->pids, pids, npids * sizeof(*pids));
+    procfs->npids = npids;
+    procfs->pos = 0;
+    procfs->isSome = 1;
+    return 1;
+}
+
+static ProcessSourceResult ProcfsNext(ProcessSource *source, ProcessInfo *process)
+{
+    ProcfsSource *procfs = (ProcfsSource *)source;
+    struct dirent *entry;
+
+    if (procfs->isSome)
+    {
+        while (procfs->pos < procfs->npids)
+        {
+            if (ProcfsReadIdentity(&procfs->reader, procfs->procfd, procfs->pids[procfs->pos++], process)) return PROCSOURCE_PROCESS;
+        }
+
+        return PROCSOURCE_END;
+    }
+
+    // Processes that exit while we're going over them are simply skipped.
+    while ((entry = readdir(procfs->dir)) != NULL)
+    {
+        char *end;
+        unsigned long pid = strtoul(entry->d_name, &end, 10);
+
+        if (*end == '\0' && end != entry->d_name && ProcfsReadIdentity(&procfs->reader, procfs->procfd, pid, process))
+        {
+            return PROCSOURCE_PROCESS;
+        }
+    }
+
+    return PROCSOURCE_END;
+}
+
+static void ProcfsReadSourceField(ProcessSource *source, ProcessInfo *process, ProcessField field)
+{
+    ProcfsSource *procfs = (ProcfsSource *)source;
+    ProcfsReadField(&procfs->reader, procfs->procfd, process, field);
+}
+
+static void ProcfsClose(ProcessSource *source)
+{
+    ProcfsSource *procfs = (ProcfsSource *)source;
+
+    closedir(procfs->dir);
+    close(procfs->procfd);
+    ProcfsReaderFree(&procfs->reader);
+    free(procfs->pids);
+    free(procfs);
+}
+
+#endif
@@ -0,0 +1,980 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "regexset.h"
+#include <stdlib.h>     // For malloc and qsort.
+#include <string.h>     // For memset.
+
+// Roughly how many bytes the DFA cache may take. The number of states it holds depends on the number of character classes.
+#define DFA_CACHE_BUDGET (1 << 20)
+#define MIN_DFA_STATES 16
+
+#define ASCII_TABLE_SIZE 128
+#define COUNTOF(arr) (sizeof(arr) / sizeof(*(arr)))
+#define NO_STATE -1
+
+typedef enum
+{
+    NFA_EPSILON,
+    NFA_SPLIT,
+    NFA_RANGES,
+    NFA_BEGIN,
+    NFA_END,
+    NFA_MATCH,
+} NfaType;
+
+typedef struct
+{
+    uint32_t type;
+    uint32_t out;
+    uint32_t out1;      // Second branch of NFA_SPLIT.
+    uint32_t ranges;    // NFA_RANGES: index of the first range. NFA_MATCH: the pattern.
+    uint32_t nranges;
+} NfaState;
+
+// An inclusive range of characters.
+typedef struct
+{
+    uint32_t lo;
+    uint32_t hi;
+} CharRange;
+
+// A DFA state is a sorted set of NFA states, kept in the pool along with the patterns that match when it's reached.
+typedef struct
+{
+    uint32_t set;
+    uint32_t nset;
+    uint32_t matches;
+    uint32_t nmatches;
+    char hasEnd;        // Whether some NFA states in the set are waiting for the end of the string.
+} DfaState;
+
+struct RegexSet
+{
+    size_t npatterns;
+    uint32_t *starts;   // The first NFA state of each pattern.
+
+    NfaState *states;
+    uint32_t nstates;
+    uint32_t statesCap;
+    CharRange *ranges;
+    uint32_t nranges;
+    uint32_t rangesCap;
+
+    // The alphabet is split into classes of characters that no pattern tells apart, and the DFA transitions on classes.
+    // Class i is the characters from boundaries[i] up to the next boundary.
+    uint32_t *boundaries;
+    uint32_t nclasses;
+    uint32_t asciiClass[ASCII_TABLE_SIZE];
+
+    // The lazy DFA. Everything here is allocated once when the set is built, scanning never allocates.
+    DfaState *dfa;
+    uint32_t ndfa;
+    uint32_t maxDfa;
+    int32_t *trans;     // maxDfa rows of nclasses transitions, NO_STATE where not computed yet.
+    int32_t *buckets;   // Hash table of the DFA states by their NFA state set.
+    uint32_t nbuckets;  // Always a power of 2.
+    uint32_t *pool;
+    uint32_t poolLen;
+    uint32_t poolCap;
+    int32_t begin;      // The state at the start of the string, NO_STATE if not computed yet.
+    uint32_t nflushes;
+
+    // Scratch space for computing NFA state sets.
+    uint32_t *scratch;
+    uint32_t *stack;
+    uint32_t *marks;
+    uint32_t markGen;
+};
+
+typedef struct
+{
+    uint32_t start;
+    uint32_t end; // An NFA_EPSILON whose out is yet to be connected.
+} Fragment;
+
+typedef struct
+{
+    RegexSet *rs;
+    const wchar_t *pattern;
+    size_t len;
+    size_t pos;
+    const char *error;
+    CharRange *tmp;     // The ranges of the class being parsed.
+    size_t ntmp;
+    size_t tmpCap;
+} Parser;
+
+static const CharRange digitRanges[] = { {'0', '9'} };
+static const CharRange wordRanges[] = { {'0', '9'}, {'A', 'Z'}, {'_', '_'}, {'a', 'z'} };
+static const CharRange spaceRanges[] = { {'\t', '\r'}, {' ', ' '} };
+
+static char CompilePattern(RegexSet *rs, Parser *p, uint32_t pattern, const wchar_t *str, size_t len);
+static char ParseAlternation(Parser *p, Fragment *frag);
+static char ParseConcatenation(Parser *p, Fragment *frag);
+static char ParseRepetition(Parser *p, Fragment *frag);
+static char ParseAtom(Parser *p, Fragment *frag);
+static char ParseBracket(Parser *p, Fragment *frag);
+static char ParseEscape(Parser *p);
+static char ReserveRanges(Parser *p, size_t n);
+static char AppendRanges(Parser *p, const CharRange *ranges, size_t n, char negate);
+static char AddRangesState(Parser *p, char negate, Fragment *frag);
+static int64_t AddState(RegexSet *rs, uint32_t type, uint32_t out, uint32_t out1);
+static char Fail(Parser *p, const char *error);
+static int CompareRanges(const void *a, const void *b);
+static int CompareU32(const void *a, const void *b);
+static size_t NormalizeRanges(CharRange *ranges, size_t n);
+static char BuildClasses(RegexSet *rs);
+static char AllocateDfa(RegexSet *rs);
+static void Flush(RegexSet *rs);
+static void NextMarkGen(RegexSet *rs);
+static void AddClosure(RegexSet *rs, uint32_t *list, uint32_t *n, uint32_t s, char atBegin, char atEnd);
+static int32_t FindOrAddState(RegexSet *rs, uint32_t *list, uint32_t n);
+static int32_t BeginState(RegexSet *rs);
+static int32_t Step(RegexSet *rs, int32_t d, uint32_t cls);
+static char IsInRanges(const RegexSet *rs, const NfaState *st, uint32_t c);
+static uint32_t ClassOf(const RegexSet *rs, uint32_t c);
+static char ReportEndMatches(RegexSet *rs, int32_t d, char atBegin, RegexSetCallback onMatch, void *ctx);
+
+RegexSet *RegexSetBuild(const wchar_t *const *patterns, const size_t *lens, size_t npatterns, RegexError *error)
+{
+    RegexSet *rs = calloc(1, sizeof(*rs));
+    Parser p = {0};
+    error->msg = "out of memory";
+    error->pattern = 0;
+    error->pos = 0;
+
+    if (rs == NULL || (rs->starts = malloc(npatterns * sizeof(*rs->starts) + 1)) == NULL)
+    {
+        goto error;
+    }
+
+    rs->npatterns = npatterns;
+
+    for (size_t i = 0; i < npatterns; i++)
+    {
+        if (!CompilePattern(rs, &p, i, patterns[i], lens[i]))
+        {
+            error->msg = p.error;
+            error->pattern = i;
+            error->pos = p.pos;
+            goto error;
+        }
+    }
+
+    if (!BuildClasses(rs) || !AllocateDfa(rs))
+    {
+        goto error;
+    }
+
+    free(p.tmp);
+    return rs;
+
+error:
+    free(p.tmp);
+    RegexSetFree(rs);
+    return NULL;
+}
+
+char RegexCheck(const wchar_t *pattern, size_t len, RegexError *error)
+{
+    RegexSet *rs = calloc(1, sizeof(*rs));
+    Parser p = {0};
+    char success = 0;
+    error->msg = "out of memory";
+    error->pattern = 0;
+    error->pos = 0;
+
+    if (rs != NULL && (rs->starts = malloc(sizeof(*rs->starts))) != NULL)
+    {
+        rs->npatterns = 1;
+        success = CompilePattern(rs, &p, 0, pattern, len);
+        if (!success) error->msg = p.error;
+        error->pos = p.pos;
+    }
+
+    free(p.tmp);
+    RegexSetFree(rs);
+    return success;
+}
+
+char RegexSetScan(RegexSet *rs, const wchar_t *text, size_t len, RegexSetCallback onMatch, void *ctx)
+{
+    int32_t d = BeginState(rs);
+
+    for (size_t i = 0;; i++)
+    {
+        const DfaState *ds = &rs->dfa[d];
+
+        for (uint32_t m = 0; m < ds->nmatches; m++)
+        {
+            if (onMatch(rs->pool[ds->matches + m], ctx)) return 1;
+        }
+
+        // With no NFA states left nothing can match anymore. That only happens when every pattern is anchored with ^.
+        if (i == len || ds->nset == 0) break;
+
+        uint32_t c = (uint32_t)text[i];
+        uint32_t cls = c < ASCII_TABLE_SIZE ? rs->asciiClass[c] : ClassOf(rs, c);
+        int32_t next = rs->trans[(size_t)d * rs->nclasses + cls];
+        d = next != NO_STATE ? next : Step(rs, d, cls);
+    }
+
+    return ReportEndMatches(rs, d, len == 0, onMatch, ctx);
+}
+
+size_t RegexSetSize(const RegexSet *rs)
+{
+    return sizeof(*rs) + rs->npatterns * sizeof(*rs->starts) + rs->statesCap * sizeof(*rs->states) + rs->rangesCap * sizeof(*rs->ranges) +
+        rs->nclasses * sizeof(*rs->boundaries) + rs->maxDfa * (sizeof(*rs->dfa) + rs->nclasses * sizeof(*rs->trans)) +
+        rs->nbuckets * sizeof(*rs->buckets) + rs->poolCap * sizeof(*rs->pool) + rs->nstates * 3 * sizeof(uint32_t);
+}
+
+void RegexSetFree(RegexSet *rs)
+{
+    if (rs == NULL)
+    {
+        return;
+    }
+
+    free(rs->starts);
+    free(rs->states);
+    free(rs->ranges);
+    free(rs->boundaries);
+    free(rs->dfa);
+    free(rs->trans);
+    free(rs->buckets);
+    free(rs->pool);
+    free(rs->scratch);
+    free(rs->stack);
+    free(rs->marks);
+    free(rs);
+}
+
+#pragma region Parsing
+
+// Compiles one pattern into the NFA, ending in an NFA_MATCH state for it.
+static char CompilePattern(RegexSet *rs, Parser *p, uint32_t pattern, const wchar_t *str, size_t len)
+{
+    Fragment frag;
+    p->rs = rs;
+    p->pattern = str;
+    p->len = len;
+    p->pos = 0;
+
+    if (!ParseAlternation(p, &frag))
+    {
+        return 0;
+    }
+
+    // The only thing that can stop an alternation early is a ')' without a '('.
+    if (p->pos < p->len)
+    {
+        return Fail(p, "unmatched ')'");
+    }
+
+    int64_t match = AddState(rs, NFA_MATCH, 0, 0);
+
+    if (match < 0)
+    {
+        return Fail(p, "out of memory");
+    }
+
+    rs->states[match].ranges = pattern;
+    rs->states[frag.end].out = match;
+    rs->starts[pattern] = frag.start;
+    return 1;
+}
+
+static char ParseAlternation(Parser *p, Fragment *frag)
+{
+    if (!ParseConcatenation(p, frag))
+    {
+        return 0;
+    }
+
+    while (p->pos < p->len && p->pattern[p->pos] == L'|')
+    {
+        Fragment other;
+        p->pos++;
+
+        if (!ParseConcatenation(p, &other))
+        {
+            return 0;
+        }
+
+        int64_t end = AddState(p->rs, NFA_EPSILON, 0, 0);
+        int64_t split = AddState(p->rs, NFA_SPLIT, frag->start, other.start);
+        if (end < 0 || split < 0) return Fail(p, "out of memory");
+
+        p->rs->states[frag->end].out = end;
+        p->rs->states[other.end].out = end;
+        frag->start = split;
+        frag->end = end;
+    }
+
+    return 1;
+}
+
+static char ParseConcatenation(Parser *p, Fragment *frag)
+{
+    int64_t empty = AddState(p->rs, NFA_EPSILON, 0, 0);
+    if (empty < 0) return Fail(p, "out of memory");
+
+    frag->start = empty;
+    frag->end = empty;
+
+    while (p->pos < p->len && p->pattern[p->pos] != L'|' && p->pattern[p->pos] != L')')
+    {
+        Fragment next;
+
+        if (!ParseRepetition(p, &next))
+        {
+            return 0;
+        }
+
+        p->rs->states[frag->end].out = next.start;
+        frag->end = next.end;
+    }
+
+    return 1;
+}
+
+static char ParseRepetition(Parser *p, Fragment *frag)
+{
+    if (!ParseAtom(p, frag))
+    {
+        return 0;
+    }
+
+    for (; p->pos < p->len; p->pos++)
+    {
+        wchar_t c = p->pattern[p->pos];
+
+        if (c == L'{')
+        {
+            return Fail(p, "counted repetition isn't supported");
+        }
+
+        if (c != L'*' && c != L'+' && c != L'?')
+        {
+            break;
+        }
+
+        int64_t end = AddState(p->rs, NFA_EPSILON, 0, 0);
+        int64_t split = end < 0 ? -1 : AddState(p->rs, NFA_SPLIT, frag->start, end);
+        if (split < 0) return Fail(p, "out of memory");
+
+        // For '*' and '+' the split loops back after the atom, for '?' the atom just goes on to the end.
+        p->rs->states[frag->end].out = c == L'?' ? end : split;
+        frag->start = c == L'+' ? frag->start : split;
+        frag->end = end;
+    }
+
+    return 1;
+}
+
+static char ParseAtom(Parser *p, Fragment *frag)
+{
+    static const CharRange anyRange = { 0, WCHAR_MAX };
+    wchar_t c = p->pattern[p->pos];
+    int64_t end, start;
+
+    switch (c)
+    {
+        case L'(':
+            p->pos++;
+            if (!ParseAlternation(p, frag)) return 0;
+            if (p->pos == p->len) return Fail(p, "missing ')'");
+            p->pos++;
+            return 1;
+        case L'*':
+        case L'+':
+        case L'?':
+        case L'{':
+            return Fail(p, "nothing to repeat");
+        case L'[':
+            p->pos++;
+            return ParseBracket(p, frag);
+        case L'^':
+        case L'$':
+            p->pos++;
+            end = AddState(p->rs, NFA_EPSILON, 0, 0);
+            start = end < 0 ? -1 : AddState(p->rs, c == L'^' ? NFA_BEGIN : NFA_END, end, 0);
+            if (start < 0) return Fail(p, "out of memory");
+            frag->start = start;
+            frag->end = end;
+            return 1;
+        case L'.':
+            p->pos++;
+            p->ntmp = 0;
+            return AppendRanges(p, &anyRange, 1, 0) && AddRangesState(p, 0, frag);
+        case L'\\':
+            p->pos++;
+            p->ntmp = 0;
+            return ParseEscape(p) && AddRangesState(p, 0, frag);
+        default:
+            p->pos++;
+            p->ntmp = 0;
+            CharRange literal = { (uint32_t)c, (uint32_t)c };
+            return AppendRanges(p, &literal, 1, 0) && AddRangesState(p, 0, frag);
+    }
+}
+
+// Parses a class after its '['.
+static char ParseBracket(Parser *p, Fragment *frag)
+{
+    size_t start = p->pos;
+    char negate = 0;
+    p->ntmp = 0;
+
+    if (p->pos < p->len && p->pattern[p->pos] == L'^')
+    {
+        negate = 1;
+        start = ++p->pos;
+    }
+
+    for (;;)
+    {
+        if (p->pos == p->len)
+        {
+            return Fail(p, "missing ']'");
+        }
+
+        wchar_t c = p->pattern[p->pos];
+
+        // A ']' right at the start is just a character.
+        if (c == L']' && p->pos != start)
+        {
+            p->pos++;
+            break;
+        }
+
+        if (c == L'\\')
+        {
+            p->pos++;
+            size_t before = p->ntmp;
+            if (!ParseEscape(p)) return 0;
+
+            // Escapes like \d can't be the ends of a range, only single characters can.
+            if (p->ntmp != before + 1 || p->tmp[before].lo != p->tmp[before].hi) continue;
+        }
+        else
+        {
+            p->pos++;
+            CharRange literal = { (uint32_t)c, (uint32_t)c };
+            if (!AppendRanges(p, &literal, 1, 0)) return 0;
+        }
+
+        // A '-' makes a range, unless it's the last thing in the class.
+        if (p->pos + 1 < p->len && p->pattern[p->pos] == L'-' && p->pattern[p->pos + 1] != L']')
+        {
+            wchar_t hi = p->pattern[p->pos + 1];
+            p->pos += 2;
+
+            if (hi == L'\\')
+            {
+                if (p->pos == p->len) return Fail(p, "trailing backslash");
+                hi = p->pattern[p->pos++];
+            }
+
+            CharRange *range = &p->tmp[p->ntmp - 1];
+
+            if ((uint32_t)hi < range->lo)
+            {
+                return Fail(p, "range is out of order");
+            }
+
+            range->hi = (uint32_t)hi;
+        }
+    }
+
+    return AddRangesState(p, negate, frag);
+}
+
+// Parses an escape after its backslash and appends its characters to the class being parsed.
+static char ParseEscape(Parser *p)
+{
+    if (p->pos == p->len)
+    {
+        return Fail(p, "trailing backslash");
+    }
+
+    wchar_t c = p->pattern[p->pos++];
+    CharRange literal;
+
+    switch (c)
+    {
+        case L'd': return AppendRanges(p, digitRanges, COUNTOF(digitRanges), 0);
+        case L'D': return AppendRanges(p, digitRanges, COUNTOF(digitRanges), 1);
+        case L'w': return AppendRanges(p, wordRanges, COUNTOF(wordRanges), 0);
+        case L'W': return AppendRanges(p, wordRanges, COUNTOF(wordRanges), 1);
+        case L's': return AppendRanges(p, spaceRanges, COUNTOF(spaceRanges), 0);
+        case L'S': return AppendRanges(p, spaceRanges, COUNTOF(spaceRanges), 1);
+        case L't': literal.lo = L'\t'; break;
+        case L'n': literal.lo = L'\n'; break;
+        case L'r': literal.lo = L'\r'; break;
+        default: literal.lo = (uint32_t)c; break;
+    }
+
+    literal.hi = literal.lo;
+    return AppendRanges(p, &literal, 1, 0);
+}
+
+// Makes room for the class being parsed to grow by n ranges.
+static char ReserveRanges(Parser *p, size_t n)
+{
+    if (p->ntmp + n <= p->tmpCap)
+    {
+        return 1;
+    }
+
+    size_t cap = (p->ntmp + n) * 2;
+    CharRange *tmp = realloc(p->tmp, cap * sizeof(*tmp));
+    if (tmp == NULL) return Fail(p, "out of memory");
+
+    p->tmp = tmp;
+    p->tmpCap = cap;
+    return 1;
+}
+
+// Appends ranges to the class being parsed. If negate is set, appends everything they don't cover instead (they must be sorted and disjoint).
+static char AppendRanges(Parser *p, const CharRange *ranges, size_t n, char negate)
+{
+    // Negating n ranges can make n + 1.
+    if (!ReserveRanges(p, n + 1))
+    {
+        return 0;
+    }
+
+    if (!negate)
+    {
+        memcpy(&p->tmp[p->ntmp], ranges, n * sizeof(*ranges));
+        p->ntmp += n;
+        return 1;
+    }
+
+    uint32_t lo = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (ranges[i].lo > lo) p->tmp[p->ntmp++] = (CharRange){ lo, ranges[i].lo - 1 };
+        lo = ranges[i].hi + 1;
+    }
+
+    if (lo <= WCHAR_MAX) p->tmp[p->ntmp++] = (CharRange){ lo, WCHAR_MAX };
+    return 1;
+}
+
+// Turns the class that was parsed into an NFA_RANGES state.
+static char AddRangesState(Parser *p, char negate, Fragment *frag)
+{
+    RegexSet *rs = p->rs;
+    size_t n = NormalizeRanges(p->tmp, p->ntmp);
+    p->ntmp = n;
+
+    if (negate)
+    {
+        // The negation is built after the ranges and then moved over them. Reserving first keeps the ranges from moving while they're read.
+        if (!ReserveRanges(p, n + 1) || !AppendRanges(p, p->tmp, n, 1)) return 0;
+
+        memmove(p->tmp, &p->tmp[n], (p->ntmp - n) * sizeof(*p->tmp));
+        n = p->ntmp - n;
+    }
+
+    if (rs->nranges + n > rs->rangesCap)
+    {
+        uint32_t cap = (rs->nranges + n) * 2;
+        CharRange *ranges = realloc(rs->ranges, cap * sizeof(*ranges));
+        if (ranges == NULL) return Fail(p, "out of memory");
+
+        rs->ranges = ranges;
+        rs->rangesCap = cap;
+    }
+
+    int64_t end = AddState(rs, NFA_EPSILON, 0, 0);
+    int64_t state = end < 0 ? -1 : AddState(rs, NFA_RANGES, end, 0);
+    if (state < 0) return Fail(p, "out of memory");
+
+    memcpy(&rs->ranges[rs->nranges], p->tmp, n * sizeof(*p->tmp));
+    rs->states[state].ranges = rs->nranges;
+    rs->states[state].nranges = n;
+    rs->nranges += n;
+
+    frag->start = state;
+    frag->end = end;
+    return 1;
+}
+
+// Returns the new state's index, or -1 if memory ran out.
+static int64_t AddState(RegexSet *rs, uint32_t type, uint32_t out, uint32_t out1)
+{
+    if (rs->nstates == rs->statesCap)
+    {
+        uint32_t cap = rs->statesCap == 0 ? 64 : rs->statesCap * 2;
+        NfaState *states = realloc(rs->states, cap * sizeof(*states));
+        if (states == NULL) return -1;
+
+        rs->states = states;
+        rs->statesCap = cap;
+    }
+
+    rs->states[rs->nstates] = (NfaState){ .type = type, .out = out, .out1 = out1 };
+    return rs->nstates++;
+}
+
+static char Fail(Parser *p, const char *error)
+{
+    p->error = error;
+    return 0;
+}
+
+static int CompareRanges(const void *a, const void *b)
+{
+    const CharRange *ra = a, *rb = b;
+    return ra->lo < rb->lo ? -1 : ra->lo > rb->lo;
+}
+
+static int CompareU32(const void *a, const void *b)
+{
+    uint32_t ua = *(const uint32_t *)a, ub = *(const uint32_t *)b;
+    return ua < ub ? -1 : ua > ub;
+}
+
+// Sorts the ranges and merges the ones that overlap or touch. Returns how many are left.
+static size_t NormalizeRanges(CharRange *ranges, size_t n)
+{
+    size_t out = 0;
+    qsort(ranges, n, sizeof(*ranges), CompareRanges);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (out > 0 && (uint64_t)ranges[out - 1].hi + 1 >= ranges[i].lo)
+        {
+            if (ranges[i].hi > ranges[out - 1].hi) ranges[out - 1].hi = ranges[i].hi;
+        }
+        else
+        {
+            ranges[out++] = ranges[i];
+        }
+    }
+
+    return out;
+}
+
+#pragma endregion // Parsing
+
+#pragma region DFA
+
+// Every range starts a class and ends one, so its bounds are the class boundaries.
+static char BuildClasses(RegexSet *rs)
+{
+    uint32_t *boundaries = malloc((rs->nranges * 2 + 1) * sizeof(*boundaries));
+    uint32_t n = 0;
+
+    if (boundaries == NULL)
+    {
+        return 0;
+    }
+
+    boundaries[n++] = 0;
+
+    for (uint32_t i = 0; i < rs->nranges; i++)
+    {
+        boundaries[n++] = rs->ranges[i].lo;
+        if (rs->ranges[i].hi < WCHAR_MAX) boundaries[n++] = rs->ranges[i].hi + 1;
+    }
+
+    qsort(boundaries, n, sizeof(*boundaries), CompareU32);
+    uint32_t nclasses = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (nclasses == 0 || boundaries[nclasses - 1] != boundaries[i]) boundaries[nclasses++] = boundaries[i];
+    }
+
+    rs->boundaries = boundaries;
+    rs->nclasses = nclasses;
+
+    for (uint32_t c = 0; c < ASCII_TABLE_SIZE; c++)
+    {
+        rs->asciiClass[c] = ClassOf(rs, c);
+    }
+
+    return 1;
+}
+
+static char AllocateDfa(RegexSet *rs)
+{
+    rs->maxDfa = DFA_CACHE_BUDGET / (rs->nclasses * sizeof(*rs->trans) + sizeof(*rs->dfa));
+    if (rs->maxDfa < MIN_DFA_STATES) rs->maxDfa = MIN_DFA_STATES;
+
+    rs->nbuckets = 1;
+    while (rs->nbuckets < rs->maxDfa * 2) rs->nbuckets *= 2;
+
+    // Any single state fits in the pool, so flushing always makes room.
+    rs->poolCap = (rs->nstates + rs->npatterns) * 4 + 4096;
+
+    rs->dfa = malloc(rs->maxDfa * sizeof(*rs->dfa));
+    rs->trans = malloc((size_t)rs->maxDfa * rs->nclasses * sizeof(*rs->trans));
+    rs->buckets = malloc(rs->nbuckets * sizeof(*rs->buckets));
+    rs->pool = malloc(rs->poolCap * sizeof(*rs->pool));
+    rs->scratch = malloc((rs->nstates + 1) * sizeof(*rs->scratch));
+    rs->stack = malloc((rs->nstates + 1) * sizeof(*rs->stack));
+    rs->marks = calloc(rs->nstates + 1, sizeof(*rs->marks));
+
+    if (rs->dfa == NULL || rs->trans == NULL || rs->buckets == NULL || rs->pool == NULL || rs->scratch == NULL || rs->stack == NULL || rs->marks == NULL)
+    {
+        return 0;
+    }
+
+    Flush(rs);
+    return 1;
+}
+
+static void Flush(RegexSet *rs)
+{
+    rs->ndfa = 0;
+    rs->poolLen = 0;
+    rs->begin = NO_STATE;
+    rs->nflushes++;
+    memset(rs->buckets, 0xff, rs->nbuckets * sizeof(*rs->buckets));
+}
+
+static void NextMarkGen(RegexSet *rs)
+{
+    if (++rs->markGen == 0)
+    {
+        memset(rs->marks, 0, rs->nstates * sizeof(*rs->marks));
+        rs->markGen = 1;
+    }
+}
+
+// Adds the states reachable from s without consuming a character to list, skipping ones already marked in this generation.
+// Only the states that consume characters, match, or wait for the end of the string are added.
+static void AddClosure(RegexSet *rs, uint32_t *list, uint32_t *n, uint32_t s, char atBegin, char atEnd)
+{
+    uint32_t top = 0;
+
+#define PUSH(state)                                                     \
+    do {                                                                \
+        uint32_t pushed = (state);                                      \
+        if (rs->marks[pushed] != rs->markGen)                           \
+        {                                                               \
+            rs->marks[pushed] = rs->markGen;                            \
+            rs->stack[top++] = pushed;                                  \
+        }                                                               \
+    } while (0)
+
+    PUSH(s);
+
+    while (top > 0)
+    {
+        uint32_t id = rs->stack[--top];
+        const NfaState *st = &rs->states[id];
+
+        switch (st->type)
+        {
+            case NFA_EPSILON:
+                PUSH(st->out);
+                break;
+            case NFA_SPLIT:
+                PUSH(st->out1);
+                PUSH(st->out);
+                break;
+            case NFA_BEGIN:
+                if (atBegin) PUSH(st->out);
+                break;
+            case NFA_END:
+                if (atEnd) PUSH(st->out);
+                else list[(*n)++] = id;
+                break;
+            default:
+                list[(*n)++] = id;
+                break;
+        }
+    }
+
+#undef PUSH
+}
+
+// Returns the DFA state for the set of NFA states, adding it if it's new. Flushes the cache if it's full.
+static int32_t FindOrAddState(RegexSet *rs, uint32_t *list, uint32_t n)
+{
+    qsort(list, n, sizeof(*list), CompareU32);
+
+    // FNV-1a over the states.
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < n; i++) hash = (hash ^ list[i]) * 16777619u;
+
+    uint32_t b = hash & (rs->nbuckets - 1);
+
+    for (; rs->buckets[b] != NO_STATE; b = (b + 1) & (rs->nbuckets - 1))
+    {
+        const DfaState *ds = &rs->dfa[rs->buckets[b]];
+        if (ds->nset == n && memcmp(&rs->pool[ds->set], list, n * sizeof(*list)) == 0) return rs->buckets[b];
+    }
+
+    uint32_t nmatches = 0;
+    char hasEnd = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (rs->states[list[i]].type == NFA_MATCH) nmatches++;
+        if (rs->states[list[i]].type == NFA_END) hasEnd = 1;
+    }
+
+    if (rs->ndfa == rs->maxDfa || rs->poolLen + n + nmatches > rs->poolCap)
+    {
+        Flush(rs);
+        b = hash & (rs->nbuckets - 1);
+    }
+
+    int32_t d = rs->ndfa++;
+    DfaState *ds = &rs->dfa[d];
+    ds->set = rs->poolLen;
+    ds->nset = n;
+    ds->matches = rs->poolLen + n;
+    ds->nmatches = 0;
+    ds->hasEnd = hasEnd;
+    memcpy(&rs->pool[ds->set], list, n * sizeof(*list));
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (rs->states[list[i]].type == NFA_MATCH) rs->pool[ds->matches + ds->nmatches++] = rs->states[list[i]].ranges;
+    }
+
+    rs->poolLen += n + nmatches;
+    rs->buckets[b] = d;
+
+    for (uint32_t c = 0; c < rs->nclasses; c++)
+    {
+        rs->trans[(size_t)d * rs->nclasses + c] = NO_STATE;
+    }
+
+    return d;
+}
+
+static int32_t BeginState(RegexSet *rs)
+{
+    if (rs->begin != NO_STATE)
+    {
+        return rs->begin;
+    }
+
+    uint32_t n = 0;
+    NextMarkGen(rs);
+
+    for (size_t i = 0; i < rs->npatterns; i++)
+    {
+        AddClosure(rs, rs->scratch, &n, rs->starts[i], 1, 0);
+    }
+
+    // Assigned after the call since it might flush and reset begin.
+    int32_t d = FindOrAddState(rs, rs->scratch, n);
+    rs->begin = d;
+    return d;
+}
+
+// Computes the transition of state d on a class and caches it.
+static int32_t Step(RegexSet *rs, int32_t d, uint32_t cls)
+{
+    uint32_t c = rs->boundaries[cls];
+    const DfaState *ds = &rs->dfa[d];
+    uint32_t n = 0;
+    NextMarkGen(rs);
+
+    for (uint32_t i = 0; i < ds->nset; i++)
+    {
+        const NfaState *st = &rs->states[rs->pool[ds->set + i]];
+        if (st->type == NFA_RANGES && IsInRanges(rs, st, c)) AddClosure(rs, rs->scratch, &n, st->out, 0, 0);
+    }
+
+    // Every pattern can also start matching at the next character.
+    for (size_t i = 0; i < rs->npatterns; i++)
+    {
+        AddClosure(rs, rs->scratch, &n, rs->starts[i], 0, 0);
+    }
+
+    uint32_t nflushes = rs->nflushes;
+    int32_t next = FindOrAddState(rs, rs->scratch, n);
+
+    // If the cache was flushed, d isn't there anymore.
+    if (rs->nflushes == nflushes) rs->trans[(size_t)d * rs->nclasses + cls] = next;
+    return next;
+}
+
+static char IsInRanges(const RegexSet *rs, const NfaState *st, uint32_t c)
+{
+    const CharRange *ranges = &rs->ranges[st->ranges];
+    uint32_t lo = 0, hi = st->nranges;
+
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+
+        if (c < ranges[mid].lo) hi = mid;
+        else if (c > ranges[mid].hi) lo = mid + 1;
+        else return 1;
+    }
+
+    return 0;
+}
+
+// The class of c is the last boundary that isn't greater than it.
+static uint32_t ClassOf(const RegexSet *rs, uint32_t c)
+{
+    uint32_t lo = 0, hi = rs->nclasses;
+
+    while (hi - lo > 1)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (rs->boundaries[mid] <= c) lo = mid;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+// Reports the patterns which match only because the string ended, like ones ending in '$'.
+static char ReportEndMatches(RegexSet *rs, int32_t d, char atBegin, RegexSetCallback onMatch, void *ctx)
+{
+    const DfaState *ds = &rs->dfa[d];
+    uint32_t n = 0;
+
+    if (!ds->hasEnd)
+    {
+        return 0;
+    }
+
+    NextMarkGen(rs);
+
+    for (uint32_t i = 0; i < ds->nset; i++)
+    {
+        const NfaState *st = &rs->states[rs->pool[ds->set + i]];
+        if (st->type == NFA_END) AddClosure(rs, rs->scratch, &n, st->out, atBegin, 1);
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        const NfaState *st = &rs->states[rs->scratch[i]];
+        if (st->type == NFA_MATCH && onMatch(st->ranges, ctx)) return 1;
+    }
+
+    return 0;
+}
+
+#pragma endregion // DFA
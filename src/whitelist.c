@@ -0,0 +1,619 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "defines.h"
+#include "whitelist.h"
+#include <stdlib.h>     // For malloc.
+#include <string.h>     // For memset.
+
+// With fewer substring entries than this, searching for each one with the vectorized search beats running the automaton.
+#define MIN_SUBSTRING_ENTRIES_FOR_AUTOMATON 8
+
+typedef struct
+{
+    const CompiledWhitelist *cw;
+    const WhitelistGroup *group;
+    ProcessField field;
+    WideSpan value;
+    char wanted; // LIST_* flags of the lists to look for.
+    char found; // LIST_* flags of the matches found so far.
+} ScanCtx;
+
+// What makes two entries of a group the same when diffing whitelists.
+typedef struct
+{
+    const wchar_t *str;
+    uint32_t len;
+    char list;
+} EntryKey;
+
+static char IsSameGroup(const CompiledWhitelist *cw, const WhitelistGroup *group, const CompiledWhitelist *old, const WhitelistGroup *oldGroup);
+static void DiffGroup(const CompiledWhitelist *cw, const WhitelistGroup *group, const CompiledWhitelist *old, const WhitelistGroup *oldGroup, WhitelistDiff *diff);
+static uint32_t FillEntryKeys(const CompiledWhitelist *cw, const WhitelistGroup *group, EntryKey *keys);
+static int CompareEntryKeys(const void *a, const void *b);
+static void BuildSubstringMatcher(CompiledWhitelist *cw, ProcessField field);
+static void BuildExactMatcher(CompiledWhitelist *cw, ProcessField field);
+static char BuildWildcardMatcher(CompiledWhitelist *cw, ProcessField field);
+static char BuildRegexMatcher(CompiledWhitelist *cw, ProcessField field);
+static char MatchExactGroup(const CompiledWhitelist *cw, const WhitelistGroup *group, ProcessField field, WideSpan value, char wanted);
+static char MatchSubstringGroup(const CompiledWhitelist *cw, const WhitelistGroup *group, ProcessField field, WideSpan value, char wanted);
+static char MatchWildcardGroup(const CompiledWhitelist *cw, const WhitelistGroup *group, ProcessField field, WideSpan value, char wanted);
+static char MatchRegexGroup(const CompiledWhitelist *cw, const WhitelistGroup *group, ProcessField field, WideSpan value, char wanted);
+static char OnScanMatch(uint32_t pattern, void *ctx);
+static void ReportWhitelistMatch(const CompiledWhitelist *cw, size_t entry, ProcessField field, WideSpan value);
+
+const wchar_t *const procfield_str[PROCFIELD_NUMOF] = {
+    [PROCFIELD_NAME]        L"Name",
+    [PROCFIELD_CMDLINE]     L"CommandLine",
+};
+
+CompiledWhitelist *WhitelistAlloc(const size_t counts[PROCFIELD_NUMOF][MATCHKIND_NUMOF], size_t nchars)
+{
+    size_t nentries = 0;
+
+    for (int field = 0; field < PROCFIELD_NUMOF; field++)
+    {
+        for (int kind = 0; kind < MATCHKIND_NUMOF; kind++) nentries += counts[field][kind];
+    }
+
+    // The uint32_t arrays come first so the arena after them is aligned for wchar_t.
+    size_t offsetsOffset = sizeof(CompiledWhitelist);
+    size_t lensOffset = offsetsOffset + nentries * sizeof(uint32_t);
+    size_t linenumsOffset = lensOffset + nentries * sizeof(uint32_t);
+    size_t arenaOffset = linenumsOffset + nentries * sizeof(uint32_t);
+    size_t listsOffset = arenaOffset + nchars * sizeof(wchar_t);
+    size_t size = listsOffset + nentries * sizeof(char);
+    CompiledWhitelist *cw = malloc(size);
+
+    if (cw == NULL)
+    {
+        return NULL;
+    }
+
+    memset(cw, 0, sizeof(*cw));
+    cw->size = size;
+    cw->offsets = (uint32_t *)((char *)cw + offsetsOffset);
+    cw->lens = (uint32_t *)((char *)cw + lensOffset);
+    cw->linenums = (uint32_t *)((char *)cw + linenumsOffset);
+    cw->arena = (wchar_t *)((char *)cw + arenaOffset);
+    cw->lists = (char *)cw + listsOffset;
+
+    // Groups start out empty and grow into their range as entries are added.
+    for (int field = 0, start = 0; field < PROCFIELD_NUMOF; field++)
+    {
+        for (int kind = 0; kind < MATCHKIND_NUMOF; kind++)
+        {
+            cw->groups[field][kind].start = start;
+            start += counts[field][kind];
+        }
+    }
+
+    return cw;
+}
+
+void WhitelistAddEntry(CompiledWhitelist *cw, ProcessField field, MatchKind kind, char list, uint32_t linenum, const wchar_t *value, size_t len)
+{
+    wmemcpy(WhitelistReserveEntry(cw, field, kind, list, linenum, len), value, len);
+}
+
+wchar_t *WhitelistReserveEntry(CompiledWhitelist *cw, ProcessField field, MatchKind kind, char list, uint32_t linenum, size_t len)
+{
+    WhitelistGroup *group = &cw->groups[field][kind];
+    uint32_t i = group->start + group->count++;
+    wchar_t *value = &cw->arena[cw->nchars];
+
+    cw->offsets[i] = cw->nchars;
+    cw->lens[i] = len;
+    cw->linenums[i] = linenum;
+    cw->lists[i] = list;
+
+    cw->nchars += len;
+    cw->nentries++;
+    group->lists |= list;
+    if (list == LIST_EXCLUSIVE) cw->isExclusiveExists = TRUE;
+    return value;
+}
+
+WhitelistDiff WhitelistAdoptMatchers(CompiledWhitelist *cw, CompiledWhitelist *old)
+{
+    WhitelistDiff diff = {0};
+    int nadopted = 0, nchanged = 0;
+
+    for (int field = 0; field < PROCFIELD_NUMOF; field++)
+    {
+        for (int kind = 0; kind < MATCHKIND_NUMOF; kind++)
+        {
+            WhitelistGroup *group = &cw->groups[field][kind];
+            WhitelistGroup *oldGroup = &old->groups[field][kind];
+
+            if (!IsSameGroup(cw, group, old, oldGroup))
+            {
+                DiffGroup(cw, group, old, oldGroup, &diff);
+                nchanged++;
+                continue;
+            }
+
+            // Groups that came with their matchers (from the cache) don't need the old ones.
+            if (group->isBuilt)
+            {
+                nadopted++;
+                continue;
+            }
+
+            // The matchers only know the group's entries by their index in it, and those are all the same.
+            group->automaton = oldGroup->automaton;
+            group->table = oldGroup->table;
+            group->wildcards = oldGroup->wildcards;
+            group->regexes = oldGroup->regexes;
+            group->isBuilt = oldGroup->isBuilt;
+
+            oldGroup->automaton = NULL;
+            oldGroup->table = NULL;
+            oldGroup->wildcards = NULL;
+            oldGroup->regexes = NULL;
+            oldGroup->isBuilt = FALSE;
+            nadopted++;
+        }
+    }
+
+    LOG("Compared the whitelist to the previous one: unchanged groups: %d, changed groups: %d, lists added to: %#x, lists removed from: %#x.",
+        nadopted, nchanged, diff.added, diff.removed);
+    return diff;
+}
+
+char WhitelistBuildMatchers(CompiledWhitelist *cw)
+{
+    for (int field = 0; field < PROCFIELD_NUMOF; field++)
+    {
+        for (int kind = 0; kind < MATCHKIND_NUMOF; kind++)
+        {
+            WhitelistGroup *group = &cw->groups[field][kind];
+
+            if (group->isBuilt) continue;
+
+            switch (kind)
+            {
+                case MATCHKIND_EXACT:
+                    BuildExactMatcher(cw, field);
+                    break;
+                case MATCHKIND_SUBSTRING:
+                    BuildSubstringMatcher(cw, field);
+                    break;
+                case MATCHKIND_GLOB:
+                    if (!BuildWildcardMatcher(cw, field)) return FALSE;
+                    break;
+                case MATCHKIND_REGEX:
+                    if (!BuildRegexMatcher(cw, field)) return FALSE;
+                    break;
+            }
+
+            group->isBuilt = TRUE;
+        }
+    }
+
+    return TRUE;
+}
+
+char WhitelistMatch(const CompiledWhitelist *cw, const WideSpan *fields, char wanted)
+{
+    char found = 0;
+
+    for (int field = 0; field < PROCFIELD_NUMOF; field++)
+    {
+        if (fields[field].str == NULL) continue;
+
+        // The kinds go from cheapest to most expensive, so the expensive ones are skipped whenever possible.
+        for (int kind = 0; kind < MATCHKIND_NUMOF; kind++)
+        {
+            const WhitelistGroup *group = &cw->groups[field][kind];
+            char remaining = wanted & ~found;
+
+            if (!(group->lists & remaining)) continue;
+
+            switch (kind)
+            {
+                case MATCHKIND_EXACT:
+                    found |= MatchExactGroup(cw, group, field, fields[field], remaining);
+                    break;
+                case MATCHKIND_SUBSTRING:
+                    found |= MatchSubstringGroup(cw, group, field, fields[field], remaining);
+                    break;
+                case MATCHKIND_GLOB:
+                    found |= MatchWildcardGroup(cw, group, field, fields[field], remaining);
+                    break;
+                case MATCHKIND_REGEX:
+                    found |= MatchRegexGroup(cw, group, field, fields[field], remaining);
+                    break;
+            }
+
+            if ((found & wanted) == wanted) return found;
+        }
+    }
+
+    return found;
+}
+
+char WhitelistFieldLists(const CompiledWhitelist *cw, ProcessField field)
+{
+    char lists = 0;
+
+    for (int kind = 0; kind < MATCHKIND_NUMOF; kind++)
+    {
+        lists |= cw->groups[field][kind].lists;
+    }
+
+    return lists;
+}
+
+WideSpan WhitelistEntryValue(const CompiledWhitelist *cw, size_t entry)
+{
+    return (WideSpan){ &cw->arena[cw->offsets[entry]], cw->lens[entry] };
+}
+
+void WhitelistFree(CompiledWhitelist *cw)
+{
+    if (cw == NULL)
+    {
+        return;
+    }
+
+    for (int field = 0; field < PROCFIELD_NUMOF; field++)
+    {
+        for (int kind = 0; kind < MATCHKIND_NUMOF; kind++)
+        {
+            AhoCorasickFree(cw->groups[field][kind].automaton);
+            ExactTableFree(cw->groups[field][kind].table);
+            WildcardSetFree(cw->groups[field][kind].wildcards);
+            RegexSetFree(cw->groups[field][kind].regexes);
+        }
+    }
+
+    free(cw);
+}
+
+// Returns nonzero if both groups have the same entries in the same order.
+static char IsSameGroup(const CompiledWhitelist *cw, const WhitelistGroup *group, const CompiledWhitelist *old, const WhitelistGroup *oldGroup)
+{
+    if (group->count != oldGroup->count)
+    {
+        return FALSE;
+    }
+
+    for (uint32_t i = 0; i < group->count; i++)
+    {
+        size_t entry = group->start + i, oldEntry = oldGroup->start + i;
+
+        if (cw->lists[entry] != old->lists[oldEntry] || cw->lens[entry] != old->lens[oldEntry] ||
+            wmemcmp(&cw->arena[cw->offsets[entry]], &old->arena[old->offsets[oldEntry]], cw->lens[entry]) != 0)
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+// Adds the lists of the entries that are only in one of the groups to the diff. Entries that only moved around aren't changes.
+static void DiffGroup(const CompiledWhitelist *cw, const WhitelistGroup *group, const CompiledWhitelist *old, const WhitelistGroup *oldGroup, WhitelistDiff *diff)
+{
+    EntryKey *keys = malloc(group->count * sizeof(*keys));
+    EntryKey *oldKeys = malloc(oldGroup->count * sizeof(*oldKeys));
+
+    // Without memory to compare them, assume every entry changed.
+    if ((keys == NULL && group->count > 0) || (oldKeys == NULL && oldGroup->count > 0))
+    {
+        diff->added |= group->lists;
+        diff->removed |= oldGroup->lists;
+        goto cleanup;
+    }
+
+    uint32_t n = FillEntryKeys(cw, group, keys);
+    uint32_t oldN = FillEntryKeys(old, oldGroup, oldKeys);
+    uint32_t i = 0, j = 0;
+
+    // Both are sorted, so they can be merged to find the keys that are only in one of them.
+    while (i < n || j < oldN)
+    {
+        int cmp = i == n ? 1 : j == oldN ? -1 : CompareEntryKeys(&keys[i], &oldKeys[j]);
+
+        if (cmp < 0) diff->added |= keys[i++].list;
+        else if (cmp > 0) diff->removed |= oldKeys[j++].list;
+        else i++, j++;
+    }
+
+cleanup:
+    free(keys);
+    free(oldKeys);
+}
+
+// Fills keys with the group's entries, sorted. Returns how many there are.
+static uint32_t FillEntryKeys(const CompiledWhitelist *cw, const WhitelistGroup *group, EntryKey *keys)
+{
+    for (uint32_t i = 0; i < group->count; i++)
+    {
+        size_t entry = group->start + i;
+        keys[i] = (EntryKey){ &cw->arena[cw->offsets[entry]], cw->lens[entry], cw->lists[entry] };
+    }
+
+    if (group->count > 0) qsort(keys, group->count, sizeof(*keys), CompareEntryKeys);
+    return group->count;
+}
+
+static int CompareEntryKeys(const void *a, const void *b)
+{
+    const EntryKey *ka = a, *kb = b;
+
+    if (ka->list != kb->list) return ka->list - kb->list;
+    if (ka->len != kb->len) return ka->len < kb->len ? -1 : 1;
+    return wmemcmp(ka->str, kb->str, ka->len);
+}
+
+static void BuildSubstringMatcher(CompiledWhitelist *cw, ProcessField field)
+{
+    WhitelistGroup *group = &cw->groups[field][MATCHKIND_SUBSTRING];
+
+    if (group->count == 0)
+    {
+        return;
+    }
+
+    const wchar_t **patterns = malloc(group->count * sizeof(*patterns));
+    size_t *lens = malloc(group->count * sizeof(*lens));
+
+    if (patterns == NULL || lens == NULL)
+    {
+        LOG_WARN("Failed to build the substring matcher for field: %ls. Falling back to checking entries one by one.", procfield_str[field]);
+        goto cleanup;
+    }
+
+    for (uint32_t i = 0; i < group->count; i++)
+    {
+        patterns[i] = &cw->arena[cw->offsets[group->start + i]];
+        lens[i] = cw->lens[group->start + i];
+    }
+
+    if (group->count < MIN_SUBSTRING_ENTRIES_FOR_AUTOMATON)
+    {
+        LOG("Field: %ls has only %u substring entries, they will be searched for one by one using the %s search.",
+            procfield_str[field], group->count, WideSearchImplName());
+        goto cleanup;
+    }
+
+    // If this fails we can still check the entries one by one, so it's not worth bothering the user about it.
+    if ((group->automaton = AhoCorasickBuild(patterns, lens, group->count)) == NULL)
+    {
+        LOG_WARN("Failed to build the substring matcher for field: %ls. Falling back to checking entries one by one.", procfield_str[field]);
+    }
+    else
+    {
+        LOG("Built substring matcher for field: %ls, patterns: %u, automaton size: %lld bytes.",
+            procfield_str[field], group->count, (long long)group->automaton->size);
+    }
+
+cleanup:
+    free(patterns);
+    free(lens);
+}
+
+static void BuildExactMatcher(CompiledWhitelist *cw, ProcessField field)
+{
+    WhitelistGroup *group = &cw->groups[field][MATCHKIND_EXACT];
+
+    if (group->count == 0)
+    {
+        return;
+    }
+
+    const wchar_t **keys = malloc(group->count * sizeof(*keys));
+    size_t *lens = malloc(group->count * sizeof(*lens));
+
+    for (uint32_t i = 0; keys != NULL && lens != NULL && i < group->count; i++)
+    {
+        keys[i] = &cw->arena[cw->offsets[group->start + i]];
+        lens[i] = cw->lens[group->start + i];
+    }
+
+    // Same as with the substring matchers, we can get by without it.
+    if (keys == NULL || lens == NULL || (group->table = ExactTableBuild(keys, lens, NULL, group->count)) == NULL)
+    {
+        LOG_WARN("Failed to build the exact matcher for field: %ls. Falling back to checking entries one by one.", procfield_str[field]);
+    }
+    else
+    {
+        LOG("Built exact matcher for field: %ls, keys: %u, table size: %lld bytes.", procfield_str[field], group->count, (long long)group->table->size);
+    }
+
+    free(keys);
+    free(lens);
+}
+
+static char BuildWildcardMatcher(CompiledWhitelist *cw, ProcessField field)
+{
+    WhitelistGroup *group = &cw->groups[field][MATCHKIND_GLOB];
+
+    if (group->count == 0)
+    {
+        return TRUE;
+    }
+
+    const wchar_t **patterns = malloc(group->count * sizeof(*patterns));
+    size_t *lens = malloc(group->count * sizeof(*lens));
+
+    for (uint32_t i = 0; patterns != NULL && lens != NULL && i < group->count; i++)
+    {
+        patterns[i] = &cw->arena[cw->offsets[group->start + i]];
+        lens[i] = cw->lens[group->start + i];
+    }
+
+    if (patterns == NULL || lens == NULL || (group->wildcards = WildcardSetBuild(patterns, lens, group->count)) == NULL)
+    {
+        LOG_WARN("Failed to build the glob matcher for field: %ls.", procfield_str[field]);
+    }
+    else
+    {
+        LOG("Built glob matcher for field: %ls, patterns: %u, segments: %u, size: %lld bytes.",
+            procfield_str[field], group->count, group->wildcards->nsegments, (long long)group->wildcards->size);
+    }
+
+    free(patterns);
+    free(lens);
+    return group->wildcards != NULL;
+}
+
+static char BuildRegexMatcher(CompiledWhitelist *cw, ProcessField field)
+{
+    WhitelistGroup *group = &cw->groups[field][MATCHKIND_REGEX];
+    RegexError error;
+
+    if (group->count == 0)
+    {
+        return TRUE;
+    }
+
+    const wchar_t **patterns = malloc(group->count * sizeof(*patterns));
+    size_t *lens = malloc(group->count * sizeof(*lens));
+
+    for (uint32_t i = 0; patterns != NULL && lens != NULL && i < group->count; i++)
+    {
+        patterns[i] = &cw->arena[cw->offsets[group->start + i]];
+        lens[i] = cw->lens[group->start + i];
+    }
+
+    // The patterns were all checked when they were parsed, so this can only fail if memory ran out.
+    if (patterns == NULL || lens == NULL || (group->regexes = RegexSetBuild(patterns, lens, group->count, &error)) == NULL)
+    {
+        LOG_WARN("Failed to build the regex matcher for field: %ls.", procfield_str[field]);
+    }
+    else
+    {
+        LOG("Built regex matcher for field: %ls, patterns: %u, size: %lld bytes.", procfield_str[field], group->count, (long long)RegexSetSize(group->regexes));
+    }
+
+    free(patterns);
+    free(lens);
+    return group->regexes != NULL;
+}
+
+// With a table, the value costs a single lookup no matter how many entries there are.
+static char MatchExactGroup(const CompiledWhitelist *cw, const WhitelistGroup *group, ProcessField field, WideSpan value, char wanted)
+{
+    char found = 0;
+
+    if (group->table != NULL)
+    {
+        for (int32_t id = ExactTableFind(group->table, 0, value.str, value.len); id != EXACT_NOT_FOUND; id = ExactTableNext(group->table, id))
+        {
+            size_t entry = group->start + id;
+            if (!(cw->lists[entry] & wanted & ~found)) continue;
+
+            ReportWhitelistMatch(cw, entry, field, value);
+            found |= cw->lists[entry];
+        }
+
+        return found;
+    }
+
+    for (size_t entry = group->start; entry < group->start + group->count; entry++)
+    {
+        if (cw->lens[entry] == value.len && wmemcmp(&cw->arena[cw->offsets[entry]], value.str, value.len) == 0 && (cw->lists[entry] & wanted & ~found))
+        {
+            ReportWhitelistMatch(cw, entry, field, value);
+            found |= cw->lists[entry];
+        }
+    }
+
+    return found;
+}
+
+static char MatchSubstringGroup(const CompiledWhitelist *cw, const WhitelistGroup *group, ProcessField field, WideSpan value, char wanted)
+{
+    if (group->automaton != NULL)
+    {
+        ScanCtx ctx = { .cw = cw, .group = group, .field = field, .value = value, .wanted = wanted, .found = 0 };
+        AhoCorasickScan(group->automaton, value.str, value.len, OnScanMatch, &ctx);
+        return ctx.found;
+    }
+
+    char found = 0;
+
+    for (size_t entry = group->start; entry < group->start + group->count && (found & wanted) != wanted; entry++)
+    {
+        // Searching is the expensive part, so skip entries of lists we're not looking for first.
+        if (!(cw->lists[entry] & wanted & ~found)) continue;
+
+        if (WideSearch(value.str, value.len, &cw->arena[cw->offsets[entry]], cw->lens[entry]) != NULL)
+        {
+            ReportWhitelistMatch(cw, entry, field, value);
+            found |= cw->lists[entry];
+        }
+    }
+
+    return found;
+}
+
+static char MatchWildcardGroup(const CompiledWhitelist *cw, const WhitelistGroup *group, ProcessField field, WideSpan value, char wanted)
+{
+    char found = 0;
+
+    for (uint32_t i = 0; i < group->count && (found & wanted) != wanted; i++)
+    {
+        size_t entry = group->start + i;
+        if (!(cw->lists[entry] & wanted & ~found)) continue;
+
+        if (WildcardSetMatch(group->wildcards, i, value.str, value.len))
+        {
+            ReportWhitelistMatch(cw, entry, field, value);
+            found |= cw->lists[entry];
+        }
+    }
+
+    return found;
+}
+
+// All the group's regexes are found in a single scan.
+static char MatchRegexGroup(const CompiledWhitelist *cw, const WhitelistGroup *group, ProcessField field, WideSpan value, char wanted)
+{
+    ScanCtx ctx = { .cw = cw, .group = group, .field = field, .value = value, .wanted = wanted, .found = 0 };
+    RegexSetScan(group->regexes, value.str, value.len, OnScanMatch, &ctx);
+    return ctx.found;
+}
+
+// Called by both the substring automatons and the regex sets.
+static char OnScanMatch(uint32_t pattern, void *ctx)
+{
+    ScanCtx *scan = (ScanCtx *)ctx;
+    size_t entry = scan->group->start + pattern;
+    char list = scan->cw->lists[entry];
+
+    // Log only the first match of each wanted list, the rest can't change anything.
+    if ((scan->wanted & list) && !(scan->found & list))
+    {
+        scan->found |= list;
+        ReportWhitelistMatch(scan->cw, entry, scan->field, scan->value);
+    }
+
+    // Once every wanted list in the group has been found there's no point scanning the rest.
+    return scan->found == (scan->group->lists & scan->wanted);
+}
+
+static void ReportWhitelistMatch(const CompiledWhitelist *cw, size_t entry, ProcessField field, WideSpan value)
+{
+    LOG("Whitelist match! list type: %s, field: %ls, line: %u,\n\tWhitelist: %.*ls\n\tProcess:   %.*ls",
+        cw->lists[entry] == LIST_EXCLUSIVE ? "exclusive" : "whitelist", procfield_str[field], cw->linenums[entry],
+        (int)cw->lens[entry], &cw->arena[cw->offsets[entry]], (int)value.len, value.str);
+
+    if (cw->onMatch != NULL) cw->onMatch(entry, field, cw->onMatchCtx);
+}
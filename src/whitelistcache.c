@@ -0,0 +1,382 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "whitelistcache.h"
+#include <stdlib.h>     // For malloc.
+#include <string.h>     // For memcpy.
+
+#define CACHE_MAGIC 0x43575341 // "ASWC" in a little endian file.
+#define FNV_OFFSET 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+// Every group has these, in this order: automaton, table, wildcards.
+#define NMATCHERS 3
+
+// The file starts with this, followed by the payload: the whitelist block, then every group's matchers.
+// Each block in the payload is preceded by its size as a uint64_t, and missing matchers have a size of 0.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t wcharSize;     // wchar_t isn't the same size everywhere.
+    uint32_t pointerSize;
+    uint64_t sourceHash;
+    uint64_t payloadSize;
+    uint64_t checksum;      // Of the payload, to catch caches that were cut short or damaged.
+    uint64_t base;          // Where the whitelist was when it was saved. Its arrays are at the same offsets from it once it's loaded.
+} CacheHeader;
+
+// Every matcher block starts with its size, and has at least its header.
+static const size_t matcherHeaderSizes[NMATCHERS] = { sizeof(AhoCorasick), sizeof(ExactTable), sizeof(WildcardSet) };
+
+static uint64_t HashBytes(uint64_t hash, const void *data, size_t size);
+static char WriteBlock(FILE *file, const void *block, size_t size, CacheHeader *header);
+static char ReadBlock(const char **pos, const char *end, size_t minSize, void **block);
+static char RebaseArray(const CompiledWhitelist *cw, uint64_t base, const void *stale, size_t nbytes, void **array);
+static char RebaseArrays(CompiledWhitelist *cw, uint64_t base);
+static char IsConsistent(const CompiledWhitelist *cw);
+static char IsInBlock(size_t blockSize, size_t offset, size_t count, size_t elemSize);
+static char AreMatchersConsistent(const WhitelistGroup *group, MatchKind kind);
+static char IsWildcardSetConsistent(const WildcardSet *ws, uint32_t npatterns);
+
+uint64_t WhitelistCacheHash(const void *data, size_t size)
+{
+    return HashBytes(FNV_OFFSET, data, size);
+}
+
+char WhitelistCacheSave(const CompiledWhitelist *cw, uint64_t sourceHash, FILE *file)
+{
+    CacheHeader header = {0};
+    header.magic = CACHE_MAGIC;
+    header.version = WHITELIST_CACHE_VERSION;
+    header.wcharSize = sizeof(wchar_t);
+    header.pointerSize = sizeof(void *);
+    header.sourceHash = sourceHash;
+    header.checksum = FNV_OFFSET;
+    header.base = (uintptr_t)cw;
+
+    // The header is written again at the end once the payload's size and checksum are known.
+    if (fwrite(&header, sizeof(header), 1, file) != 1 || !WriteBlock(file, cw, cw->size, &header))
+    {
+        return 0;
+    }
+
+    for (int field = 0; field < PROCFIELD_NUMOF; field++)
+    {
+        for (int kind = 0; kind < MATCHKIND_NUMOF; kind++)
+        {
+            const WhitelistGroup *group = &cw->groups[field][kind];
+            const void *matchers[NMATCHERS] = { group->automaton, group->table, group->wildcards };
+
+            for (int i = 0; i < NMATCHERS; i++)
+            {
+                if (!WriteBlock(file, matchers[i], matchers[i] == NULL ? 0 : *(const size_t *)matchers[i], &header)) return 0;
+            }
+        }
+    }
+
+    return fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+CompiledWhitelist *WhitelistCacheLoad(const void *data, size_t size, uint64_t sourceHash)
+{
+    const char *pos = data, *end = pos + size;
+    CacheHeader header;
+    CompiledWhitelist *cw = NULL;
+    void *block;
+
+    if (size < sizeof(header))
+    {
+        return NULL;
+    }
+
+    memcpy(&header, pos, sizeof(header));
+    pos += sizeof(header);
+
+    if (header.magic != CACHE_MAGIC || header.version != WHITELIST_CACHE_VERSION || header.wcharSize != sizeof(wchar_t) ||
+        header.pointerSize != sizeof(void *) || header.sourceHash != sourceHash || header.payloadSize != (uint64_t)(end - pos) ||
+        header.checksum != HashBytes(FNV_OFFSET, pos, end - pos))
+    {
+        return NULL;
+    }
+
+    if (!ReadBlock(&pos, end, sizeof(*cw), &block) || block == NULL)
+    {
+        return NULL;
+    }
+
+    cw = block;
+
+    // The matcher pointers are from when it was saved. Clearing them first makes it safe to free.
+    for (int field = 0; field < PROCFIELD_NUMOF; field++)
+    {
+        for (int kind = 0; kind < MATCHKIND_NUMOF; kind++)
+        {
+            WhitelistGroup *group = &cw->groups[field][kind];
+            group->automaton = NULL;
+            group->table = NULL;
+            group->wildcards = NULL;
+            group->regexes = NULL;
+            group->isBuilt = 0;
+        }
+    }
+
+    cw->onMatch = NULL;
+    cw->onMatchCtx = NULL;
+
+    if (!RebaseArrays(cw, header.base) || !IsConsistent(cw))
+    {
+        goto error;
+    }
+
+    for (int field = 0; field < PROCFIELD_NUMOF; field++)
+    {
+        for (int kind = 0; kind < MATCHKIND_NUMOF; kind++)
+        {
+            WhitelistGroup *group = &cw->groups[field][kind];
+            void *matchers[NMATCHERS];
+
+            for (int i = 0; i < NMATCHERS; i++)
+            {
+                if (!ReadBlock(&pos, end, matcherHeaderSizes[i], &matchers[i]))
+                {
+                    while (i-- > 0) free(matchers[i]);
+                    goto error;
+                }
+            }
+
+            group->automaton = matchers[0];
+            group->table = matchers[1];
+            group->wildcards = matchers[2];
+
+            // Regex sets have to be built again.
+            group->isBuilt = kind != MATCHKIND_REGEX;
+
+            // The matchers are freed along with the whitelist from here on.
+            if (!AreMatchersConsistent(group, kind))
+            {
+                goto error;
+            }
+        }
+    }
+
+    if (pos != end)
+    {
+        goto error;
+    }
+
+    return cw;
+
+error:
+    WhitelistFree(cw);
+    return NULL;
+}
+
+static uint64_t HashBytes(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+// Writes the block preceded by its size, and adds it to the payload in the header.
+static char WriteBlock(FILE *file, const void *block, size_t size, CacheHeader *header)
+{
+    uint64_t size64 = size;
+
+    if (fwrite(&size64, sizeof(size64), 1, file) != 1 || (size > 0 && fwrite(block, size, 1, file) != 1))
+    {
+        return 0;
+    }
+
+    header->checksum = HashBytes(HashBytes(header->checksum, &size64, sizeof(size64)), block, size);
+    header->payloadSize += sizeof(size64) + size;
+    return 1;
+}
+
+// Reads a block written by WriteBlock into its own allocation, or NULL if it's empty, and moves pos past it.
+// Returns zero if the block doesn't look right or memory ran out.
+static char ReadBlock(const char **pos, const char *end, size_t minSize, void **block)
+{
+    uint64_t size;
+    size_t blockSize;
+
+    *block = NULL;
+
+    if (end - *pos < (ptrdiff_t)sizeof(size))
+    {
+        return 0;
+    }
+
+    memcpy(&size, *pos, sizeof(size));
+    *pos += sizeof(size);
+
+    if (size == 0)
+    {
+        return 1;
+    }
+
+    // Every block starts with its own size.
+    if (size < minSize || size > (uint64_t)(end - *pos))
+    {
+        return 0;
+    }
+
+    memcpy(&blockSize, *pos, sizeof(blockSize));
+
+    if (blockSize != size || (*block = malloc(size)) == NULL)
+    {
+        return 0;
+    }
+
+    memcpy(*block, *pos, size);
+    *pos += size;
+    return 1;
+}
+
+static char RebaseArray(const CompiledWhitelist *cw, uint64_t base, const void *stale, size_t nbytes, void **array)
+{
+    uint64_t offset = (uintptr_t)stale - base;
+
+    if (offset < sizeof(*cw) || offset > cw->size || nbytes > cw->size - offset)
+    {
+        return 0;
+    }
+
+    *array = (char *)cw + offset;
+    return 1;
+}
+
+// Points the whitelist's arrays back into its block, which is now at a different address than when it was saved.
+static char RebaseArrays(CompiledWhitelist *cw, uint64_t base)
+{
+    void *offsets, *lens, *linenums, *arena, *lists;
+
+    if (cw->nentries > cw->size || cw->nchars > cw->size)
+    {
+        return 0;
+    }
+
+    if (!RebaseArray(cw, base, cw->offsets, cw->nentries * sizeof(*cw->offsets), &offsets) ||
+        !RebaseArray(cw, base, cw->lens, cw->nentries * sizeof(*cw->lens), &lens) ||
+        !RebaseArray(cw, base, cw->linenums, cw->nentries * sizeof(*cw->linenums), &linenums) ||
+        !RebaseArray(cw, base, cw->arena, cw->nchars * sizeof(*cw->arena), &arena) ||
+        !RebaseArray(cw, base, cw->lists, cw->nentries * sizeof(*cw->lists), &lists))
+    {
+        return 0;
+    }
+
+    cw->offsets = offsets;
+    cw->lens = lens;
+    cw->linenums = linenums;
+    cw->arena = arena;
+    cw->lists = lists;
+    return 1;
+}
+
+// Checks that the groups and entries stay inside the arrays, so matching can't read out of bounds.
+static char IsConsistent(const CompiledWhitelist *cw)
+{
+    for (int field = 0; field < PROCFIELD_NUMOF; field++)
+    {
+        for (int kind = 0; kind < MATCHKIND_NUMOF; kind++)
+        {
+            const WhitelistGroup *group = &cw->groups[field][kind];
+            if (group->start > cw->nentries || group->count > cw->nentries - group->start) return 0;
+        }
+    }
+
+    for (size_t i = 0; i < cw->nentries; i++)
+    {
+        if (cw->offsets[i] > cw->nchars || cw->lens[i] > cw->nchars - cw->offsets[i]) return 0;
+    }
+
+    return 1;
+}
+
+// Returns nonzero if an array of count elements at offset from the start of a block fits in it.
+static char IsInBlock(size_t blockSize, size_t offset, size_t count, size_t elemSize)
+{
+    return offset <= blockSize && count <= (blockSize - offset) / elemSize;
+}
+
+// Checks that the group has the matchers its kind is matched with, and that they're of as many patterns as it has entries.
+// Automatons and tables are optional since the group can be matched without them, but a glob group is always matched with its wildcard set.
+// What's inside automatons and tables is trusted to the checksum, only the parts of them their headers point to are checked.
+static char AreMatchersConsistent(const WhitelistGroup *group, MatchKind kind)
+{
+    const AhoCorasick *ac = group->automaton;
+    const ExactTable *table = group->table;
+    const WildcardSet *ws = group->wildcards;
+
+    if ((ac != NULL && kind != MATCHKIND_SUBSTRING) || (table != NULL && kind != MATCHKIND_EXACT) || (ws != NULL && kind != MATCHKIND_GLOB))
+    {
+        return 0;
+    }
+
+    if (ac != NULL && (ac->npatterns != group->count || ac->nodesOffset > ac->edgesOffset || ac->edgesOffset > ac->patternNextOffset ||
+        !IsInBlock(ac->size, ac->patternNextOffset, ac->npatterns, sizeof(int32_t))))
+    {
+        return 0;
+    }
+
+    // Lookups mask the hash with nbuckets - 1 to pick a bucket, and the buckets are uint32_t.
+    if (table != NULL && (table->nkeys != group->count || table->nbuckets == 0 || (table->nbuckets & (table->nbuckets - 1)) != 0 ||
+        table->bucketsOffset > table->keysOffset || table->nbuckets > (table->keysOffset - table->bucketsOffset) / sizeof(uint32_t) ||
+        table->keysOffset > table->charsOffset || table->charsOffset > table->size))
+    {
+        return 0;
+    }
+
+    return kind != MATCHKIND_GLOB || group->count == 0 || (ws != NULL && IsWildcardSetConsistent(ws, group->count));
+}
+
+// Checks that every pattern's segments, and every segment's characters, are inside the set.
+static char IsWildcardSetConsistent(const WildcardSet *ws, uint32_t npatterns)
+{
+    if (ws->npatterns != npatterns || !IsInBlock(ws->size, ws->patternsOffset, ws->npatterns, sizeof(WildcardPattern)) ||
+        !IsInBlock(ws->size, ws->segmentsOffset, ws->nsegments, sizeof(WildcardSegment)) || ws->charsOffset > ws->size)
+    {
+        return 0;
+    }
+
+    const WildcardPattern *patterns = (const WildcardPattern *)((const char *)ws + ws->patternsOffset);
+    const WildcardSegment *segments = (const WildcardSegment *)((const char *)ws + ws->segmentsOffset);
+    size_t nchars = (ws->size - ws->charsOffset) / sizeof(wchar_t);
+
+    for (uint32_t i = 0; i < ws->npatterns; i++)
+    {
+        if (patterns[i].firstSegment > ws->nsegments || patterns[i].nsegments > ws->nsegments - patterns[i].firstSegment) return 0;
+    }
+
+    for (uint32_t i = 0; i < ws->nsegments; i++)
+    {
+        const WildcardSegment *segment = &segments[i];
+
+        if (segment->charsIdx > nchars || segment->len > nchars - segment->charsIdx ||
+            segment->runIdx > segment->len || segment->runLen > segment->len - segment->runIdx)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
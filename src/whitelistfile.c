@@ -0,0 +1,221 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "defines.h"
+#include "whitelistfile.h"
+#include "whitelistlexer.h" // For splitting lines into flags and command.
+#include <string.h>     // For memchr.
+#include <wchar.h>      // For mbrtowc.
+
+// A whitelist line as it's parsed, before it goes into the compiled whitelist.
+typedef struct
+{
+    const char *command; // Points into the whitelist file. NULL if the line isn't an entry.
+    size_t ncommand;
+    size_t nchars;       // Length of the command once it's converted to wchar.
+    ProcessField checkField;
+    MatchKind kind;
+    char isExclusive;
+} WhitelistEntry;
+
+static const char *NextLine(const char *line, const char *end);
+static char ParseLine(const char *line, const char *end, int linenum, WhitelistEntry *entry, WhitelistParseError *error);
+static size_t WidenCommand(const char *src, size_t len, wchar_t *dst);
+
+CompiledWhitelist *WhitelistParse(const char *data, size_t size, WhitelistParseError *error)
+{
+    CompiledWhitelist *whitelist;
+
+    memset(error, 0, sizeof(*error));
+
+    // The first pass validates every line and measures the entries, so the compiled whitelist can be allocated exactly once.
+    size_t counts[PROCFIELD_NUMOF][MATCHKIND_NUMOF] = {0};
+    size_t nchars = 0;
+    int linenum = 0;
+
+    for (const char *line = data, *end = data + size; line < end; line = NextLine(line, end))
+    {
+        WhitelistEntry entry;
+        linenum++;
+
+        if (!ParseLine(line, end, linenum, &entry, error)) return NULL;
+
+        if (entry.command == NULL)
+        {
+            LOG("Skipping line %d because it is empty or a comment.", linenum);
+            continue;
+        }
+
+        if ((entry.nchars = WidenCommand(entry.command, entry.ncommand, NULL)) == (size_t)-1)
+        {
+            error->linenum = linenum;
+            snprintf(error->msg, sizeof(error->msg), "Failed to load the whitelist due to a problem at line: %d. It may contain unsupported characters.", linenum);
+            return NULL;
+        }
+
+        counts[entry.checkField][entry.kind]++;
+        nchars += entry.nchars;
+    }
+
+    if ((whitelist = WhitelistAlloc(counts, nchars)) == NULL)
+    {
+        error->isOutOfMemory = TRUE;
+        return NULL;
+    }
+
+    // The second pass widens each command straight into the whitelist's arena. Lines are known to be valid by now.
+    linenum = 0;
+
+    for (const char *line = data, *end = data + size; line < end; line = NextLine(line, end))
+    {
+        WhitelistEntry entry;
+        linenum++;
+
+        if (!ParseLine(line, end, linenum, &entry, error) || entry.command == NULL) continue;
+
+        entry.nchars = WidenCommand(entry.command, entry.ncommand, NULL);
+        wchar_t *value = WhitelistReserveEntry(whitelist, entry.checkField, entry.kind, entry.isExclusive ? LIST_EXCLUSIVE : LIST_WHITELIST, linenum, entry.nchars);
+        WidenCommand(entry.command, entry.ncommand, value);
+
+        // Regexes are compiled together once the whole whitelist is loaded, but this is where we can tell the user which line is bad.
+        RegexError regexError;
+
+        if (entry.kind == MATCHKIND_REGEX && !RegexCheck(value, entry.nchars, &regexError))
+        {
+            error->linenum = linenum;
+            snprintf(error->msg, sizeof(error->msg), "Invalid whitelist line: %d - invalid regex: %s at character %lld.", linenum, regexError.msg, (long long)regexError.pos + 1);
+            WhitelistFree(whitelist);
+            return NULL;
+        }
+
+        LOG("Added to the whitelist: line: %d, kind: %d, isExclusive: %d, field: %ls, value length: %lld value: '%.*ls'.",
+            linenum, entry.kind, entry.isExclusive, procfield_str[entry.checkField], (long long)entry.nchars, (int)entry.nchars, value);
+    }
+
+    return whitelist;
+}
+
+// Returns the start of the line after the one at line, or end if it's the last.
+static const char *NextLine(const char *line, const char *end)
+{
+    const char *eol = memchr(line, '\n', end - line);
+    return eol == NULL ? end : eol + 1;
+}
+
+// Parses the line that starts at line, up to the next line break or end. Returns FALSE and fills error if it's invalid.
+// Lines which aren't entries (empty lines and comments) get a NULL command.
+static char ParseLine(const char *line, const char *end, int linenum, WhitelistEntry *entry, WhitelistParseError *error)
+{
+    const char *eol = memchr(line, '\n', end - line);
+    WhitelistLine parts;
+    LineKind lineKind = WhitelistLexLine(line, (eol == NULL ? end : eol) - line, &parts);
+
+    memset(entry, 0, sizeof(*entry));
+    entry->checkField = PROCFIELD_CMDLINE;
+    error->linenum = linenum;
+
+    if (lineKind == LINE_EMPTY)
+    {
+        return TRUE;
+    }
+
+    if (lineKind == LINE_MISSING_FLAGS)
+    {
+        snprintf(error->msg, sizeof(error->msg), "Invalid whitelist line: %d - line starts with ?? but has no flags.", linenum);
+        return FALSE;
+    }
+
+    if (parts.flags != NULL)
+    {
+        char isComment = FALSE;
+
+        for (const char *c = parts.flags; c != parts.flags + parts.nflags; c++)
+        {
+            switch (*c)
+            {
+                case 'S':
+                case 'G':
+                case 'R':
+                {
+                    MatchKind kind = *c == 'S' ? MATCHKIND_SUBSTRING : *c == 'G' ? MATCHKIND_GLOB : MATCHKIND_REGEX;
+
+                    // A line can only be matched one way.
+                    if (entry->kind != MATCHKIND_EXACT && entry->kind != kind)
+                    {
+                        snprintf(error->msg, sizeof(error->msg), "Invalid whitelist line: %d - only one of the flags S, G and R can be used.", linenum);
+                        return FALSE;
+                    }
+
+                    entry->kind = kind;
+                    break;
+                }
+                case 'E':
+                    entry->isExclusive = TRUE;
+                    break;
+                case 'N':
+                    entry->checkField = PROCFIELD_NAME;
+                    break;
+                case 'I':
+                    // Keep iterating over flag characters even if this is a comment.
+                    isComment = TRUE;
+                    break;
+                default:
+                    snprintf(error->msg, sizeof(error->msg), "Invalid whitelist line: %d - flag character: '%c' is unrecognized.", linenum, *c);
+                    return FALSE;
+            }
+        }
+
+        if (isComment)
+        {
+            return TRUE;
+        }
+
+        if (parts.ncommand == 0)
+        {
+            snprintf(error->msg, sizeof(error->msg), "Invalid whitelist line: %d - command is missing.", linenum);
+            return FALSE;
+        }
+    }
+
+    entry->command = parts.command;
+    entry->ncommand = parts.ncommand;
+    return TRUE;
+}
+
+// Converts the command to wchar the way mbstowcs would, writing it to dst unless it's NULL.
+// Returns the number of characters, or (size_t)-1 if the command has a character that can't be converted.
+static size_t WidenCommand(const char *src, size_t len, wchar_t *dst)
+{
+    mbstate_t state = {0};
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; n++)
+    {
+        wchar_t wc;
+        size_t consumed = mbrtowc(&wc, &src[i], len - i, &state);
+
+        if (consumed == (size_t)-1 || consumed == (size_t)-2)
+        {
+            return (size_t)-1;
+        }
+
+        // A null character still takes up a byte.
+        i += consumed == 0 ? 1 : consumed;
+        if (dst != NULL) dst[n] = wc;
+    }
+
+    return n;
+}
@@ -0,0 +1,61 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "whitelistlexer.h"
+
+// The same characters as \s in the C locale. Not using isspace because it depends on the locale and chars may be negative.
+static inline char IsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+LineKind WhitelistLexLine(const char *line, size_t len, WhitelistLine *out)
+{
+    size_t start = 0, end = len;
+
+    out->flags = NULL;
+    out->nflags = 0;
+    out->command = NULL;
+    out->ncommand = 0;
+
+    while (start < end && IsSpace(line[start])) start++;
+    while (end > start && IsSpace(line[end - 1])) end--;
+
+    if (start == end)
+    {
+        return LINE_EMPTY;
+    }
+
+    if (end - start >= 2 && line[start] == '?' && line[start + 1] == '?')
+    {
+        // The flags go up to the first whitespace, and they have to be right after the ??.
+        start += 2;
+        out->flags = &line[start];
+        while (start < end && !IsSpace(line[start])) start++;
+        out->nflags = &line[start] - out->flags;
+
+        if (out->nflags == 0)
+        {
+            return LINE_MISSING_FLAGS;
+        }
+
+        while (start < end && IsSpace(line[start])) start++;
+    }
+
+    out->command = &line[start];
+    out->ncommand = end - start;
+    return LINE_ENTRY;
+}
@@ -0,0 +1,186 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "widestr.h"
+#include <stdint.h>     // For WCHAR_MAX.
+#include <wctype.h>     // For iswspace.
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WIDESTR_X86
+#include <immintrin.h>  // For SSE2 and AVX2 intrinsics.
+#endif
+
+typedef const wchar_t *(*WideSearchFunc)(const wchar_t *haystack, size_t hlen, const wchar_t *needle, size_t nlen);
+
+static const wchar_t *WideSearchResolve(const wchar_t *haystack, size_t hlen, const wchar_t *needle, size_t nlen);
+
+// Starts out pointing at the resolver, which replaces it with the best implementation on the first call.
+// Threads racing on the first call all write the same value, so that's harmless.
+static WideSearchFunc wideSearchImpl = WideSearchResolve;
+static const char *wideSearchImplName = "unresolved";
+
+WideSpan WideSpanTrim(WideSpan span)
+{
+    while (span.len > 0 && iswspace(span.str[0]))
+    {
+        span.str++;
+        span.len--;
+    }
+
+    while (span.len > 0 && iswspace(span.str[span.len - 1])) span.len--;
+    return span;
+}
+
+const wchar_t *WideSearch(const wchar_t *haystack, size_t hlen, const wchar_t *needle, size_t nlen)
+{
+    return wideSearchImpl(haystack, hlen, needle, nlen);
+}
+
+const char *WideSearchImplName()
+{
+    if (wideSearchImpl == WideSearchResolve) WideSearchResolve(NULL, 0, NULL, 1);
+    return wideSearchImplName;
+}
+
+const wchar_t *WideSearchScalar(const wchar_t *haystack, size_t hlen, const wchar_t *needle, size_t nlen)
+{
+    if (nlen == 0) return haystack;
+    if (nlen > hlen) return NULL;
+
+    const wchar_t *end = haystack + (hlen - nlen) + 1;
+
+    for (const wchar_t *h = haystack; (h = wmemchr(h, needle[0], end - h)) != NULL; h++)
+    {
+        if (wmemcmp(h + 1, needle + 1, nlen - 1) == 0) return h;
+    }
+
+    return NULL;
+}
+
+#ifdef WIDESTR_X86
+
+// The vectorized searches compare the needle's first and last characters against a whole block of haystack positions at once,
+// and only compare the rest of the needle at positions where both matched. wchar_t is 2 bytes on Windows but 4 on Linux.
+#if WCHAR_MAX <= 0xFFFF
+#define SET1_128(c) _mm_set1_epi16((short)(c))
+#define CMPEQ_128(a, b) _mm_cmpeq_epi16((a), (b))
+#define SET1_256(c) _mm256_set1_epi16((short)(c))
+#define CMPEQ_256(a, b) _mm256_cmpeq_epi16((a), (b))
+#else
+#define SET1_128(c) _mm_set1_epi32((int)(c))
+#define CMPEQ_128(a, b) _mm_cmpeq_epi32((a), (b))
+#define SET1_256(c) _mm256_set1_epi32((int)(c))
+#define CMPEQ_256(a, b) _mm256_cmpeq_epi32((a), (b))
+#endif
+
+// A movemask has one bit per byte, so a matching lane shows up as this many bits.
+#define LANE_MASK ((1u << sizeof(wchar_t)) - 1)
+
+// Checks the candidate positions in mask, which are relative to haystack + i. Returns the match or NULL.
+static inline const wchar_t *CheckCandidates(unsigned mask, const wchar_t *haystack, size_t i, const wchar_t *needle, size_t nlen)
+{
+    while (mask != 0)
+    {
+        unsigned bit = __builtin_ctz(mask);
+        const wchar_t *candidate = haystack + i + bit / sizeof(wchar_t);
+
+        // The first and last characters are already known to match.
+        if (nlen <= 2 || wmemcmp(candidate + 1, needle + 1, nlen - 2) == 0) return candidate;
+
+        mask &= ~(LANE_MASK << bit);
+    }
+
+    return NULL;
+}
+
+__attribute__((target("sse2")))
+static const wchar_t *WideSearchSse2(const wchar_t *haystack, size_t hlen, const wchar_t *needle, size_t nlen)
+{
+    const size_t lanes = sizeof(__m128i) / sizeof(wchar_t);
+
+    if (nlen == 0) return haystack;
+    if (nlen > hlen) return NULL;
+
+    __m128i first = SET1_128(needle[0]);
+    __m128i last = SET1_128(needle[nlen - 1]);
+    size_t i = 0;
+
+    for (; i + lanes + nlen - 1 <= hlen; i += lanes)
+    {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i *)(haystack + i));
+        __m128i blockLast = _mm_loadu_si128((const __m128i *)(haystack + i + nlen - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(CMPEQ_128(first, blockFirst), CMPEQ_128(last, blockLast)));
+        const wchar_t *match = CheckCandidates(mask, haystack, i, needle, nlen);
+
+        if (match != NULL) return match;
+    }
+
+    // Whatever is left is shorter than a block.
+    return WideSearchScalar(haystack + i, hlen - i, needle, nlen);
+}
+
+__attribute__((target("avx2")))
+static const wchar_t *WideSearchAvx2(const wchar_t *haystack, size_t hlen, const wchar_t *needle, size_t nlen)
+{
+    const size_t lanes = sizeof(__m256i) / sizeof(wchar_t);
+
+    if (nlen == 0) return haystack;
+    if (nlen > hlen) return NULL;
+
+    __m256i first = SET1_256(needle[0]);
+    __m256i last = SET1_256(needle[nlen - 1]);
+    size_t i = 0;
+
+    for (; i + lanes + nlen - 1 <= hlen; i += lanes)
+    {
+        __m256i blockFirst = _mm256_loadu_si256((const __m256i *)(haystack + i));
+        __m256i blockLast = _mm256_loadu_si256((const __m256i *)(haystack + i + nlen - 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(CMPEQ_256(first, blockFirst), CMPEQ_256(last, blockLast)));
+        const wchar_t *match = CheckCandidates(mask, haystack, i, needle, nlen);
+
+        if (match != NULL) return match;
+    }
+
+    // The SSE2 version will take care of the last few blocks.
+    return WideSearchSse2(haystack + i, hlen - i, needle, nlen);
+}
+
+#endif // WIDESTR_X86
+
+static const wchar_t *WideSearchResolve(const wchar_t *haystack, size_t hlen, const wchar_t *needle, size_t nlen)
+{
+#ifdef WIDESTR_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        wideSearchImplName = "avx2";
+        wideSearchImpl = WideSearchAvx2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        wideSearchImplName = "sse2";
+        wideSearchImpl = WideSearchSse2;
+    }
+    else
+#endif
+    {
+        wideSearchImplName = "scalar";
+        wideSearchImpl = WideSearchScalar;
+    }
+
+    return wideSearchImpl(haystack, hlen, needle, nlen);
+}
@@ -0,0 +1,225 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "wildcard.h"
+#include "widestr.h"    // For searching for segments.
+#include <stdlib.h>     // For malloc.
+#include <string.h>     // For memset.
+
+#define NOT_FOUND ((size_t)-1)
+
+static size_t CountSegments(const wchar_t *pattern, size_t len);
+static char IsSegmentAt(const WildcardSegment *seg, const wchar_t *chars, const wchar_t *text);
+static size_t FindSegment(const WildcardSegment *seg, const wchar_t *chars, const wchar_t *text, size_t len);
+
+WildcardSet *WildcardSetBuild(const wchar_t *const *patterns, const size_t *lens, size_t npatterns)
+{
+    size_t nsegments = 0;
+    size_t nchars = 0;
+
+    for (size_t i = 0; i < npatterns; i++)
+    {
+        nsegments += CountSegments(patterns[i], lens[i]);
+        nchars += lens[i];
+    }
+
+    size_t patternsOffset = sizeof(WildcardSet);
+    size_t segmentsOffset = patternsOffset + npatterns * sizeof(WildcardPattern);
+    size_t charsOffset = segmentsOffset + nsegments * sizeof(WildcardSegment);
+    size_t size = charsOffset + nchars * sizeof(wchar_t);
+    WildcardSet *ws = malloc(size);
+
+    if (ws == NULL)
+    {
+        return NULL;
+    }
+
+    memset(ws, 0, sizeof(*ws));
+    ws->size = size;
+    ws->npatterns = npatterns;
+    ws->nsegments = nsegments;
+    ws->patternsOffset = patternsOffset;
+    ws->segmentsOffset = segmentsOffset;
+    ws->charsOffset = charsOffset;
+
+    WildcardPattern *wpatterns = (WildcardPattern *)((char *)ws + patternsOffset);
+    WildcardSegment *segments = (WildcardSegment *)((char *)ws + segmentsOffset);
+    wchar_t *chars = (wchar_t *)((char *)ws + charsOffset);
+    uint32_t nseg = 0, nch = 0;
+
+    for (size_t i = 0; i < npatterns; i++)
+    {
+        const wchar_t *pattern = patterns[i];
+        size_t len = lens[i];
+        WildcardPattern *wp = &wpatterns[i];
+
+        wp->firstSegment = nseg;
+        wp->nsegments = 0;
+        wp->minLen = 0;
+        wp->isAnchoredStart = len == 0 || pattern[0] != L'*';
+        wp->isAnchoredEnd = len == 0 || pattern[len - 1] != L'*';
+
+        for (size_t j = 0; j < len;)
+        {
+            if (pattern[j] == L'*')
+            {
+                j++;
+                continue;
+            }
+
+            WildcardSegment *seg = &segments[nseg++];
+            seg->charsIdx = nch;
+            seg->len = 0;
+            seg->runIdx = 0;
+            seg->runLen = 0;
+
+            // Copy the segment while keeping track of its longest run without a '?'.
+            for (uint32_t runStart = 0; j < len && pattern[j] != L'*'; j++)
+            {
+                chars[nch++] = pattern[j];
+                seg->len++;
+
+                if (pattern[j] == L'?')
+                {
+                    runStart = seg->len;
+                }
+                else if (seg->len - runStart > seg->runLen)
+                {
+                    seg->runIdx = runStart;
+                    seg->runLen = seg->len - runStart;
+                }
+            }
+
+            wp->nsegments++;
+            wp->minLen += seg->len;
+        }
+    }
+
+    return ws;
+}
+
+char WildcardSetMatch(const WildcardSet *ws, uint32_t pattern, const wchar_t *text, size_t len)
+{
+    const WildcardPattern *wp = &((const WildcardPattern *)((const char *)ws + ws->patternsOffset))[pattern];
+    const WildcardSegment *segs = &((const WildcardSegment *)((const char *)ws + ws->segmentsOffset))[wp->firstSegment];
+    const wchar_t *chars = (const wchar_t *)((const char *)ws + ws->charsOffset);
+    size_t first = 0, last = wp->nsegments; // The range of segments which may be anywhere.
+    size_t pos = 0, end = len;              // The range of the text they have to be in.
+
+    if (len < wp->minLen)
+    {
+        return 0;
+    }
+
+    // A pattern that's all '*'s matches anything, and an empty one only matches empty strings.
+    if (wp->nsegments == 0)
+    {
+        return !wp->isAnchoredStart || len == 0;
+    }
+
+    if (wp->isAnchoredStart)
+    {
+        if (!IsSegmentAt(&segs[0], chars, text)) return 0;
+        pos = segs[0].len;
+        first = 1;
+    }
+
+    if (wp->isAnchoredEnd)
+    {
+        // A pattern without any '*' is a single segment that has to be the whole string.
+        if (first == wp->nsegments) return pos == len;
+
+        end = len - segs[last - 1].len;
+        if (end < pos || !IsSegmentAt(&segs[last - 1], chars, text + end)) return 0;
+        last--;
+    }
+
+    for (size_t i = first; i < last; i++)
+    {
+        size_t found = FindSegment(&segs[i], chars, text + pos, end - pos);
+        if (found == NOT_FOUND) return 0;
+
+        pos += found + segs[i].len;
+    }
+
+    return 1;
+}
+
+void WildcardSetFree(WildcardSet *ws)
+{
+    free(ws);
+}
+
+static size_t CountSegments(const wchar_t *pattern, size_t len)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        if (pattern[i] != L'*' && (i == 0 || pattern[i - 1] == L'*')) n++;
+    }
+
+    return n;
+}
+
+static char IsSegmentAt(const WildcardSegment *seg, const wchar_t *chars, const wchar_t *text)
+{
+    const wchar_t *s = &chars[seg->charsIdx];
+
+    if (seg->runLen == seg->len)
+    {
+        return wmemcmp(s, text, seg->len) == 0;
+    }
+
+    for (uint32_t i = 0; i < seg->len; i++)
+    {
+        if (s[i] != L'?' && s[i] != text[i]) return 0;
+    }
+
+    return 1;
+}
+
+// Returns the index of the first place in text where the segment is, or NOT_FOUND.
+static size_t FindSegment(const WildcardSegment *seg, const wchar_t *chars, const wchar_t *text, size_t len)
+{
+    const wchar_t *run = &chars[seg->charsIdx + seg->runIdx];
+
+    if (len < seg->len)
+    {
+        return NOT_FOUND;
+    }
+
+    // A segment of only '?'s fits anywhere.
+    if (seg->runLen == 0)
+    {
+        return 0;
+    }
+
+    // Search for the run, and where it's found check the '?'s around it. The run can't be so close to either end that the rest won't fit.
+    const wchar_t *from = text + seg->runIdx;
+    const wchar_t *to = text + len - (seg->len - seg->runIdx - seg->runLen);
+    const wchar_t *found;
+
+    while ((found = WideSearch(from, to - from, run, seg->runLen)) != NULL)
+    {
+        const wchar_t *start = found - seg->runIdx;
+        if (IsSegmentAt(seg, chars, start)) return start - text;
+
+        from = found + 1;
+    }
+
+    return NOT_FOUND;
+}
@@ -0,0 +1,342 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "wmiprocess.h"
+#include "wqlplan.h"    // For enumerating only the processes the whitelist could match.
+#include "batchiter.h"  // For bringing back processes many at a time.
+#include <oleauto.h>    // For working with BSTRs.
+#include <stdio.h>      // For _snwprintf.
+#include <stdlib.h>     // For malloc.
+#include <string.h>     // For memset.
+
+// Processes are queried for their command lines this many at a time, to keep the queries short.
+#define PIDS_PER_QUERY 64
+
+// Processes are brought back from WMI this many at a time, each batch in one round trip.
+#define BATCH_SIZE 64
+
+// How long to wait for a batch before handing out what came so far, and how long WMI can go without sending anything before it's given up on.
+#define BATCH_TIMEOUT_MS 1000
+#define MAX_IDLE_MS 30000
+
+typedef struct
+{
+    ProcessSource base;
+    IWbemServices *services;
+    wchar_t *query;                   // Enumerates all the processes. NULL until there's a plan.
+    IEnumWbemClassObject *enumerator; // NULL between queries.
+    BatchIterator batch;              // Goes over the enumerator.
+    char isFinished;                  // Whether the enumeration ended, if there's no enumerator.
+    IWbemClassObject *current;        // The process last returned by next.
+    VARIANT variants[PROCFIELD_NUMOF]; // The fields of the current process. VT_EMPTY unless they were read.
+
+    // The PIDs given to beginSome, and how many of them were queried so far.
+    uint32_t *pids;
+    size_t npids;
+    size_t pidsCapacity;
+    size_t pos;
+} WmiProcessSource;
+
+static void ReleaseCurrent(WmiProcessSource *wmi);
+static void ReleaseEnumerator(WmiProcessSource *wmi);
+static char Query(WmiProcessSource *wmi, const wchar_t *query);
+static BatchFetchResult FetchProcesses(void *ctx, void **items, size_t max, uint32_t timeoutMs, size_t *nfetched);
+static void ReleaseProcess(void *ctx, void *item);
+static char QuerySome(WmiProcessSource *wmi);
+static char WmiBegin(ProcessSource *source);
+static char WmiBeginSome(ProcessSource *source, const uint32_t *pids, size_t npids);
+static ProcessSourceResult WmiNext(ProcessSource *source, ProcessInfo *process);
+static void WmiReadField(ProcessSource *source, ProcessInfo *process, ProcessField field);
+static void WmiClose(ProcessSource *source);
+
+// Until a whitelist is planned for, every process is enumerated.
+static const wchar_t *defaultQuery = L"SELECT Name,ProcessId,CreationDate FROM Win32_Process";
+
+static const ProcessSourceVtbl wmiVtbl = { WmiBegin, WmiBeginSome, WmiNext, WmiReadField, WmiClose };
+
+char WmiGetProcessIdentity(IWbemClassObject *process, uint32_t *pid, uint64_t *createTime)
+{
+    VARIANT pidVariant, dateVariant;
+    char success = 0;
+
+    if (FAILED(process->lpVtbl->Get(process, L"ProcessId", 0, &pidVariant, 0, 0)))
+    {
+        return 0;
+    }
+
+    if (FAILED(process->lpVtbl->Get(process, L"CreationDate", 0, &dateVariant, 0, 0)))
+    {
+        VariantClear(&pidVariant);
+        return 0;
+    }
+
+    // uint32 properties normally come back as VT_I4.
+    if (pidVariant.vt != VT_I4 && pidVariant.vt != VT_UI4)
+    {
+        goto cleanup;
+    }
+
+    *pid = (uint32_t)pidVariant.lVal;
+    *createTime = 0;
+
+    // Some system processes have no creation date. Their PIDs are never reused so that's fine.
+    if (dateVariant.vt == VT_BSTR)
+    {
+        // CIM_DATETIME looks like yyyymmddHHMMSS.mmmmmmsUUU. We don't care about the UTC offset since it's the same for all processes.
+        SYSTEMTIME st = {0};
+        FILETIME ft;
+        unsigned long micros;
+
+        if (swscanf(dateVariant.bstrVal, L"%4hu%2hu%2hu%2hu%2hu%2hu.%6lu", &st.wYear, &st.wMonth, &st.wDay, &st.wHour, &st.wMinute, &st.wSecond, &micros) != 7 ||
+            !SystemTimeToFileTime(&st, &ft))
+        {
+            goto cleanup;
+        }
+
+        *createTime = ((uint64_t)ft.dwHighDateTime << 32 | ft.dwLowDateTime) + micros * 10;
+    }
+
+    success = 1;
+
+cleanup:
+    VariantClear(&pidVariant);
+    VariantClear(&dateVariant);
+    return success;
+}
+
+void WmiGetProcessField(IWbemClassObject *process, ProcessField field, VARIANT *variant, WideSpan *span)
+{
+    *span = (WideSpan){ NULL, 0 };
+
+    if (FAILED(process->lpVtbl->Get(process, procfield_str[field], 0, variant, 0, 0)))
+    {
+        // Mark failed fields empty so we know not to free them.
+        variant->vt = VT_EMPTY;
+        return;
+    }
+
+    // The span stays NULL if it's not a string (it's VT_NULL when the process has no value).
+    if (variant->vt == VT_BSTR)
+    {
+        // Trimming the span instead of a copy of the string means no allocations.
+        *span = WideSpanTrim((WideSpan){ variant->bstrVal, SysStringLen(variant->bstrVal) });
+    }
+}
+
+void WmiGetProcessFields(IWbemClassObject *process, VARIANT variants[PROCFIELD_NUMOF], WideSpan fields[PROCFIELD_NUMOF])
+{
+    for (int i = 0; i < PROCFIELD_NUMOF; i++)
+    {
+        WmiGetProcessField(process, i, &variants[i], &fields[i]);
+    }
+}
+
+void WmiClearProcessFields(VARIANT variants[PROCFIELD_NUMOF])
+{
+    for (int i = 0; i < PROCFIELD_NUMOF; i++)
+    {
+        if (variants[i].vt != VT_EMPTY) VariantClear(&variants[i]);
+        variants[i].vt = VT_EMPTY;
+    }
+}
+
+ProcessSource *WmiProcessSourceOpen(IWbemServices *services)
+{
+    WmiProcessSource *wmi = calloc(1, sizeof(*wmi));
+
+    if (wmi == NULL)
+    {
+        return NULL;
+    }
+
+    wmi->base.vtbl = &wmiVtbl;
+    wmi->services = services;
+    for (int i = 0; i < PROCFIELD_NUMOF; i++) wmi->variants[i].vt = VT_EMPTY;
+
+    if (!BatchIteratorInit(&wmi->batch, BATCH_SIZE, BATCH_TIMEOUT_MS, MAX_IDLE_MS, FetchProcesses, ReleaseProcess, wmi))
+    {
+        free(wmi);
+        return NULL;
+    }
+
+    return &wmi->base;
+}
+
+char WmiProcessSourcePlan(ProcessSource *source, const CompiledWhitelist *cw)
+{
+    WmiProcessSource *wmi = (WmiProcessSource *)source;
+
+    // A query planned for another whitelist could leave out processes this one matches, so it's never kept.
+    free(wmi->query);
+    wmi->query = WqlPlanQuery(cw);
+    return wmi->query != NULL;
+}
+
+static void ReleaseCurrent(WmiProcessSource *wmi)
+{
+    WmiClearProcessFields(wmi->variants);
+    if (wmi->current != NULL) wmi->current->lpVtbl->Release(wmi->current);
+    wmi->current = NULL;
+}
+
+static void ReleaseEnumerator(WmiProcessSource *wmi)
+{
+    // The batch holds processes from the enumerator.
+    BatchIteratorRestart(&wmi->batch);
+    if (wmi->enumerator != NULL) wmi->enumerator->lpVtbl->Release(wmi->enumerator);
+    wmi->enumerator = NULL;
+}
+
+static char Query(WmiProcessSource *wmi, const wchar_t *query)
+{
+    ReleaseEnumerator(wmi);
+
+    // Returning immediately is what lets Next wait for a bounded time, instead of ExecQuery waiting for the whole result.
+    return SUCCEEDED(wmi->services->lpVtbl->ExecQuery(wmi->services, L"WQL", (BSTR)query, WBEM_FLAG_RETURN_IMMEDIATELY | WBEM_FLAG_FORWARD_ONLY, NULL, &wmi->enumerator));
+}
+
+static BatchFetchResult FetchProcesses(void *ctx, void **items, size_t max, uint32_t timeoutMs, size_t *nfetched)
+{
+    WmiProcessSource *wmi = ctx;
+    ULONG count = 0;
+    HRESULT res = wmi->enumerator->lpVtbl->Next(wmi->enumerator, timeoutMs, max, (IWbemClassObject **)items, &count);
+
+    *nfetched = count;
+
+    // WBEM_S_FALSE means fewer than max were left.
+    if (res == WBEM_S_FALSE) return FETCH_END;
+    if (res == WBEM_S_TIMEDOUT) return FETCH_TIMEOUT;
+    return res == WBEM_S_NO_ERROR ? FETCH_MORE : FETCH_ERROR;
+}
+
+static void ReleaseProcess(void *ctx, void *item)
+{
+    IWbemClassObject *process = item;
+    process->lpVtbl->Release(process);
+}
+
+// Queries the next few of the PIDs given to beginSome, this time with their command lines.
+static char QuerySome(WmiProcessSource *wmi)
+{
+    wchar_t query[128 + PIDS_PER_QUERY * 32] = L"SELECT CommandLine,ProcessId,CreationDate FROM Win32_Process WHERE ";
+    size_t len = wcslen(query);
+
+    for (size_t i = 0; i < PIDS_PER_QUERY && wmi->pos < wmi->npids; i++, wmi->pos++)
+    {
+        len += _snwprintf(&query[len], _countof(query) - len, L"%lsProcessId=%u", i == 0 ? L"" : L" OR ", wmi->pids[wmi->pos]);
+    }
+
+    return Query(wmi, query);
+}
+
+// Command lines are never selected here, leaving them out is what spares WMI from reading every process's memory.
+static char WmiBegin(ProcessSource *source)
+{
+    WmiProcessSource *wmi = (WmiProcessSource *)source;
+
+    ReleaseCurrent(wmi);
+    wmi->npids = 0;
+    wmi->pos = 0;
+    wmi->isFinished = 0;
+
+    return Query(wmi, wmi->query != NULL ? wmi->query : defaultQuery);
+}
+
+static char WmiBeginSome(ProcessSource *source, const uint32_t *pids, size_t npids)
+{
+    WmiProcessSource *wmi = (WmiProcessSource *)source;
+
+    ReleaseCurrent(wmi);
+    ReleaseEnumerator(wmi);
+
+    if (wmi->pidsCapacity < npids)
+    {
+        uint32_t *grown = realloc(wmi->pids, npids * sizeof(*grown));
+        if (grown == NULL) return 0;
+
+        wmi->pids = grown;
+        wmi->pidsCapacity = npids;
+    }
+
+    if (npids > 0) memcpy(wmi->pids, pids, npids * sizeof(*pids));
+    wmi->npids = npids;
+    wmi->pos = 0;
+    wmi->isFinished = npids == 0;
+    return npids == 0 || QuerySome(wmi);
+}
+
+static ProcessSourceResult WmiNext(ProcessSource *source, ProcessInfo *process)
+{
+    WmiProcessSource *wmi = (WmiProcessSource *)source;
+    BatchResult res;
+
+    ReleaseCurrent(wmi);
+
+    for (;;)
+    {
+        if (wmi->enumerator == NULL)
+        {
+            return wmi->isFinished ? PROCSOURCE_END : PROCSOURCE_ERROR;
+        }
+
+        if ((res = BatchIteratorNext(&wmi->batch, (void **)&wmi->current)) == BATCH_ITEM)
+        {
+            break;
+        }
+
+        wmi->current = NULL;
+        ReleaseEnumerator(wmi);
+
+        if (res == BATCH_ERROR) return PROCSOURCE_ERROR;
+
+        // The PIDs of beginSome are queried a few at a time.
+        if (wmi->pos < wmi->npids)
+        {
+            if (!QuerySome(wmi)) return PROCSOURCE_ERROR;
+        }
+        else
+        {
+            wmi->isFinished = 1;
+        }
+    }
+
+    process->isIdentified = WmiGetProcessIdentity(wmi->current, &process->pid, &process->createTime);
+    memset(process->fields, 0, sizeof(process->fields));
+    return PROCSOURCE_PROCESS;
+}
+
+static void WmiReadField(ProcessSource *source, ProcessInfo *process, ProcessField field)
+{
+    WmiProcessSource *wmi = (WmiProcessSource *)source;
+
+    if (wmi->variants[field].vt != VT_EMPTY) VariantClear(&wmi->variants[field]);
+    wmi->variants[field].vt = VT_EMPTY;
+    process->fields[field] = (WideSpan){ NULL, 0 };
+
+    if (wmi->current != NULL) WmiGetProcessField(wmi->current, field, &wmi->variants[field], &process->fields[field]);
+}
+
+static void WmiClose(ProcessSource *source)
+{
+    WmiProcessSource *wmi = (WmiProcessSource *)source;
+
+    ReleaseCurrent(wmi);
+    ReleaseEnumerator(wmi);
+    BatchIteratorFree(&wmi->batch);
+    free(wmi->pids);
+    free(wmi->query);
+    free(wmi);
+}
@@ -0,0 +1,148 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "wqlplan.h"
+#include <stdlib.h>     // For realloc.
+
+#define INITIAL_QUERY_SIZE 128
+
+// A query being built. Once anything fails to fit, it stays failed.
+typedef struct
+{
+    wchar_t *str;
+    size_t len;
+    size_t size;
+    char isFailed;
+} QueryBuilder;
+
+static char CanFilterByName(const CompiledWhitelist *cw);
+static void AppendLikeTerm(QueryBuilder *qb, const CompiledWhitelist *cw, size_t entry, MatchKind kind);
+static void AppendStr(QueryBuilder *qb, const wchar_t *str);
+static void AppendChar(QueryBuilder *qb, wchar_t c);
+
+wchar_t *WqlPlanQuery(const CompiledWhitelist *cw)
+{
+    QueryBuilder qb = {0};
+    const WhitelistGroup *names = cw->groups[PROCFIELD_NAME];
+    char isFirst = 1;
+
+    // CBA to compose this string using procfield_str.
+    AppendStr(&qb, WhitelistFieldLists(cw, PROCFIELD_NAME) ? L"SELECT Name,ProcessId,CreationDate FROM Win32_Process" : L"SELECT ProcessId,CreationDate FROM Win32_Process");
+
+    if (CanFilterByName(cw))
+    {
+        AppendStr(&qb, L" WHERE ");
+
+        for (int kind = 0; kind < MATCHKIND_NUMOF; kind++)
+        {
+            for (uint32_t i = 0; i < names[kind].count; i++)
+            {
+                if (!isFirst) AppendStr(&qb, L" OR ");
+                AppendLikeTerm(&qb, cw, names[kind].start + i, kind);
+                isFirst = 0;
+            }
+        }
+    }
+
+    if (qb.isFailed)
+    {
+        free(qb.str);
+        return NULL;
+    }
+
+    return qb.str;
+}
+
+// A process can only be filtered out if no entry could match it, which means every entry has to be on the name. Regexes can't be put as a LIKE.
+static char CanFilterByName(const CompiledWhitelist *cw)
+{
+    size_t nnames = 0;
+
+    for (int kind = 0; kind < MATCHKIND_NUMOF; kind++)
+    {
+        nnames += cw->groups[PROCFIELD_NAME][kind].count;
+    }
+
+    return nnames > 0 && nnames == cw->nentries && nnames <= WQLPLAN_MAX_FILTER_ENTRIES && cw->groups[PROCFIELD_NAME][MATCHKIND_REGEX].count == 0;
+}
+
+// Appends a condition on the name that every name the entry matches meets. Names are trimmed before they're matched, so every pattern allows for
+// leading whitespace. Trailing whitespace needn't be, Windows doesn't allow file names to end with it.
+static void AppendLikeTerm(QueryBuilder *qb, const CompiledWhitelist *cw, size_t entry, MatchKind kind)
+{
+    WideSpan value = WhitelistEntryValue(cw, entry);
+
+    AppendStr(qb, L"Name LIKE '");
+    if (kind != MATCHKIND_GLOB || value.len == 0 || value.str[0] != L'*') AppendChar(qb, L'%');
+
+    for (size_t i = 0; i < value.len; i++)
+    {
+        wchar_t c = value.str[i];
+
+        if (kind == MATCHKIND_GLOB && (c == L'*' || c == L'?'))
+        {
+            AppendChar(qb, c == L'*' ? L'%' : L'_');
+        }
+        else if (c == L'%' || c == L'_' || c == L'[')
+        {
+            // Characters which mean something to LIKE are matched literally by putting them in a set.
+            AppendChar(qb, L'[');
+            AppendChar(qb, c);
+            AppendChar(qb, L']');
+        }
+        else
+        {
+            // And characters which mean something to the string are escaped.
+            if (c == L'\\' || c == L'\'') AppendChar(qb, L'\\');
+            AppendChar(qb, c);
+        }
+    }
+
+    if (kind == MATCHKIND_SUBSTRING) AppendChar(qb, L'%');
+    AppendChar(qb, L'\'');
+}
+
+static void AppendStr(QueryBuilder *qb, const wchar_t *str)
+{
+    while (*str != L'\0') AppendChar(qb, *str++);
+}
+
+// Keeps the query null-terminated.
+static void AppendChar(QueryBuilder *qb, wchar_t c)
+{
+    if (qb->isFailed)
+    {
+        return;
+    }
+
+    if (qb->len + 2 > qb->size)
+    {
+        size_t size = qb->size == 0 ? INITIAL_QUERY_SIZE : qb->size * 2;
+        wchar_t *grown = realloc(qb->str, size * sizeof(*grown));
+
+        if (grown == NULL)
+        {
+            qb->isFailed = 1;
+            return;
+        }
+
+        qb->str = grown;
+        qb->size = size;
+    }
+
+    qb->str[qb->len++] = c;
+    qb->str[qb->len] = L'\0';
+}
@@ -0,0 +1,189 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Checks BatchIterator against a fake enumerator which answers each fetch from a script, the way WMI might: with timeouts that bring
+// nothing, batches cut short, and errors after some of the items were fetched. Every item has to be either handed out or released, once.
+
+#include "test.h"
+#include "batchiter.h"
+#include <stdint.h>
+
+#define BATCH_SIZE 4
+#define TIMEOUT_MS 100
+#define MAX_IDLE_MS 300
+#define MAX_ITEMS 64
+
+typedef struct
+{
+    BatchFetchResult result;
+    size_t nitems;
+} FetchStep;
+
+typedef struct
+{
+    const FetchStep *steps;
+    size_t nsteps;
+    size_t nfetches;
+    uintptr_t nextItem; // Items are numbered from 1 so none of them is NULL.
+    int nreleases[MAX_ITEMS + 1];
+} FakeEnumerator;
+
+static BatchFetchResult FakeFetch(void *ctx, void **items, size_t max, uint32_t timeoutMs, size_t *nfetched);
+static void FakeRelease(void *ctx, void *item);
+static void StartScript(FakeEnumerator *fake, const FetchStep *steps, size_t nsteps);
+static size_t Drain(BatchIterator *it, BatchResult *last);
+static int CountReleases(const FakeEnumerator *fake);
+
+int main()
+{
+    FakeEnumerator fake = {0};
+    BatchIterator it = {0};
+    BatchResult last;
+    void *item;
+
+    TestBegin();
+    CHECK(BatchIteratorInit(&it, BATCH_SIZE, TIMEOUT_MS, MAX_IDLE_MS, FakeFetch, FakeRelease, &fake));
+
+    // Timeouts that bring nothing add up, and once they reach maxIdleMs the enumerator is given up on.
+    StartScript(&fake, (FetchStep[]){ { FETCH_TIMEOUT, 0 }, { FETCH_TIMEOUT, 0 }, { FETCH_TIMEOUT, 0 }, { FETCH_END, 1 } }, 4);
+    CHECK(Drain(&it, &last) == 0);
+    CHECK(last == BATCH_ERROR);
+    CHECK(fake.nfetches == MAX_IDLE_MS / TIMEOUT_MS);
+    CHECK(it.idleMs == MAX_IDLE_MS);
+
+    // But anything that brings items, even a timeout, starts the count over.
+    BatchIteratorRestart(&it);
+    StartScript(&fake, (FetchStep[]){
+            { FETCH_TIMEOUT, 0 }, { FETCH_TIMEOUT, 0 }, { FETCH_TIMEOUT, 2 },
+            { FETCH_TIMEOUT, 0 }, { FETCH_TIMEOUT, 0 }, { FETCH_MORE, 4 },
+            { FETCH_TIMEOUT, 0 }, { FETCH_TIMEOUT, 0 }, { FETCH_END, 1 },
+        }, 9);
+    CHECK(Drain(&it, &last) == 7);
+    CHECK(last == BATCH_END);
+    CHECK(CountReleases(&fake) == 0);
+
+    // A batch that comes back short is handed out in full, and the one with FETCH_END is the last one fetched.
+    BatchIteratorRestart(&it);
+    StartScript(&fake, (FetchStep[]){ { FETCH_MORE, 4 }, { FETCH_MORE, 3 }, { FETCH_END, 2 }, { FETCH_ERROR, 1 } }, 4);
+    CHECK(Drain(&it, &last) == 9);
+    CHECK(last == BATCH_END);
+    CHECK(fake.nfetches == 3);
+
+    // And the iterator stays ended without fetching again.
+    CHECK(BatchIteratorNext(&it, &item) == BATCH_END);
+    CHECK(fake.nfetches == 3);
+
+    // An end with nothing in it ends the items right away.
+    BatchIteratorRestart(&it);
+    StartScript(&fake, (FetchStep[]){ { FETCH_MORE, 4 }, { FETCH_END, 0 } }, 2);
+    CHECK(Drain(&it, &last) == 4);
+    CHECK(last == BATCH_END);
+
+    // Items fetched along with an error are never handed out, they're released.
+    BatchIteratorRestart(&it);
+    StartScript(&fake, (FetchStep[]){ { FETCH_MORE, 4 }, { FETCH_ERROR, 3 }, { FETCH_END, 1 } }, 3);
+    CHECK(Drain(&it, &last) == 4);
+    CHECK(last == BATCH_ERROR);
+    CHECK(CountReleases(&fake) == 3);
+    CHECK(fake.nreleases[5] == 1 && fake.nreleases[6] == 1 && fake.nreleases[7] == 1);
+
+    // And the iterator stays failed without fetching again.
+    CHECK(BatchIteratorNext(&it, &item) == BATCH_ERROR);
+    CHECK(fake.nfetches == 2);
+
+    // Restarting in the middle of a batch releases the rest of it, and so does freeing.
+    BatchIteratorRestart(&it);
+    StartScript(&fake, (FetchStep[]){ { FETCH_MORE, 4 }, { FETCH_MORE, 4 } }, 2);
+    CHECK(BatchIteratorNext(&it, &item) == BATCH_ITEM && item == (void *)1);
+    BatchIteratorRestart(&it);
+    CHECK(CountReleases(&fake) == 3);
+    CHECK(fake.nreleases[1] == 0);
+
+    CHECK(BatchIteratorNext(&it, &item) == BATCH_ITEM && item == (void *)5);
+    BatchIteratorFree(&it);
+    CHECK(CountReleases(&fake) == 6);
+    CHECK(fake.nreleases[5] == 0);
+
+    return TestEnd("batchiter");
+}
+
+// Answers the fetch with the next step of the script, with new items. Past the end of the script it fails.
+static BatchFetchResult FakeFetch(void *ctx, void **items, size_t max, uint32_t timeoutMs, size_t *nfetched)
+{
+    FakeEnumerator *fake = ctx;
+
+    CHECK(timeoutMs == TIMEOUT_MS);
+
+    if (fake->nfetches == fake->nsteps)
+    {
+        fake->nfetches++;
+        *nfetched = 0;
+        return FETCH_ERROR;
+    }
+
+    const FetchStep *step = &fake->steps[fake->nfetches++];
+    CHECK(step->nitems <= max);
+
+    for (size_t i = 0; i < step->nitems && fake->nextItem < MAX_ITEMS; i++)
+    {
+        items[i] = (void *)++fake->nextItem;
+    }
+
+    *nfetched = step->nitems;
+    return step->result;
+}
+
+static void FakeRelease(void *ctx, void *item)
+{
+    FakeEnumerator *fake = ctx;
+    uintptr_t n = (uintptr_t)item;
+
+    CHECK(n >= 1 && n <= fake->nextItem);
+    if (n <= MAX_ITEMS) fake->nreleases[n]++;
+}
+
+static void StartScript(FakeEnumerator *fake, const FetchStep *steps, size_t nsteps)
+{
+    *fake = (FakeEnumerator){ .steps = steps, .nsteps = nsteps };
+}
+
+// Takes items until the iterator stops handing them out, checking they come in the order they were fetched. Returns how many it took.
+static size_t Drain(BatchIterator *it, BatchResult *last)
+{
+    size_t ntaken = 0;
+    void *item;
+
+    while ((*last = BatchIteratorNext(it, &item)) == BATCH_ITEM)
+    {
+        CHECK(item == (void *)(ntaken + 1));
+        ntaken++;
+    }
+
+    return ntaken;
+}
+
+static int CountReleases(const FakeEnumerator *fake)
+{
+    int count = 0;
+
+    for (size_t n = 1; n <= MAX_ITEMS; n++)
+    {
+        CHECK(fake->nreleases[n] <= 1);
+        count += fake->nreleases[n];
+    }
+
+    return count;
+}
@@ -0,0 +1,174 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Checks that exact entries looked up in the hash table match the same processes, and report the same entries, as the linear scan it replaced.
+// The whitelists and process fields are made up from a tiny alphabet, so there are lots of duplicate entries and lots of fields that match.
+
+#include "test.h"
+#include "whitelist.h"
+
+#define NWHITELISTS 200
+#define MAX_ENTRIES 40
+#define NFIELDS 200
+#define MAX_VALUE_LEN 4
+#define MAX_REPORTED 64
+
+typedef struct
+{
+    size_t entries[MAX_REPORTED];
+    ProcessField fields[MAX_REPORTED];
+    size_t n;
+} Reported;
+
+static CompiledWhitelist *MakeWhitelist(size_t nentries);
+static size_t MakeValue(wchar_t *value);
+static void CheckTableAgainstKeys(const CompiledWhitelist *cw, ProcessField field);
+static void OnMatch(size_t entry, ProcessField field, void *ctx);
+static uint32_t Random();
+
+static uint64_t rng = 0x9E3779B97F4A7C15ull;
+
+int main()
+{
+    TestBegin();
+
+    for (int w = 0; w < NWHITELISTS; w++)
+    {
+        CompiledWhitelist *tabled = MakeWhitelist(Random() % (MAX_ENTRIES + 1));
+        Reported tabledReported, linearReported;
+
+        // A copy of the whitelist's header without the tables is matched by the linear scan. Its arrays are still the original's.
+        CompiledWhitelist copy = *tabled, *linear = &copy;
+
+        for (int field = 0; field < PROCFIELD_NUMOF; field++)
+        {
+            linear->groups[field][MATCHKIND_EXACT].table = NULL;
+            CHECK(tabled->groups[field][MATCHKIND_EXACT].count == 0 || tabled->groups[field][MATCHKIND_EXACT].table != NULL);
+            CheckTableAgainstKeys(tabled, field);
+        }
+
+        tabled->onMatch = linear->onMatch = OnMatch;
+        tabled->onMatchCtx = &tabledReported;
+        linear->onMatchCtx = &linearReported;
+
+        for (int f = 0; f < NFIELDS; f++)
+        {
+            wchar_t name[MAX_VALUE_LEN], cmdline[MAX_VALUE_LEN];
+            WideSpan fields[PROCFIELD_NUMOF] = { { name, MakeValue(name) }, { cmdline, MakeValue(cmdline) } };
+            char wanted = 1 + Random() % (LIST_WHITELIST | LIST_EXCLUSIVE);
+
+            // Every so often a field is missing.
+            if (Random() % 8 == 0) fields[Random() % PROCFIELD_NUMOF].str = NULL;
+
+            tabledReported.n = linearReported.n = 0;
+            char tabledLists = WhitelistMatch(tabled, fields, wanted);
+            char linearLists = WhitelistMatch(linear, fields, wanted);
+
+            CHECK(tabledLists == linearLists);
+            CHECK(tabledReported.n == linearReported.n);
+
+            for (size_t i = 0; i < tabledReported.n && i < linearReported.n; i++)
+            {
+                CHECK(tabledReported.entries[i] == linearReported.entries[i]);
+                CHECK(tabledReported.fields[i] == linearReported.fields[i]);
+            }
+        }
+
+        WhitelistFree(tabled);
+    }
+
+    return TestEnd("exacttable");
+}
+
+// A whitelist of exact entries only, spread over both fields and both lists.
+static CompiledWhitelist *MakeWhitelist(size_t nentries)
+{
+    size_t counts[PROCFIELD_NUMOF][MATCHKIND_NUMOF] = {0};
+    wchar_t values[MAX_ENTRIES][MAX_VALUE_LEN];
+    size_t lens[MAX_ENTRIES];
+    ProcessField fields[MAX_ENTRIES];
+
+    for (size_t i = 0; i < nentries; i++)
+    {
+        lens[i] = MakeValue(values[i]);
+        fields[i] = Random() % PROCFIELD_NUMOF;
+        counts[fields[i]][MATCHKIND_EXACT]++;
+    }
+
+    CompiledWhitelist *cw = WhitelistAlloc(counts, nentries * MAX_VALUE_LEN);
+
+    for (size_t i = 0; i < nentries; i++)
+    {
+        WhitelistAddEntry(cw, fields[i], MATCHKIND_EXACT, Random() % 2 ? LIST_WHITELIST : LIST_EXCLUSIVE, i + 1, values[i], lens[i]);
+    }
+
+    WhitelistBuildMatchers(cw);
+    return cw;
+}
+
+// Values of up to MAX_VALUE_LEN characters out of 2, so they come up again and again. Empty values are included on purpose.
+static size_t MakeValue(wchar_t *value)
+{
+    size_t len = Random() % (MAX_VALUE_LEN + 1);
+    for (size_t i = 0; i < len; i++) value[i] = Random() % 2 ? L'a' : L'.';
+    return len;
+}
+
+// Looking each key up directly has to find exactly the keys equal to it, in the order they were given.
+static void CheckTableAgainstKeys(const CompiledWhitelist *cw, ProcessField field)
+{
+    const WhitelistGroup *group = &cw->groups[field][MATCHKIND_EXACT];
+
+    for (uint32_t i = 0; group->table != NULL && i < group->count; i++)
+    {
+        WideSpan key = WhitelistEntryValue(cw, group->start + i);
+        int32_t id = ExactTableFind(group->table, 0, key.str, key.len);
+
+        for (uint32_t j = 0; j < group->count; j++)
+        {
+            WideSpan other = WhitelistEntryValue(cw, group->start + j);
+            if (other.len != key.len || wmemcmp(other.str, key.str, key.len) != 0) continue;
+
+            CHECK(id == (int32_t)j);
+            if (id == EXACT_NOT_FOUND) break;
+            id = ExactTableNext(group->table, id);
+        }
+
+        CHECK(id == EXACT_NOT_FOUND);
+    }
+}
+
+static void OnMatch(size_t entry, ProcessField field, void *ctx)
+{
+    Reported *reported = ctx;
+
+    if (reported->n < MAX_REPORTED)
+    {
+        reported->entries[reported->n] = entry;
+        reported->fields[reported->n] = field;
+    }
+
+    reported->n++;
+}
+
+// xorshift64*, so every run checks the same whitelists.
+static uint32_t Random()
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (rng * 0x2545F4914F6CDD1Dull) >> 32;
+}
@@ -0,0 +1,214 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Checks that a FileWatch on a whitelist in a scratch directory reports each of the ways an editor changes it exactly once,
+// and doesn't report reads of it, which the fixer does itself every time it reloads, or changes to other files next to it.
+// Also that changes call back right away, so the fixer needn't poll for them, and that reads and closing the watch don't.
+
+#include "test.h"
+#include "filewatch.h"
+#include <pthread.h>    // For waiting on the callbacks.
+#include <stdlib.h>     // For mkdtemp.
+#include <unistd.h>     // For rmdir.
+
+#define WATCHED_NAME "Whitelist.txt"
+
+// Changes are told of as they're made, this is only for a loaded machine.
+#define CHANGE_TIMEOUT_MS 2000
+
+// How long to wait to be sure that a change isn't told of.
+#define QUIET_MS 50
+
+static char dir[] = "/tmp/filewatch_testXXXXXX";
+
+static pthread_mutex_t changeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static int nchanges = 0;
+
+static void WriteFile(const char *name, const char *contents);
+static void ReadFile(const char *name);
+static const char *PathOf(const char *name);
+static void OnChange(void *ctx);
+static char WaitForChange(int *seen, int timeoutMs);
+
+int main()
+{
+    TestBegin();
+
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    CHECK(FileWatchOpen(PathOf("missing"), WATCHED_NAME, NULL, NULL) == NULL);
+
+    FileWatch *fw = FileWatchOpen(dir, WATCHED_NAME, NULL, NULL);
+    CHECK(fw != NULL);
+
+    if (fw == NULL)
+    {
+        rmdir(dir);
+        return TestEnd("filewatch");
+    }
+
+    // Nothing happened yet.
+    CHECK(!FileWatchPoll(fw));
+
+    // Created, then written in place.
+    WriteFile(WATCHED_NAME, "game.exe\n");
+    CHECK(FileWatchPoll(fw));
+    CHECK(!FileWatchPoll(fw));
+
+    WriteFile(WATCHED_NAME, "game.exe\nother.exe\n");
+    CHECK(FileWatchPoll(fw));
+    CHECK(!FileWatchPoll(fw));
+
+    // Reloading it doesn't count as a change.
+    ReadFile(WATCHED_NAME);
+    CHECK(!FileWatchPoll(fw));
+
+    // Written to a new file which is renamed over it, the way a lot of editors save. The new file itself is none of our business.
+    WriteFile(WATCHED_NAME ".tmp", "game.exe\n");
+    CHECK(!FileWatchPoll(fw));
+    CHECK(rename(PathOf(WATCHED_NAME ".tmp"), PathOf(WATCHED_NAME)) == 0);
+    CHECK(FileWatchPoll(fw));
+    CHECK(!FileWatchPoll(fw));
+
+    // Other files in the directory.
+    WriteFile("Other.txt", "game.exe\n");
+    ReadFile("Other.txt");
+    CHECK(remove(PathOf("Other.txt")) == 0);
+    CHECK(!FileWatchPoll(fw));
+
+    // Deleted.
+    CHECK(remove(PathOf(WATCHED_NAME)) == 0);
+    CHECK(FileWatchPoll(fw));
+    CHECK(!FileWatchPoll(fw));
+
+    // Changes that come between two polls are reported by one of them.
+    WriteFile(WATCHED_NAME, "game.exe\n");
+    WriteFile(WATCHED_NAME, "other.exe\n");
+    CHECK(FileWatchPoll(fw));
+    CHECK(!FileWatchPoll(fw));
+
+    CHECK(remove(PathOf(WATCHED_NAME)) == 0);
+    CHECK(FileWatchPoll(fw));
+    FileWatchClose(fw);
+    FileWatchClose(NULL);
+
+    // With a callback, changes are told of as they come, without polling. Reads aren't.
+    int seen = nchanges;
+    fw = FileWatchOpen(dir, WATCHED_NAME, OnChange, NULL);
+    CHECK(fw != NULL);
+
+    if (fw != NULL)
+    {
+        CHECK(!WaitForChange(&seen, QUIET_MS));
+
+        WriteFile(WATCHED_NAME, "game.exe\n");
+        CHECK(WaitForChange(&seen, CHANGE_TIMEOUT_MS));
+        CHECK(FileWatchPoll(fw));
+
+        ReadFile(WATCHED_NAME);
+        CHECK(!WaitForChange(&seen, QUIET_MS));
+        CHECK(!FileWatchPoll(fw));
+
+        // Even if the last one wasn't polled yet.
+        WriteFile(WATCHED_NAME, "other.exe\n");
+        CHECK(WaitForChange(&seen, CHANGE_TIMEOUT_MS));
+        CHECK(remove(PathOf(WATCHED_NAME)) == 0);
+        CHECK(WaitForChange(&seen, CHANGE_TIMEOUT_MS));
+        CHECK(FileWatchPoll(fw));
+
+        // Once it's closed it doesn't call back anymore.
+        FileWatchClose(fw);
+        WriteFile(WATCHED_NAME, "game.exe\n");
+        CHECK(!WaitForChange(&seen, QUIET_MS));
+        CHECK(remove(PathOf(WATCHED_NAME)) == 0);
+    }
+
+    CHECK(rmdir(dir) == 0);
+
+    return TestEnd("filewatch");
+}
+
+static void WriteFile(const char *name, const char *contents)
+{
+    FILE *file = fopen(PathOf(name), "w");
+    CHECK(file != NULL);
+
+    if (file != NULL)
+    {
+        fputs(contents, file);
+        fclose(file);
+    }
+}
+
+static void ReadFile(const char *name)
+{
+    char buffer[64];
+    FILE *file = fopen(PathOf(name), "r");
+    CHECK(file != NULL);
+
+    if (file != NULL)
+    {
+        while (fgets(buffer, sizeof(buffer), file) != NULL);
+        fclose(file);
+    }
+}
+
+// Returns the path of the file in the scratch directory. Only good until the call after the next one, so two can be passed to rename.
+static const char *PathOf(const char *name)
+{
+    static char paths[2][sizeof(dir) + 64];
+    static int next = 0;
+
+    char *path = paths[next];
+    next = !next;
+    snprintf(path, sizeof(paths[0]), "%s/%s", dir, name);
+    return path;
+}
+
+static void OnChange(void *ctx)
+{
+    pthread_mutex_lock(&changeLock);
+    nchanges++;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&changeLock);
+}
+
+// Waits for a change after the ones already seen. Returns zero if none came in time.
+static char WaitForChange(int *seen, int timeoutMs)
+{
+    struct timespec due;
+    clock_gettime(CLOCK_REALTIME, &due);
+    due.tv_sec += timeoutMs / 1000;
+    due.tv_nsec += (timeoutMs % 1000) * 1000000L;
+
+    if (due.tv_nsec >= 1000000000L)
+    {
+        due.tv_sec++;
+        due.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&changeLock);
+    while (nchanges == *seen && pthread_cond_timedwait(&changed, &changeLock, &due) == 0);
+    char isChanged = nchanges != *seen;
+    *seen = nchanges;
+    pthread_mutex_unlock(&changeLock);
+    return isChanged;
+}
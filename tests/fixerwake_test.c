@@ -0,0 +1,115 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Checks that a wake from another thread cuts the fixer's wait short right away, the way a tray command does, instead of after the interval.
+// Also that a wake which came before the wait isn't lost, that a notification cuts it short without passing for a command,
+// and that without either the wait lasts the interval.
+
+#include "test.h"
+#include "fixerwake.h"
+#include <pthread.h>
+#include <time.h>       // For nanosleep.
+
+#define NWAKES 20
+#define WAIT_INTERVAL_SEC 10
+
+// Waking up is a context switch or two, this leaves plenty of room for a loaded machine without letting a wait for the interval pass.
+#define MAX_WAKE_LATENCY_MS 100
+
+// Long enough for the waiter to be waiting by the time the wake comes.
+#define WAKE_DELAY_MS 20
+
+static void *WakeLater(void *arg);
+static void *NotifyLater(void *arg);
+static void *NotifyLater(void *arg)
+{
+    struct timespec delay = { 0, WAKE_DELAY_MS * 1000000L };
+    nanosleep(&delay, NULL);
+    FixerNotify(NULL);
+    return NULL;
+}
+
+static double ElapsedMs(const struct timespec *since);
+
+int main()
+{
+    double maxLatencyMs = 0;
+    struct timespec start;
+
+    TestBegin();
+
+    // Woken from another thread while waiting.
+    for (int i = 0; i < NWAKES; i++)
+    {
+        pthread_t waker;
+        CHECK(pthread_create(&waker, NULL, WakeLater, NULL) == 0);
+
+        char isWoken = FixerWaitForCycle(WAIT_INTERVAL_SEC);
+        double latencyMs = ElapsedMs(&glbl.wakeRequestTime);
+
+        CHECK(isWoken);
+        CHECK(latencyMs < MAX_WAKE_LATENCY_MS);
+        if (latencyMs > maxLatencyMs) maxLatencyMs = latencyMs;
+
+        pthread_join(waker, NULL);
+    }
+
+    printf("fixerwake: wake latency: max %.3f ms over %d wakes\n", maxLatencyMs, NWAKES);
+
+    // Woken before waiting, like when a command comes in while a cycle runs. The wake is only acted on once.
+    pthread_mutex_lock(&glbl.lock);
+    FixerWake();
+    pthread_mutex_unlock(&glbl.lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(FixerWaitForCycle(WAIT_INTERVAL_SEC));
+    CHECK(ElapsedMs(&start) < MAX_WAKE_LATENCY_MS);
+    CHECK(!glbl.isWakeRequested);
+
+    // Notified, like when a process starts. It isn't a command, and it doesn't leave one behind for the next wait either.
+    pthread_t notifier;
+    CHECK(pthread_create(&notifier, NULL, NotifyLater, NULL) == 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(!FixerWaitForCycle(WAIT_INTERVAL_SEC));
+    CHECK(ElapsedMs(&start) < WAKE_DELAY_MS + MAX_WAKE_LATENCY_MS);
+    CHECK(!glbl.isWakeRequested && !glbl.isNotified);
+    pthread_join(notifier, NULL);
+
+    // Not woken at all.
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(!FixerWaitForCycle(1));
+    CHECK(ElapsedMs(&start) >= 1000 - MAX_WAKE_LATENCY_MS);
+
+    return TestEnd("fixerwake");
+}
+
+static void *WakeLater(void *arg)
+{
+    struct timespec delay = { 0, WAKE_DELAY_MS * 1000000L };
+    nanosleep(&delay, NULL);
+
+    pthread_mutex_lock(&glbl.lock);
+    FixerWake();
+    pthread_mutex_unlock(&glbl.lock);
+    return NULL;
+}
+
+static double ElapsedMs(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000.0 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
@@ -0,0 +1,160 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Checks that once the memo has grown to fit the running processes, a poll makes no heap allocations, even as processes come and go.
+// The poll here is the part of EnumerateRunningProcesses that doesn't talk to WMI: looking processes up in the memo, trimming and matching
+// the fields of the new ones as spans, and evicting the ones that exited. WMI's own allocations for the VARIANTs aren't ours to avoid.
+
+#include "test.h"
+#include "whitelist.h"
+#include "whitelistfile.h"
+#include "procmemo.h"
+#include <string.h>     // For strlen.
+
+#define NPROCESSES 300
+#define NCHURN 10 // Processes that exit and start between polls.
+#define NWARMUP_POLLS 3
+#define NPOLLS 100
+#define MAX_FIELD_LEN 96
+
+typedef struct
+{
+    uint32_t pid;
+    uint64_t createTime;
+    wchar_t fields[PROCFIELD_NUMOF][MAX_FIELD_LEN];
+    size_t lens[PROCFIELD_NUMOF];
+} Process;
+
+// Every kind of entry on both fields, with enough substring entries on the command line for an automaton.
+static const char whitelistFile[] =
+    "??N app3.exe\n"
+    "\"C:\\Program Files\\App5\\app5.exe\" --arg5\n"
+    "??S app7.exe\"\n"
+    "??S App11\\\n"
+    "??S --arg13\n"
+    "??S Game.exe\n"
+    "??S Launcher.exe\n"
+    "??S -ServerName:Netflix\n"
+    "??S PrimeVideo.exe\n"
+    "??ES app17.exe\n"
+    "??NG app2?.exe\n"
+    "??G *\\App3?\\*\n"
+    "??R app(4|6)[0-9]\\.exe\n"
+    "??NR ^app9[0-9]+\n";
+
+static void MakeProcess(Process *process, uint32_t id);
+static char Poll(CompiledWhitelist *cw, ProcessMemo *memo, Process *processes, size_t *nmatched);
+
+int main()
+{
+    static Process processes[NPROCESSES];
+    ProcessMemo memo = {0};
+    WhitelistParseError error;
+    size_t nmatched = 0;
+    uint32_t nextId = 0;
+
+    TestBegin();
+
+    CompiledWhitelist *cw = WhitelistParse(whitelistFile, strlen(whitelistFile), &error);
+    CHECK(cw != NULL);
+    if (cw == NULL) return TestEnd("pollalloc");
+    CHECK(WhitelistBuildMatchers(cw));
+    CHECK(cw->groups[PROCFIELD_CMDLINE][MATCHKIND_SUBSTRING].automaton != NULL);
+
+    for (size_t i = 0; i < NPROCESSES; i++) MakeProcess(&processes[i], nextId++);
+
+    // The memo grows to fit the processes during the first polls.
+    for (int p = 0; p < NWARMUP_POLLS; p++) Poll(cw, &memo, processes, &nmatched);
+
+    size_t nallocationsBefore = nallocations;
+    nmatched = 0;
+
+    for (int p = 0; p < NPOLLS; p++)
+    {
+        // Processes exit and new ones take their place, so every poll has processes to match.
+        for (int c = 0; c < NCHURN; c++) MakeProcess(&processes[(p * NCHURN + c * 31) % NPROCESSES], nextId++);
+        Poll(cw, &memo, processes, &nmatched);
+    }
+
+    CHECK(nallocations == nallocationsBefore);
+    CHECK(memo.count == NPROCESSES);
+
+    // Some of the new processes should have matched, or the matchers weren't really exercised.
+    CHECK(nmatched > 0);
+
+    // Matching every process again, not only the new ones, doesn't allocate either.
+    for (size_t i = 0; i < NPROCESSES; i++)
+    {
+        WideSpan fields[PROCFIELD_NUMOF];
+
+        for (int field = 0; field < PROCFIELD_NUMOF; field++)
+        {
+            fields[field] = WideSpanTrim((WideSpan){ processes[i].fields[field], processes[i].lens[field] });
+        }
+
+        WhitelistMatch(cw, fields, LIST_WHITELIST | LIST_EXCLUSIVE);
+    }
+
+    CHECK(nallocations == nallocationsBefore);
+
+    ProcessMemoFree(&memo);
+    WhitelistFree(cw);
+    return TestEnd("pollalloc");
+}
+
+// Processes get their fields with the whitespace around them that WMI leaves in, so they have to be trimmed.
+static void MakeProcess(Process *process, uint32_t id)
+{
+    uint32_t app = id % 100;
+
+    process->pid = 4 + id * 4;
+    process->createTime = 1000 + id;
+    process->lens[PROCFIELD_NAME] = swprintf(process->fields[PROCFIELD_NAME], MAX_FIELD_LEN, L"app%u.exe ", app);
+    process->lens[PROCFIELD_CMDLINE] = swprintf(process->fields[PROCFIELD_CMDLINE], MAX_FIELD_LEN,
+        L"  \"C:\\Program Files\\App%u\\app%u.exe\" --arg%u  ", app, app, id % 20);
+}
+
+// Returns the LIST_* flags of the lists the running processes match, and counts the new processes that matched any.
+static char Poll(CompiledWhitelist *cw, ProcessMemo *memo, Process *processes, size_t *nmatched)
+{
+    char lists = 0;
+    ProcessMemoBeginCycle(memo);
+
+    for (size_t i = 0; i < NPROCESSES; i++)
+    {
+        Process *process = &processes[i];
+        char verdict;
+
+        if (!ProcessMemoLookup(memo, process->pid, process->createTime, &verdict))
+        {
+            WideSpan fields[PROCFIELD_NUMOF];
+
+            for (int field = 0; field < PROCFIELD_NUMOF; field++)
+            {
+                fields[field] = WideSpanTrim((WideSpan){ process->fields[field], process->lens[field] });
+            }
+
+            verdict = WhitelistMatch(cw, fields, LIST_WHITELIST | LIST_EXCLUSIVE);
+            *nmatched += verdict != 0;
+            CHECK(ProcessMemoInsert(memo, process->pid, process->createTime, verdict));
+        }
+
+        lists |= verdict;
+    }
+
+    ProcessMemoEndCycle(memo);
+    return lists;
+}
@@ -0,0 +1,299 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Checks the process connector backend of ProcessEvents. It's fed a script of the kernel's messages over a socket pair, which checks
+// which of them become events and which are skipped, and that each arrival is told of once. Then, if the kernel lets us listen (which
+// takes CAP_NET_ADMIN), a child is started and reaped for real, and both its start and its exit have to come, read as they're told of.
+
+#include "test.h"
+#include "procevents.h"
+#include <pthread.h>    // For waiting on arrivals.
+#include <string.h>     // For memcpy.
+#include <time.h>       // For timing the waits.
+#include <unistd.h>     // For fork and exec.
+#include <sys/socket.h> // For the socket pair.
+#include <sys/wait.h>   // For reaping the children.
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+// The kernel sends the events right as they happen, this is only for a loaded machine.
+#define EVENT_TIMEOUT_MS 2000
+
+// How long to wait to be sure that no arrival is told of.
+#define QUIET_MS 50
+
+static pthread_mutex_t arrivalLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t arrived = PTHREAD_COND_INITIALIZER;
+static int narrivals = 0;
+
+static void CheckFed();
+static void CheckKernel(ProcessEvents *pe);
+static void Send(int sock, const struct proc_event *ev, size_t len);
+static void SendExec(int sock, uint32_t pid, uint32_t tgid);
+static void SendExit(int sock, uint32_t pid, uint32_t tgid);
+static pid_t StartChild(int *stdinFd);
+static uint32_t GonePid();
+static void OnArrival(void *ctx);
+static char WaitForArrival(int *seen, int timeoutMs);
+static char WaitForEvent(ProcessEvents *pe, ProcessEventKind kind, uint32_t pid, ProcessEvent *event, int *seen);
+static char IsName(const ProcessEvent *event, const wchar_t *name);
+
+int main()
+{
+    TestBegin();
+
+    CheckFed();
+
+    ProcessEvents *pe = ProcessEventsOpen(0, OnArrival, NULL);
+
+    if (pe == NULL)
+    {
+        printf("procevents: can't listen to the process connector without CAP_NET_ADMIN, only the fed messages were checked\n");
+    }
+    else
+    {
+        CheckKernel(pe);
+        ProcessEventsClose(pe);
+    }
+
+    ProcessEventsClose(NULL);
+    return TestEnd("procevents");
+}
+
+static void CheckFed()
+{
+    int fds[2];
+    int seen = narrivals;
+    ProcessEvent event;
+
+    CHECK(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == 0);
+
+    ProcessEvents *pe = ProcessEventsFromSocket(fds[0], OnArrival, NULL);
+    CHECK(pe != NULL);
+
+    if (pe == NULL)
+    {
+        close(fds[1]);
+        return;
+    }
+
+    // Nothing sent yet.
+    CHECK(!ProcessEventsNext(pe, &event));
+    CHECK(!WaitForArrival(&seen, QUIET_MS));
+
+    // An exec is a start, and it's read out of /proc. This process is one that surely exists.
+    uint32_t self = getpid();
+    SendExec(fds[1], self, self);
+    CHECK(WaitForArrival(&seen, EVENT_TIMEOUT_MS));
+    CHECK(ProcessEventsNext(pe, &event));
+    CHECK(event.kind == PROCEVENT_START && event.process.pid == self && event.process.isIdentified);
+    CHECK(event.process.createTime != PROCESS_ANY_CREATE_TIME);
+    CHECK(IsName(&event, L"procevents_test"));
+    CHECK(event.process.fields[PROCFIELD_CMDLINE].str != NULL);
+    CHECK(!ProcessEventsNext(pe, &event));
+
+    // Once it was told of, what's read doesn't call back again.
+    CHECK(!WaitForArrival(&seen, QUIET_MS));
+
+    // Skipped: other kinds of events, the exec of a process that's gone by the time it's read, the exit of a thread, and a message cut short.
+    struct proc_event forked = { .what = PROC_EVENT_FORK };
+    forked.event_data.fork.parent_pid = forked.event_data.fork.parent_tgid = self;
+    forked.event_data.fork.child_pid = forked.event_data.fork.child_tgid = self + 1;
+    Send(fds[1], &forked, sizeof(forked));
+
+    SendExec(fds[1], GonePid(), 0);
+    SendExit(fds[1], self + 1, self);
+
+    struct proc_event exec = { .what = PROC_EVENT_EXEC };
+    exec.event_data.exec.process_pid = exec.event_data.exec.process_tgid = self;
+    Send(fds[1], &exec, sizeof(exec) / 2);
+
+    CHECK(WaitForArrival(&seen, EVENT_TIMEOUT_MS));
+    CHECK(!ProcessEventsNext(pe, &event));
+
+    // Those may have been told of one by one or all at once.
+    while (WaitForArrival(&seen, QUIET_MS));
+
+    // An exit doesn't say when the process started, it's gone. An arrival is told of even when what came before it wasn't read yet.
+    SendExit(fds[1], self, self);
+    CHECK(WaitForArrival(&seen, EVENT_TIMEOUT_MS));
+    SendExec(fds[1], self, self);
+    CHECK(WaitForArrival(&seen, EVENT_TIMEOUT_MS));
+
+    CHECK(ProcessEventsNext(pe, &event));
+    CHECK(event.kind == PROCEVENT_EXIT && event.process.pid == self && event.process.isIdentified);
+    CHECK(event.process.createTime == PROCESS_ANY_CREATE_TIME);
+    CHECK(ProcessEventsNext(pe, &event));
+    CHECK(event.kind == PROCEVENT_START && event.process.pid == self);
+    CHECK(!ProcessEventsNext(pe, &event));
+
+    CHECK(!ProcessEventsWereLost(pe));
+
+    ProcessEventsClose(pe);
+    close(fds[1]);
+}
+
+static void CheckKernel(ProcessEvents *pe)
+{
+    ProcessEvent event;
+    int seen = narrivals;
+    int stdinFd;
+
+    // Whatever happened on the system before this isn't what we're after.
+    while (ProcessEventsNext(pe, &event));
+
+    pid_t child = StartChild(&stdinFd);
+    CHECK(child > 0);
+
+    if (child <= 0)
+    {
+        return;
+    }
+
+    // It runs until its input is closed.
+    CHECK(WaitForEvent(pe, PROCEVENT_START, child, &event, &seen));
+    CHECK(IsName(&event, L"cat"));
+
+    close(stdinFd);
+    CHECK(waitpid(child, NULL, 0) == child);
+    CHECK(WaitForEvent(pe, PROCEVENT_EXIT, child, &event, &seen));
+    CHECK(event.process.createTime == PROCESS_ANY_CREATE_TIME);
+}
+
+// Sends the event the way the kernel does, after the netlink and connector headers. len can cut it short.
+static void Send(int sock, const struct proc_event *ev, size_t len)
+{
+    char buffer[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(*ev))] __attribute__((aligned(NLMSG_ALIGNTO))) = {0};
+    struct nlmsghdr *header = (struct nlmsghdr *)buffer;
+    struct cn_msg *msg = NLMSG_DATA(header);
+
+    header->nlmsg_len = NLMSG_LENGTH(sizeof(*msg) + len);
+    header->nlmsg_type = NLMSG_DONE;
+    msg->id.idx = CN_IDX_PROC;
+    msg->id.val = CN_VAL_PROC;
+    msg->len = len;
+    memcpy(msg->data, ev, len);
+
+    CHECK(send(sock, buffer, header->nlmsg_len, 0) == header->nlmsg_len);
+}
+
+static void SendExec(int sock, uint32_t pid, uint32_t tgid)
+{
+    struct proc_event ev = { .what = PROC_EVENT_EXEC };
+    ev.event_data.exec.process_pid = pid;
+    ev.event_data.exec.process_tgid = tgid == 0 ? pid : tgid;
+    Send(sock, &ev, sizeof(ev));
+}
+
+static void SendExit(int sock, uint32_t pid, uint32_t tgid)
+{
+    struct proc_event ev = { .what = PROC_EVENT_EXIT };
+    ev.event_data.exit.process_pid = pid;
+    ev.event_data.exit.process_tgid = tgid;
+    Send(sock, &ev, sizeof(ev));
+}
+
+// Starts cat reading from a pipe, so it stays running until the pipe is closed. Returns its PID, or -1 if it couldn't be started.
+static pid_t StartChild(int *stdinFd)
+{
+    int fds[2];
+
+    if (pipe(fds) != 0)
+    {
+        return -1;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        dup2(fds[0], STDIN_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execlp("cat", "cat", (char *)NULL);
+        _exit(127);
+    }
+
+    close(fds[0]);
+    *stdinFd = fds[1];
+    if (pid < 0) close(fds[1]);
+    return pid;
+}
+
+// Returns the PID of a child that has already been reaped, so there's nothing in /proc for it.
+static uint32_t GonePid()
+{
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        _exit(0);
+    }
+
+    CHECK(pid > 0 && waitpid(pid, NULL, 0) == pid);
+    return pid;
+}
+
+static void OnArrival(void *ctx)
+{
+    pthread_mutex_lock(&arrivalLock);
+    narrivals++;
+    pthread_cond_broadcast(&arrived);
+    pthread_mutex_unlock(&arrivalLock);
+}
+
+// Waits for an arrival after the ones already seen. Returns zero if none came in time.
+static char WaitForArrival(int *seen, int timeoutMs)
+{
+    struct timespec due;
+    clock_gettime(CLOCK_REALTIME, &due);
+    due.tv_sec += timeoutMs / 1000;
+    due.tv_nsec += (timeoutMs % 1000) * 1000000L;
+
+    if (due.tv_nsec >= 1000000000L)
+    {
+        due.tv_sec++;
+        due.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&arrivalLock);
+    while (narrivals == *seen && pthread_cond_timedwait(&arrived, &arrivalLock, &due) == 0);
+    char isArrived = narrivals != *seen;
+    *seen = narrivals;
+    pthread_mutex_unlock(&arrivalLock);
+    return isArrived;
+}
+
+// Reads events as they're told of until one of the kind comes for the process, skipping the rest of the system's. Returns zero if none came in time.
+static char WaitForEvent(ProcessEvents *pe, ProcessEventKind kind, uint32_t pid, ProcessEvent *event, int *seen)
+{
+    do
+    {
+        while (ProcessEventsNext(pe, event))
+        {
+            if (event->kind == kind && event->process.pid == pid) return 1;
+        }
+    } while (WaitForArrival(seen, EVENT_TIMEOUT_MS));
+
+    return 0;
+}
+
+static char IsName(const ProcessEvent *event, const wchar_t *name)
+{
+    WideSpan field = event->process.fields[PROCFIELD_NAME];
+    return field.str != NULL && field.len == wcslen(name) && wmemcmp(field.str, name, field.len) == 0;
+}
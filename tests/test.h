@@ -0,0 +1,78 @@
+#ifndef TEST_H
+#define TEST_H
+
+// Each test is a program of its own, built together with the modules it tests the same way the tools are, so it builds anywhere.
+// A test checks as much as it can, prints every check that failed, and exits with nonzero if any did.
+
+#include "defines.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>       // For GetDateTimeStaticStr.
+
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+#define CHECK(cond)                                                                     \
+    do {                                                                                \
+        if (!(cond))                                                                    \
+        {                                                                               \
+            ncheckFailures++;                                                           \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);    \
+        }                                                                               \
+    } while (0)
+
+// The tests are linked with the allocation functions wrapped, so they can tell how many allocations the code they call makes.
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+GlobalCb glbl = { .lock = PTHREAD_MUTEX_INITIALIZER, .loglock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+static int ncheckFailures = 0;
+static size_t nallocations = 0;
+
+void *__wrap_malloc(size_t size)
+{
+    nallocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    nallocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    nallocations++;
+    return __real_realloc(ptr, size);
+}
+
+// The modules log as they go, which the tests don't want to see.
+static void TestBegin()
+{
+    glbl.logfile = fopen(NULL_DEVICE, "w");
+}
+
+// Returns the test's exit code.
+static int TestEnd(const char *name)
+{
+    if (ncheckFailures > 0) printf("%s: %d checks failed\n", name, ncheckFailures);
+    else printf("%s: passed\n", name);
+
+    return ncheckFailures > 0;
+}
+
+char *GetDateTimeStaticStr()
+{
+    static char str[32];
+    time_t now = time(NULL);
+    strftime(str, sizeof(str), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    return str;
+}
+
+#endif
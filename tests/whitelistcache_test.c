@@ -0,0 +1,273 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Checks that a whitelist loaded from its cache matches the same as the one that was saved, and that every cache which can't be
+// trusted is turned down so the whitelist is compiled from the file instead: of another file, of another version, cut short, damaged,
+// or with matchers that don't fit their groups even though the checksum is right.
+
+#include "test.h"
+#include "whitelistcache.h"
+#include <stdlib.h>     // For malloc.
+#include <string.h>     // For memcpy.
+
+#define SOURCE_HASH 0x1234abcdull
+
+// The header is the magic, the version and the sizes of wchar_t and pointers, then four uint64_t.
+#define CACHE_HEADER_SIZE (4 * sizeof(uint32_t) + 4 * sizeof(uint64_t))
+
+typedef struct
+{
+    ProcessField field;
+    MatchKind kind;
+    char list;
+    const wchar_t *value;
+} Entry;
+
+// Enough substrings for an automaton, and some of every other kind.
+static const Entry entries[] = {
+    { PROCFIELD_NAME, MATCHKIND_EXACT, LIST_WHITELIST, L"game.exe" },
+    { PROCFIELD_NAME, MATCHKIND_EXACT, LIST_EXCLUSIVE, L"editor.exe" },
+    { PROCFIELD_NAME, MATCHKIND_GLOB, LIST_WHITELIST, L"*shooter*.exe" },
+    { PROCFIELD_NAME, MATCHKIND_GLOB, LIST_WHITELIST, L"rpg?.exe" },
+    { PROCFIELD_NAME, MATCHKIND_REGEX, LIST_WHITELIST, L"^sim[0-9]+\\.exe$" },
+    { PROCFIELD_CMDLINE, MATCHKIND_SUBSTRING, LIST_WHITELIST, L"--mode=0" },
+    { PROCFIELD_CMDLINE, MATCHKIND_SUBSTRING, LIST_WHITELIST, L"--mode=1" },
+    { PROCFIELD_CMDLINE, MATCHKIND_SUBSTRING, LIST_WHITELIST, L"--mode=2" },
+    { PROCFIELD_CMDLINE, MATCHKIND_SUBSTRING, LIST_WHITELIST, L"--mode=3" },
+    { PROCFIELD_CMDLINE, MATCHKIND_SUBSTRING, LIST_WHITELIST, L"--mode=4" },
+    { PROCFIELD_CMDLINE, MATCHKIND_SUBSTRING, LIST_WHITELIST, L"--mode=5" },
+    { PROCFIELD_CMDLINE, MATCHKIND_SUBSTRING, LIST_WHITELIST, L"--mode=6" },
+    { PROCFIELD_CMDLINE, MATCHKIND_SUBSTRING, LIST_EXCLUSIVE, L"--record" },
+};
+
+// A name and command line of a process each, with the lists they match.
+static const struct { const wchar_t *name; const wchar_t *cmdline; char lists; } processes[] = {
+    { L"game.exe", L"game.exe", LIST_WHITELIST },
+    { L"editor.exe", L"", LIST_EXCLUSIVE },
+    { L"spaceshooter2.exe", NULL, LIST_WHITELIST },
+    { L"rpg7.exe", NULL, LIST_WHITELIST },
+    { L"rpg77.exe", NULL, 0 },
+    { L"sim2024.exe", NULL, LIST_WHITELIST },
+    { L"launcher.exe", L"launcher.exe --mode=5 --record", LIST_WHITELIST | LIST_EXCLUSIVE },
+    { L"notepad.exe", L"notepad.exe --mode=9", 0 },
+};
+
+#define NENTRIES (sizeof(entries) / sizeof(*entries))
+#define NPROCESSES (sizeof(processes) / sizeof(*processes))
+
+static CompiledWhitelist *Compile();
+static void *Save(const CompiledWhitelist *cw, size_t *size);
+static void CheckMatches(const CompiledWhitelist *cw);
+static void CheckRejected(int line, const void *data, size_t size);
+
+int main()
+{
+    size_t size;
+
+    TestBegin();
+
+    CompiledWhitelist *cw = Compile();
+    CHECK(cw != NULL);
+
+    if (cw == NULL)
+    {
+        return TestEnd("whitelistcache");
+    }
+
+    CheckMatches(cw);
+
+    // Saved and loaded back, it matches the same, once its regexes are built again.
+    char *data = Save(cw, &size);
+    CompiledWhitelist *loaded = WhitelistCacheLoad(data, size, SOURCE_HASH);
+    CHECK(loaded != NULL);
+
+    if (loaded != NULL)
+    {
+        CHECK(loaded->nentries == cw->nentries && loaded->isExclusiveExists == cw->isExclusiveExists);
+        CHECK(loaded->groups[PROCFIELD_CMDLINE][MATCHKIND_SUBSTRING].automaton != NULL);
+        CHECK(loaded->groups[PROCFIELD_NAME][MATCHKIND_EXACT].table != NULL);
+        CHECK(!loaded->groups[PROCFIELD_NAME][MATCHKIND_REGEX].isBuilt);
+        CHECK(WhitelistBuildMatchers(loaded));
+        CheckMatches(loaded);
+        WhitelistFree(loaded);
+    }
+
+    // The cache of an older whitelist file.
+    CHECK(WhitelistCacheLoad(data, size, SOURCE_HASH + 1) == NULL);
+
+    // Of another version. It comes right after the magic.
+    char *copy = malloc(size);
+    memcpy(copy, data, size);
+    ((uint32_t *)copy)[1]++;
+    CheckRejected(__LINE__, copy, size);
+
+    // Cut short anywhere.
+    for (size_t cut = 0; cut < size; cut++)
+    {
+        CHECK(WhitelistCacheLoad(data, cut, SOURCE_HASH) == NULL);
+    }
+
+    // Any byte of the payload damaged.
+    for (size_t i = CACHE_HEADER_SIZE; i < size; i++)
+    {
+        memcpy(copy, data, size);
+        copy[i] ^= 0x10;
+        CHECK(WhitelistCacheLoad(copy, size, SOURCE_HASH) == NULL);
+    }
+
+    free(copy);
+    free(data);
+
+    // The rest are saved wrong on purpose, so the checksum is right. A glob group is matched with its wildcard set, so it can't do without.
+    WhitelistGroup *globs = &cw->groups[PROCFIELD_NAME][MATCHKIND_GLOB];
+    WildcardSet *wildcards = globs->wildcards;
+    globs->wildcards = NULL;
+    data = Save(cw, &size);
+    CheckRejected(__LINE__, data, size);
+    free(data);
+
+    // Nor with a set of fewer patterns than it has entries.
+    globs->wildcards = WildcardSetBuild((const wchar_t *[]){ L"*" }, (size_t[]){ 1 }, 1);
+    data = Save(cw, &size);
+    CheckRejected(__LINE__, data, size);
+    free(data);
+    WildcardSetFree(globs->wildcards);
+    globs->wildcards = wildcards;
+
+    // Tables and automatons are optional, but they have to be of as many patterns as the group has entries.
+    WhitelistGroup *exacts = &cw->groups[PROCFIELD_NAME][MATCHKIND_EXACT];
+    ExactTable *table = exacts->table;
+    exacts->table = ExactTableBuild((const wchar_t *[]){ L"game.exe" }, (size_t[]){ 8 }, NULL, 1);
+    data = Save(cw, &size);
+    CheckRejected(__LINE__, data, size);
+    free(data);
+    ExactTableFree(exacts->table);
+
+    exacts->table = NULL;
+    data = Save(cw, &size);
+    loaded = WhitelistCacheLoad(data, size, SOURCE_HASH);
+    CHECK(loaded != NULL);
+    CHECK(loaded == NULL || WhitelistBuildMatchers(loaded));
+    if (loaded != NULL) CheckMatches(loaded);
+    WhitelistFree(loaded);
+    free(data);
+    exacts->table = table;
+
+    // And of the group's kind.
+    WhitelistGroup *substrings = &cw->groups[PROCFIELD_CMDLINE][MATCHKIND_SUBSTRING];
+    WhitelistGroup *cmdlineExacts = &cw->groups[PROCFIELD_CMDLINE][MATCHKIND_EXACT];
+    cmdlineExacts->automaton = substrings->automaton;
+    data = Save(cw, &size);
+    CheckRejected(__LINE__, data, size);
+    free(data);
+    cmdlineExacts->automaton = NULL;
+
+    WhitelistFree(cw);
+    return TestEnd("whitelistcache");
+}
+
+static CompiledWhitelist *Compile()
+{
+    size_t counts[PROCFIELD_NUMOF][MATCHKIND_NUMOF];
+    size_t nchars = 0;
+
+    memset(counts, 0, sizeof(counts));
+
+    for (size_t i = 0; i < NENTRIES; i++)
+    {
+        counts[entries[i].field][entries[i].kind]++;
+        nchars += wcslen(entries[i].value);
+    }
+
+    CompiledWhitelist *cw = WhitelistAlloc(counts, nchars);
+
+    if (cw == NULL)
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < NENTRIES; i++)
+    {
+        WhitelistAddEntry(cw, entries[i].field, entries[i].kind, entries[i].list, i + 1, entries[i].value, wcslen(entries[i].value));
+    }
+
+    if (!WhitelistBuildMatchers(cw))
+    {
+        WhitelistFree(cw);
+        return NULL;
+    }
+
+    return cw;
+}
+
+// Returns the cache of the whitelist as it would be read from the file.
+static void *Save(const CompiledWhitelist *cw, size_t *size)
+{
+    FILE *file = tmpfile();
+    char *data = NULL;
+
+    *size = 0;
+    CHECK(file != NULL);
+
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    CHECK(WhitelistCacheSave(cw, SOURCE_HASH, file));
+
+    if (fseek(file, 0, SEEK_END) == 0)
+    {
+        *size = ftell(file);
+    }
+
+    rewind(file);
+    CHECK(*size > 0 && (data = malloc(*size)) != NULL && fread(data, *size, 1, file) == 1);
+    fclose(file);
+    return data;
+}
+
+static void CheckMatches(const CompiledWhitelist *cw)
+{
+    for (size_t i = 0; i < NPROCESSES; i++)
+    {
+        WideSpan fields[PROCFIELD_NUMOF] = {
+            { processes[i].name, wcslen(processes[i].name) },
+            { processes[i].cmdline, processes[i].cmdline == NULL ? 0 : wcslen(processes[i].cmdline) },
+        };
+
+        char lists = WhitelistMatch(cw, fields, LIST_WHITELIST | LIST_EXCLUSIVE);
+
+        if (lists != processes[i].lists)
+        {
+            ncheckFailures++;
+            fprintf(stderr, "%s: %ls matched lists %d instead of %d\n", __FILE__, processes[i].name, lists, processes[i].lists);
+        }
+    }
+}
+
+// Checks that the cache isn't loaded. Takes the line of the check, since they all fail here.
+static void CheckRejected(int line, const void *data, size_t size)
+{
+    CompiledWhitelist *cw = WhitelistCacheLoad(data, size, SOURCE_HASH);
+
+    if (cw != NULL)
+    {
+        ncheckFailures++;
+        fprintf(stderr, "%s:%d: the cache was loaded.\n", __FILE__, line);
+        WhitelistFree(cw);
+    }
+}
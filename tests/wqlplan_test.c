@@ -0,0 +1,164 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Checks the queries WqlPlanQuery builds: how entries are put as LIKE terms, and when the processes can't be filtered by name at all.
+// A wrong term either lets through processes that can't match, which only costs time, or filters out ones that can, which breaks matching.
+
+#include "test.h"
+#include "wqlplan.h"
+#include <stdlib.h>     // For free.
+#include <string.h>     // For memset.
+
+#define SELECT_NAMES L"SELECT Name,ProcessId,CreationDate FROM Win32_Process"
+#define SELECT_NO_NAMES L"SELECT ProcessId,CreationDate FROM Win32_Process"
+
+#define MAX_ENTRIES (WQLPLAN_MAX_FILTER_ENTRIES + 1)
+
+typedef struct
+{
+    ProcessField field;
+    MatchKind kind;
+    const wchar_t *value;
+} Entry;
+
+static void CheckQuery(int line, const Entry *entries, size_t nentries, const wchar_t *expected);
+static void CheckNameEntries(int line, size_t nentries, const wchar_t *expectedStart);
+static wchar_t *PlanQuery(const Entry *entries, size_t nentries);
+
+int main()
+{
+    TestBegin();
+
+    // Without entries on the name there's nothing to select it for, let alone filter by it.
+    CheckQuery(__LINE__, NULL, 0, SELECT_NO_NAMES);
+    CheckQuery(__LINE__, (Entry[]){ { PROCFIELD_CMDLINE, MATCHKIND_SUBSTRING, L"game.exe" } }, 1, SELECT_NO_NAMES);
+
+    // Exact names allow for leading whitespace, but not trailing, and substrings allow for anything on either side.
+    CheckQuery(__LINE__, (Entry[]){ { PROCFIELD_NAME, MATCHKIND_EXACT, L"game.exe" } }, 1, SELECT_NAMES L" WHERE Name LIKE '%game.exe'");
+    CheckQuery(__LINE__, (Entry[]){ { PROCFIELD_NAME, MATCHKIND_SUBSTRING, L"game" } }, 1, SELECT_NAMES L" WHERE Name LIKE '%game%'");
+
+    // LIKE's special characters are matched literally by putting them in a set, in every kind of entry.
+    CheckQuery(__LINE__, (Entry[]){ { PROCFIELD_NAME, MATCHKIND_EXACT, L"a%b_c[d].exe" } }, 1,
+        SELECT_NAMES L" WHERE Name LIKE '%a[%]b[_]c[[]d].exe'");
+    CheckQuery(__LINE__, (Entry[]){ { PROCFIELD_NAME, MATCHKIND_SUBSTRING, L"100%" } }, 1, SELECT_NAMES L" WHERE Name LIKE '%100[%]%'");
+    CheckQuery(__LINE__, (Entry[]){ { PROCFIELD_NAME, MATCHKIND_GLOB, L"_*" } }, 1, SELECT_NAMES L" WHERE Name LIKE '%[_]%'");
+
+    // The string's special characters are escaped with a backslash.
+    CheckQuery(__LINE__, (Entry[]){ { PROCFIELD_NAME, MATCHKIND_EXACT, L"it's\\here.exe" } }, 1,
+        SELECT_NAMES L" WHERE Name LIKE '%it\\'s\\\\here.exe'");
+
+    // Glob wildcards become LIKE's. A glob that starts with * already allows for leading whitespace, so it doesn't get another %.
+    CheckQuery(__LINE__, (Entry[]){ { PROCFIELD_NAME, MATCHKIND_GLOB, L"game?.*" } }, 1, SELECT_NAMES L" WHERE Name LIKE '%game_.%'");
+    CheckQuery(__LINE__, (Entry[]){ { PROCFIELD_NAME, MATCHKIND_GLOB, L"*.exe" } }, 1, SELECT_NAMES L" WHERE Name LIKE '%.exe'");
+    CheckQuery(__LINE__, (Entry[]){ { PROCFIELD_NAME, MATCHKIND_GLOB, L"?ame.exe" } }, 1, SELECT_NAMES L" WHERE Name LIKE '%_ame.exe'");
+
+    // Wildcards only mean something in globs.
+    CheckQuery(__LINE__, (Entry[]){ { PROCFIELD_NAME, MATCHKIND_EXACT, L"*?.exe" } }, 1, SELECT_NAMES L" WHERE Name LIKE '%*?.exe'");
+
+    // The terms are joined in the order of the groups, not of the entries.
+    CheckQuery(__LINE__, (Entry[]){
+            { PROCFIELD_NAME, MATCHKIND_GLOB, L"g*" },
+            { PROCFIELD_NAME, MATCHKIND_SUBSTRING, L"s" },
+            { PROCFIELD_NAME, MATCHKIND_EXACT, L"e" },
+        }, 3, SELECT_NAMES L" WHERE Name LIKE '%e' OR Name LIKE '%s%' OR Name LIKE '%g%'");
+
+    // A process whose name matches no entry can still match by its command line, or by a regex, which can't be put as a LIKE.
+    CheckQuery(__LINE__, (Entry[]){
+            { PROCFIELD_NAME, MATCHKIND_EXACT, L"game.exe" },
+            { PROCFIELD_CMDLINE, MATCHKIND_SUBSTRING, L"--fullscreen" },
+        }, 2, SELECT_NAMES);
+    CheckQuery(__LINE__, (Entry[]){
+            { PROCFIELD_NAME, MATCHKIND_EXACT, L"game.exe" },
+            { PROCFIELD_NAME, MATCHKIND_REGEX, L"^game[0-9]+\\.exe$" },
+        }, 2, SELECT_NAMES);
+
+    // Past the cutoff, filtering costs WMI more than it saves us.
+    CheckNameEntries(__LINE__, WQLPLAN_MAX_FILTER_ENTRIES, SELECT_NAMES L" WHERE Name LIKE '%game0.exe' OR ");
+    CheckNameEntries(__LINE__, WQLPLAN_MAX_FILTER_ENTRIES + 1, SELECT_NAMES);
+
+    return TestEnd("wqlplan");
+}
+
+// Checks the query planned for a whitelist of the entries. Takes the line of the check, since they all fail here.
+static void CheckQuery(int line, const Entry *entries, size_t nentries, const wchar_t *expected)
+{
+    wchar_t *query = PlanQuery(entries, nentries);
+    CHECK(query != NULL);
+
+    if (query != NULL && wcscmp(query, expected) != 0)
+    {
+        ncheckFailures++;
+        fprintf(stderr, "%s:%d: wrong query.\n\texpected: %ls\n\tgot:      %ls\n", __FILE__, line, expected, query);
+    }
+
+    free(query);
+}
+
+// Checks that a whitelist of that many exact names is planned as a query that starts as expected, and filters only if that does.
+static void CheckNameEntries(int line, size_t nentries, const wchar_t *expectedStart)
+{
+    static wchar_t values[MAX_ENTRIES][16];
+    Entry entries[MAX_ENTRIES];
+
+    for (size_t i = 0; i < nentries; i++)
+    {
+        swprintf(values[i], _countof(values[i]), L"game%lld.exe", (long long)i);
+        entries[i] = (Entry){ PROCFIELD_NAME, MATCHKIND_EXACT, values[i] };
+    }
+
+    wchar_t *query = PlanQuery(entries, nentries);
+    CHECK(query != NULL);
+
+    if (query != NULL && (wcsncmp(query, expectedStart, wcslen(expectedStart)) != 0 ||
+        (wcsstr(query, L" WHERE ") != NULL) != (wcsstr(expectedStart, L" WHERE ") != NULL)))
+    {
+        ncheckFailures++;
+        fprintf(stderr, "%s:%d: wrong query for %lld entries.\n\texpected: %ls...\n\tgot:      %ls\n", __FILE__, line, (long long)nentries, expectedStart, query);
+    }
+
+    free(query);
+}
+
+// Returns the query planned for a whitelist of the entries, or NULL if memory ran out.
+static wchar_t *PlanQuery(const Entry *entries, size_t nentries)
+{
+    size_t counts[PROCFIELD_NUMOF][MATCHKIND_NUMOF];
+    size_t nchars = 0;
+
+    memset(counts, 0, sizeof(counts));
+
+    for (size_t i = 0; i < nentries; i++)
+    {
+        counts[entries[i].field][entries[i].kind]++;
+        nchars += wcslen(entries[i].value);
+    }
+
+    CompiledWhitelist *cw = WhitelistAlloc(counts, nchars);
+
+    if (cw == NULL)
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < nentries; i++)
+    {
+        WhitelistAddEntry(cw, entries[i].field, entries[i].kind, LIST_WHITELIST, i + 1, entries[i].value, wcslen(entries[i].value));
+    }
+
+    wchar_t *query = WqlPlanQuery(cw);
+    WhitelistFree(cw);
+    return query;
+}
@@ -0,0 +1,497 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Runs the fixer's decider against a fake Shadowplay, fake processes and a fake user, on a virtual clock, without anything Windows.
+// Prints how often it woke up, how often it toggled, and how long Instant Replay was left in the wrong state.
+//
+// Usage: decidesim [-v] [-n cycles] [-s seed] [-m max interval] [scenario]
+//   -v               Print every cycle that does something, and every event.
+//   -n cycles        How many cycles to run a random scenario for (default 10000000).
+//   -s seed          Seed for the random scenario (default 1).
+//   -m max interval  The longest the poll interval backs off to, in seconds (default 40).
+//
+// The scenario has one event per line: the second it happens at, then what happens. Lines starting with # are comments.
+//   replay on|off        Someone else turns Instant Replay on or off.
+//   whitelisted on|off   A whitelisted process starts or exits.
+//   exclusive on|off     An exclusive process starts or exits.
+//   exclusives on|off    The whitelist is edited to have an exclusives list or not.
+//   fight on|off|none    Another program starts keeping Instant Replay on or off, or stops.
+//   disable|enable       The user disables or enables AlwaysShadow from the tray.
+//   refresh              The user refreshes from the tray.
+//   expect on|off        Instant Replay should be on or off by now. If it isn't the simulation fails.
+//   end                  The simulation ends. Otherwise it runs for 10 minutes after the last event.
+// Without a scenario, events are made up at random. A scenario's output is the same every time, make test compares it with what's expected.
+
+#include "decider.h"
+#include <stdio.h>
+#include <stdlib.h>     // For malloc.
+#include <string.h>     // For strcmp.
+#include <time.h>       // For timing.
+
+#define MIN_INTERVAL_SEC 5
+#define DEFAULT_MAX_INTERVAL_SEC 40
+#define CONFLICT_BACKOFF_SEC 800
+
+// How long Shadowplay takes to act on a toggle, and how long the other program takes to undo it.
+#define TOGGLE_LATENCY_MS 1500
+#define FIGHT_LATENCY_MS 2000
+
+// How long after the last event a scenario keeps running, and how far apart random events are on average.
+#define SCENARIO_TAIL_MS (10 * 60 * 1000)
+#define RANDOM_EVENT_MEAN_MS (5 * 60 * 1000)
+
+#define NO_TIME UINT64_MAX
+
+typedef enum
+{
+    EVENT_REPLAY,
+    EVENT_WHITELISTED,
+    EVENT_EXCLUSIVE,
+    EVENT_EXCLUSIVES,
+    EVENT_FIGHT,
+    EVENT_DISABLE,
+    EVENT_ENABLE,
+    EVENT_REFRESH,
+    EVENT_EXPECT,
+    EVENT_END,
+    EVENT_NUMOF,
+} EventType;
+
+static const char *eventNames[EVENT_NUMOF] = { "replay", "whitelisted", "exclusive", "exclusives", "fight", "disable", "enable", "refresh", "expect", "end" };
+
+typedef struct
+{
+    uint64_t timeMs;
+    EventType type;
+    int arg; // 1 for on, 0 for off, -1 for none.
+} Event;
+
+// Everything the fixer would otherwise get from Windows, and everything the user does.
+typedef struct
+{
+    uint64_t nowMs;
+
+    // Shadowplay, whose state is what the registry says.
+    char isOn;
+    uint64_t toggleAtMs; // When the toggle it was asked for goes through.
+
+    // Another program that keeps Instant Replay at fightState, if it's not -1.
+    int fightState;
+    uint64_t fightAtMs;
+
+    // The processes and the whitelist.
+    char isWhitelistedRunning;
+    char isExclusiveRunning;
+    char isExclusiveExists;
+
+    // The tray.
+    char isDisabled;
+    char isWakeRequested;
+    char isRefreshRequested;
+    char isReloadPending; // The whitelist changed and the file watch hasn't told the fixer yet.
+
+    // The scenario, or NULL for a random one.
+    Event *events;
+    size_t nevents;
+    size_t nextEvent;
+    Event randomEvent;
+    uint64_t rng;
+    uint64_t endMs;
+
+    // What came of it.
+    uint64_t wrongMs;        // How long Instant Replay was in the wrong state.
+    uint64_t accountedMs;    // Up to when wrongMs was counted.
+    size_t nexpected;
+    size_t nfailed;
+    char isVerbose;
+} World;
+
+static Event *ReadScenario(const char *filename, size_t *nevents, uint64_t *endMs);
+static char ParseEvent(const char *line, Event *event);
+static const Event *PeekEvent(World *world);
+static void PopEvent(World *world);
+static uint64_t Random(World *world);
+static char AdvanceWorld(World *world, uint64_t untilMs);
+static void ApplyEvent(World *world, const Event *event);
+static void SetInstantReplay(World *world, char isOn);
+static void AccountWrongState(World *world);
+static double ElapsedMs(const struct timespec *start);
+
+int main(int argc, char **argv)
+{
+    uint64_t maxCycles = 10000000;
+    uint64_t seed = 1;
+    uint32_t maxIntervalSec = DEFAULT_MAX_INTERVAL_SEC;
+    char isVerbose = 0;
+    int argi = 1;
+
+    for (; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        if (strcmp(argv[argi], "-v") == 0) isVerbose = 1;
+        else if (strcmp(argv[argi], "-n") == 0 && argi + 1 < argc) maxCycles = strtoull(argv[++argi], NULL, 10);
+        else if (strcmp(argv[argi], "-s") == 0 && argi + 1 < argc) seed = strtoull(argv[++argi], NULL, 10);
+        else if (strcmp(argv[argi], "-m") == 0 && argi + 1 < argc && (maxIntervalSec = atoi(argv[++argi])) > 0) continue;
+        else break;
+    }
+
+    if (argc - argi > 1 || (argi < argc && argv[argi][0] == '-'))
+    {
+        fprintf(stderr, "Usage: %s [-v] [-n cycles] [-s seed] [-m max interval] [scenario]\n", argv[0]);
+        return 2;
+    }
+
+    World world = {0};
+    world.isOn = 1;
+    world.toggleAtMs = NO_TIME;
+    world.fightState = -1;
+    world.fightAtMs = NO_TIME;
+    world.rng = seed * 0x9E3779B97F4A7C15ull | 1;
+    world.endMs = NO_TIME;
+    world.isVerbose = isVerbose;
+
+    if (argi < argc)
+    {
+        if ((world.events = ReadScenario(argv[argi], &world.nevents, &world.endMs)) == NULL) return 2;
+        maxCycles = UINT64_MAX;
+    }
+
+    Decider decider;
+    DeciderInit(&decider, MIN_INTERVAL_SEC, maxIntervalSec, CONFLICT_BACKOFF_SEC);
+
+    uint64_t ncycles = 0, ntoggles = 0, nconflicts = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Same as FixerLoop, except the waits and everything the decider is told come from the world.
+    for (uint32_t intervalSec = MIN_INTERVAL_SEC; ncycles < maxCycles && world.nowMs < world.endMs; ncycles++)
+    {
+        DeciderInputs inputs = {0};
+        inputs.isWoken = AdvanceWorld(&world, world.nowMs + intervalSec * 1000ull);
+        world.isWakeRequested = 0;
+
+        inputs.nowMs = world.nowMs;
+        inputs.isDisabled = world.isDisabled;
+        inputs.isReloaded = world.isRefreshRequested || world.isReloadPending;
+        inputs.isExclusiveExists = world.isExclusiveExists;
+        world.isRefreshRequested = 0;
+        world.isReloadPending = 0;
+
+        if (DeciderIsObserving(&decider, &inputs))
+        {
+            inputs.isInstantReplayOn = world.isOn;
+            inputs.isPolled = 1;
+            inputs.isWhitelistedRunning = world.isWhitelistedRunning;
+            inputs.isExclusiveRunning = world.isExclusiveRunning;
+        }
+
+        DeciderActions actions = DeciderStep(&decider, &inputs);
+        intervalSec = actions.intervalSec;
+        nconflicts += actions.isConflictEntered;
+
+        if (actions.isToggling)
+        {
+            // A toggle that's still on its way is acted on twice, just like Shadowplay would.
+            ntoggles++;
+            if (world.toggleAtMs == NO_TIME) world.toggleAtMs = world.nowMs + TOGGLE_LATENCY_MS;
+        }
+
+        if (world.isVerbose && (actions.isToggling || actions.isConflictEntered || actions.isConflictRetried))
+        {
+            printf("%10.1f  %s%s%s(replay %s, next cycle in %us)\n", world.nowMs / 1000.0, actions.isToggling ? "toggle " : "",
+                actions.isConflictEntered ? "conflict " : "", actions.isConflictRetried ? "retry " : "", world.isOn ? "on" : "off", intervalSec);
+        }
+    }
+
+    double runMs = ElapsedMs(&start);
+    AccountWrongState(&world);
+
+    double hours = world.nowMs / 3600000.0;
+    printf("simulated: %.1f hours, cycles: %llu (%.1f wakeups per hour)\n", hours, (unsigned long long)ncycles, hours == 0 ? 0 : ncycles / hours);
+    printf("toggles: %llu, conflicts: %llu\n", (unsigned long long)ntoggles, (unsigned long long)nconflicts);
+    printf("wrong state: %.1f s (%.3f%% of the time)\n", world.wrongMs / 1000.0, world.nowMs == 0 ? 0 : 100.0 * world.wrongMs / world.nowMs);
+
+    // Scenarios print the same every time, so their output can be compared with what's expected. How fast they ran would spoil that.
+    if (world.events == NULL) printf("speed: %.0f cycles per second\n", runMs == 0 ? 0 : ncycles * 1000.0 / runMs);
+
+    if (world.nexpected > 0)
+    {
+        printf("expectations: %lld passed, %lld failed\n", (long long)(world.nexpected - world.nfailed), (long long)world.nfailed);
+    }
+
+    free(world.events);
+    return world.nfailed > 0;
+}
+
+// Reads the events of a scenario file in the order they happen. Returns NULL (after printing why) if it can't be read.
+static Event *ReadScenario(const char *filename, size_t *nevents, uint64_t *endMs)
+{
+    FILE *file = fopen(filename, "r");
+    size_t capacity = 16;
+    Event *events = malloc(capacity * sizeof(*events));
+    char line[256];
+    int lineno = 0;
+
+    if (file == NULL || events == NULL)
+    {
+        perror(filename);
+        goto error;
+    }
+
+    *nevents = 0;
+    *endMs = NO_TIME;
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        Event event;
+        lineno++;
+
+        char *content = line + strspn(line, " \t");
+        if (*content == '#' || strspn(content, " \t\r\n") == strlen(content)) continue;
+
+        if (!ParseEvent(content, &event))
+        {
+            fprintf(stderr, "%s:%d: Can't make out the event.\n", filename, lineno);
+            goto error;
+        }
+
+        if (*nevents > 0 && event.timeMs < events[*nevents - 1].timeMs)
+        {
+            fprintf(stderr, "%s:%d: Events have to be in the order they happen.\n", filename, lineno);
+            goto error;
+        }
+
+        if (event.type == EVENT_END)
+        {
+            *endMs = event.timeMs;
+            break;
+        }
+
+        if (*nevents == capacity)
+        {
+            capacity *= 2;
+            Event *grown = realloc(events, capacity * sizeof(*events));
+            if (grown == NULL) goto error;
+            events = grown;
+        }
+
+        events[(*nevents)++] = event;
+    }
+
+    if (*endMs == NO_TIME) *endMs = (*nevents > 0 ? events[*nevents - 1].timeMs : 0) + SCENARIO_TAIL_MS;
+    fclose(file);
+    return events;
+
+error:
+    if (file != NULL) fclose(file);
+    free(events);
+    return NULL;
+}
+
+static char ParseEvent(const char *line, Event *event)
+{
+    double sec;
+    char name[32], arg[32];
+    int nfields = sscanf(line, "%lf %31s %31s", &sec, name, arg);
+
+    if (nfields < 2 || sec < 0) return 0;
+
+    event->timeMs = (uint64_t)(sec * 1000);
+    event->arg = -1;
+
+    for (event->type = 0; event->type < EVENT_NUMOF && strcmp(name, eventNames[event->type]) != 0; event->type++);
+
+    if (event->type == EVENT_NUMOF) return 0;
+
+    // These are the only ones without an argument.
+    if (event->type == EVENT_DISABLE || event->type == EVENT_ENABLE || event->type == EVENT_REFRESH || event->type == EVENT_END)
+    {
+        return nfields == 2;
+    }
+
+    if (nfields != 3) return 0;
+    if (strcmp(arg, "on") == 0) event->arg = 1;
+    else if (strcmp(arg, "off") == 0) event->arg = 0;
+    else if (strcmp(arg, "none") != 0 || event->type != EVENT_FIGHT) return 0;
+
+    return 1;
+}
+
+// The next event of the scenario, or NULL if there are no more. Random scenarios never run out.
+static const Event *PeekEvent(World *world)
+{
+    if (world->events != NULL)
+    {
+        return world->nextEvent < world->nevents ? &world->events[world->nextEvent] : NULL;
+    }
+
+    if (world->randomEvent.timeMs <= world->nowMs)
+    {
+        // Processes come and go the most, and the user and other programs hardly ever get involved.
+        static const EventType weighted[] = { EVENT_WHITELISTED, EVENT_WHITELISTED, EVENT_EXCLUSIVE, EVENT_EXCLUSIVE, EVENT_EXCLUSIVE,
+            EVENT_REPLAY, EVENT_EXCLUSIVES, EVENT_FIGHT, EVENT_DISABLE, EVENT_ENABLE, EVENT_REFRESH };
+
+        world->randomEvent.timeMs = world->nowMs + 1 + Random(world) % (2 * RANDOM_EVENT_MEAN_MS);
+        world->randomEvent.type = weighted[Random(world) % (sizeof(weighted) / sizeof(*weighted))];
+        world->randomEvent.arg = (int)(Random(world) % 3) - (world->randomEvent.type == EVENT_FIGHT);
+        if (world->randomEvent.arg > 1) world->randomEvent.arg = 1;
+    }
+
+    return &world->randomEvent;
+}
+
+static void PopEvent(World *world)
+{
+    if (world->events != NULL) world->nextEvent++;
+}
+
+// xorshift64*, so a seed always makes the same scenario.
+static uint64_t Random(World *world)
+{
+    world->rng ^= world->rng >> 12;
+    world->rng ^= world->rng << 25;
+    world->rng ^= world->rng >> 27;
+    return world->rng * 0x2545F4914F6CDD1Dull;
+}
+
+// Runs the world up to untilMs, or until the main thread would wake the fixer up. Returns whether it did.
+static char AdvanceWorld(World *world, uint64_t untilMs)
+{
+    if (untilMs > world->endMs) untilMs = world->endMs;
+
+    while (!world->isWakeRequested)
+    {
+        const Event *event = PeekEvent(world);
+        uint64_t eventMs = event != NULL ? event->timeMs : NO_TIME;
+        uint64_t nextMs = untilMs;
+
+        if (world->toggleAtMs < nextMs) nextMs = world->toggleAtMs;
+        if (world->fightAtMs < nextMs) nextMs = world->fightAtMs;
+        if (eventMs < nextMs) nextMs = eventMs;
+
+        world->nowMs = nextMs;
+        AccountWrongState(world);
+
+        if (nextMs == world->toggleAtMs)
+        {
+            world->toggleAtMs = NO_TIME;
+            SetInstantReplay(world, !world->isOn);
+        }
+        else if (nextMs == world->fightAtMs)
+        {
+            world->fightAtMs = NO_TIME;
+            if (world->fightState >= 0) SetInstantReplay(world, world->fightState);
+        }
+        else if (nextMs == eventMs)
+        {
+            Event copy = *event;
+            PopEvent(world);
+            ApplyEvent(world, &copy);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return world->isWakeRequested;
+}
+
+static void ApplyEvent(World *world, const Event *event)
+{
+    if (world->isVerbose && event->type != EVENT_EXPECT)
+    {
+        printf("%10.1f  event: %s%s\n", world->nowMs / 1000.0, eventNames[event->type],
+            event->type >= EVENT_DISABLE ? "" : event->arg == 1 ? " on" : event->arg == 0 ? " off" : " none");
+    }
+
+    switch (event->type)
+    {
+    case EVENT_REPLAY:
+        SetInstantReplay(world, event->arg);
+        break;
+    case EVENT_WHITELISTED:
+        world->isWhitelistedRunning = event->arg;
+        break;
+    case EVENT_EXCLUSIVE:
+        world->isExclusiveRunning = event->arg;
+        break;
+    case EVENT_EXCLUSIVES:
+        world->isExclusiveExists = event->arg;
+        world->isReloadPending = 1;
+        break;
+    case EVENT_FIGHT:
+        world->fightState = event->arg;
+        SetInstantReplay(world, world->isOn);
+        break;
+    case EVENT_DISABLE:
+    case EVENT_ENABLE:
+        world->isDisabled = event->type == EVENT_DISABLE;
+        world->isWakeRequested = 1;
+        break;
+    case EVENT_REFRESH:
+        world->isRefreshRequested = 1;
+        world->isWakeRequested = 1;
+        break;
+    case EVENT_EXPECT:
+        world->nexpected++;
+
+        if (world->isOn != event->arg)
+        {
+            world->nfailed++;
+            printf("%10.1f  FAILED: expected Instant Replay to be %s\n", world->nowMs / 1000.0, event->arg ? "on" : "off");
+        }
+
+        break;
+    default:
+        break;
+    }
+}
+
+// Whoever sets Instant Replay, the other program sets it back after a while if it's fighting.
+static void SetInstantReplay(World *world, char isOn)
+{
+    world->isOn = isOn;
+
+    if (world->fightState >= 0 && world->isOn != world->fightState)
+    {
+        if (world->fightAtMs == NO_TIME) world->fightAtMs = world->nowMs + FIGHT_LATENCY_MS;
+    }
+    else
+    {
+        world->fightAtMs = NO_TIME;
+    }
+}
+
+// Counts the time since the last call as wrong if Instant Replay was in the state the fixer is supposed to take it out of.
+// Nothing is wrong while the fixer is disabled or a whitelisted process is running, since then it's not supposed to do anything.
+static void AccountWrongState(World *world)
+{
+    char isShouldBeOn = !world->isExclusiveExists || world->isExclusiveRunning;
+
+    if (!world->isDisabled && !world->isWhitelistedRunning && world->isOn != isShouldBeOn)
+    {
+        world->wrongMs += world->nowMs - world->accountedMs;
+    }
+
+    world->accountedMs = world->nowMs;
+}
+
+static double ElapsedMs(const struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1000.0 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
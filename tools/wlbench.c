@@ -0,0 +1,381 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Benchmarks the whitelist's hot paths on made up whitelists and command lines, without WMI or anything else Windows.
+// The data comes from a fixed seed, so runs on the same machine can be compared with each other.
+//
+// Usage: wlbench [benchmark...]
+// Without arguments every benchmark is run. The benchmarks are:
+//   match   Matching command lines against substring entries, with the automaton and entry by entry.
+//   search  Searching haystacks of different lengths for a needle that isn't in them, with WideSearch and WideSearchScalar.
+//   load    Parsing a 50k line whitelist file and building its matchers.
+
+#include "defines.h"
+#include "whitelist.h"
+#include "whitelistfile.h"
+#include <stdlib.h>     // For malloc.
+#include <string.h>     // For strcmp.
+#include <time.h>       // For timing.
+
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+// Long enough for the timings to be well above the clock's resolution.
+#define MIN_BENCH_MS 200
+
+// Groups smaller than this don't get an automaton from WhitelistBuildMatchers.
+#define MIN_AUTOMATON_ENTRIES 8
+
+#define NLOAD_LINES 50000
+
+#define NCMDLINES 256
+#define MAX_CMDLINE_LEN 512
+
+typedef const wchar_t *(*WideSearchFunc)(const wchar_t *haystack, size_t hlen, const wchar_t *needle, size_t nlen);
+
+typedef struct
+{
+    const char *name;
+    void (*run)();
+} Benchmark;
+
+GlobalCb glbl = { .lock = PTHREAD_MUTEX_INITIALIZER, .loglock = PTHREAD_MUTEX_INITIALIZER };
+
+static void BenchMatch();
+static void BenchSearch();
+static void BenchLoad();
+static char *MakeWhitelistFile(size_t nlines, size_t *size);
+static double TimeSearch(WideSearchFunc search, const wchar_t *haystack, size_t hlen, const wchar_t *needle, size_t nlen);
+static CompiledWhitelist *MakeSubstringWhitelist(size_t nentries);
+static size_t MakeCmdline(wchar_t *buf, size_t size);
+static uint64_t Random();
+static double ElapsedMs(const struct timespec *start);
+
+static const Benchmark benchmarks[] = {
+    { "match", BenchMatch },
+    { "search", BenchSearch },
+    { "load", BenchLoad },
+};
+
+static uint64_t rng = 0x9E3779B97F4A7C15ull;
+
+int main(int argc, char **argv)
+{
+    glbl.logfile = fopen(NULL_DEVICE, "w");
+
+    for (size_t i = 0; i < _countof(benchmarks); i++)
+    {
+        char isWanted = argc == 1;
+
+        for (int argi = 1; argi < argc; argi++)
+        {
+            isWanted |= strcmp(argv[argi], benchmarks[i].name) == 0;
+        }
+
+        if (!isWanted) continue;
+
+        printf("%s:\n", benchmarks[i].name);
+        rng = 0x9E3779B97F4A7C15ull;
+        benchmarks[i].run();
+    }
+
+    return 0;
+}
+
+// Command lines that don't match anything, which is how almost every process goes, matched against more and more substring entries.
+// The automaton goes over each command line once however many entries there are, entry by entry goes over it once per entry.
+static void BenchMatch()
+{
+    static const size_t sizes[] = { 4, 16, 64, 256, 1024 };
+    wchar_t (*cmdlines)[MAX_CMDLINE_LEN] = malloc(NCMDLINES * sizeof(*cmdlines));
+    size_t lens[NCMDLINES];
+
+    if (cmdlines == NULL)
+    {
+        printf("\tout of memory\n");
+        return;
+    }
+
+    for (size_t i = 0; i < NCMDLINES; i++) lens[i] = MakeCmdline(cmdlines[i], MAX_CMDLINE_LEN);
+
+    for (size_t s = 0; s < _countof(sizes); s++)
+    {
+        CompiledWhitelist *cw = MakeSubstringWhitelist(sizes[s]);
+        WhitelistGroup *group = &cw->groups[PROCFIELD_CMDLINE][MATCHKIND_SUBSTRING];
+        double nsPerCmdline[2];
+
+        // Small groups get an automaton they wouldn't have otherwise.
+        if (group->automaton == NULL)
+        {
+            const wchar_t *patterns[MIN_AUTOMATON_ENTRIES];
+            size_t patternLens[MIN_AUTOMATON_ENTRIES];
+
+            for (uint32_t i = 0; i < group->count; i++)
+            {
+                WideSpan value = WhitelistEntryValue(cw, group->start + i);
+                patterns[i] = value.str;
+                patternLens[i] = value.len;
+            }
+
+            group->automaton = AhoCorasickBuild(patterns, patternLens, group->count);
+        }
+
+        for (int isAutomaton = 1; isAutomaton >= 0; isAutomaton--)
+        {
+            if (!isAutomaton)
+            {
+                AhoCorasickFree(group->automaton);
+                group->automaton = NULL;
+            }
+
+            struct timespec start;
+            size_t nmatched = 0, nruns = 0;
+            double ms;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+
+            do
+            {
+                for (size_t i = 0; i < NCMDLINES; i++)
+                {
+                    WideSpan fields[PROCFIELD_NUMOF] = { [PROCFIELD_CMDLINE] = { cmdlines[i], lens[i] } };
+                    nmatched += WhitelistMatch(cw, fields, LIST_WHITELIST | LIST_EXCLUSIVE) != 0;
+                }
+
+                nruns++;
+            } while ((ms = ElapsedMs(&start)) < MIN_BENCH_MS);
+
+            nsPerCmdline[isAutomaton] = ms * 1e6 / (nruns * NCMDLINES);
+            if (nmatched > 0) printf("\tunexpected matches: %lld\n", (long long)nmatched);
+        }
+
+        printf("\tentries: %4zu  automaton: %9.1f ns  entry by entry: %9.1f ns  (per command line, %.1fx)\n",
+            sizes[s], nsPerCmdline[1], nsPerCmdline[0], nsPerCmdline[0] / nsPerCmdline[1]);
+        WhitelistFree(cw);
+    }
+
+    free(cmdlines);
+}
+
+// The needle's first character is all over the haystack, like the quotes and backslashes of a command line are, so the search can't just skip ahead.
+static void BenchSearch()
+{
+    static const size_t lens[] = { 16, 64, 256, 1024, 4096 };
+    static const wchar_t needle[] = L"\\Game.exe\"";
+    size_t nlen = _countof(needle) - 1;
+    wchar_t *haystack = malloc(lens[_countof(lens) - 1] * sizeof(*haystack));
+
+    if (haystack == NULL)
+    {
+        printf("\tout of memory\n");
+        return;
+    }
+
+    printf("\tvectorized implementation: %s\n", WideSearchImplName());
+
+    for (size_t l = 0; l < _countof(lens); l++)
+    {
+        for (size_t i = 0; i < lens[l]; i++) haystack[i] = Random() % 8 == 0 ? L'\\' : L'a' + Random() % 26;
+
+        double vectorNs = TimeSearch(WideSearch, haystack, lens[l], needle, nlen);
+        double scalarNs = TimeSearch(WideSearchScalar, haystack, lens[l], needle, nlen);
+
+        printf("\tlength: %4zu  vectorized: %8.1f ns  scalar: %8.1f ns  (per search, %.1fx)\n", lens[l], vectorNs, scalarNs, scalarNs / vectorNs);
+    }
+
+    free(haystack);
+}
+
+// Returns how long one search takes in nanoseconds.
+static void BenchLoad();
+static char *MakeWhitelistFile(size_t nlines, size_t *size);
+static double TimeSearch(WideSearchFunc search, const wchar_t *haystack, size_t hlen, const wchar_t *needle, size_t nlen)
+{
+    struct timespec start;
+    size_t nfound = 0, nruns = 0;
+    double ms;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    do
+    {
+        for (int i = 0; i < 1000; i++) nfound += search(haystack, hlen, needle, nlen) != NULL;
+        nruns += 1000;
+    } while ((ms = ElapsedMs(&start)) < MIN_BENCH_MS);
+
+    if (nfound > 0) printf("\tunexpected matches: %lld\n", (long long)nfound);
+    return ms * 1e6 / nruns;
+}
+
+// Every line is parsed, but only the first time a whitelist is seen. After that it comes from the cache, so this is the worst case.
+static void BenchLoad()
+{
+    size_t size;
+    char *data = MakeWhitelistFile(NLOAD_LINES, &size);
+    double parseMs = 0, buildMs = 0;
+    int nruns = 0;
+    struct timespec start, total;
+    WhitelistParseError error;
+
+    if (data == NULL)
+    {
+        printf("\tout of memory\n");
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &total);
+
+    do
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        CompiledWhitelist *cw = WhitelistParse(data, size, &error);
+        parseMs += ElapsedMs(&start);
+
+        if (cw == NULL)
+        {
+            printf("\tfailed to parse: %s\n", error.isOutOfMemory ? "out of memory" : error.msg);
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (!WhitelistBuildMatchers(cw)) printf("\tfailed to build the matchers\n");
+        buildMs += ElapsedMs(&start);
+
+        WhitelistFree(cw);
+        nruns++;
+    } while (ElapsedMs(&total) < MIN_BENCH_MS);
+
+    if (nruns > 0)
+    {
+        printf("\tlines: %d, size: %lld bytes  parse: %.2f ms (%.0f ns per line)  build: %.2f ms\n",
+            NLOAD_LINES, (long long)size, parseMs / nruns, parseMs * 1e6 / nruns / NLOAD_LINES, buildMs / nruns);
+    }
+
+    free(data);
+}
+
+// A whitelist file with every kind of line in it, including long ones, which is where a backtracking lexer would struggle.
+static char *MakeWhitelistFile(size_t nlines, size_t *size)
+{
+    size_t capacity = nlines * 64;
+    char *data = malloc(capacity);
+    *size = 0;
+
+    for (size_t i = 0; data != NULL && i < nlines; i++)
+    {
+        unsigned id = Random() % 100000;
+
+        if (*size + 1024 > capacity)
+        {
+            capacity *= 2;
+            char *grown = realloc(data, capacity);
+            if (grown == NULL) free(data);
+            data = grown;
+            if (data == NULL) break;
+        }
+
+        char *line = data + *size;
+
+        switch (i % 8)
+        {
+            case 0: *size += sprintf(line, "??I Comment number %lld, about the lines below.\n", (long long)i); break;
+            case 1: *size += sprintf(line, "\"C:\\Program Files\\Vendor%u\\App.exe\" -ServerName:App%u.wwa\n", id, id); break;
+            case 2: *size += sprintf(line, "??S Game%05u.exe\n", id); break;
+            case 3: *size += sprintf(line, "??N Tool%05u.exe\n", id); break;
+            case 4: *size += sprintf(line, "??ES Exclusive%05u.exe\" -fullscreen\n", id); break;
+            case 5: *size += sprintf(line, "   \n"); break;
+            case 6: *size += sprintf(line, "??NG Launcher%u*.exe\n", id % 1000); break;
+            case 7:
+                *size += sprintf(line, "??S \"C:\\Games\\%u\\bin\\game.exe\"", id);
+                for (int arg = 0; arg < 24; arg++) *size += sprintf(data + *size, " --option%d=value%u", arg, id);
+                *size += sprintf(data + *size, "\n");
+                break;
+        }
+    }
+
+    return data;
+}
+
+// A whitelist of substring entries on the command line that look like the ones people write, built with all its matchers.
+static CompiledWhitelist *MakeSubstringWhitelist(size_t nentries)
+{
+    size_t counts[PROCFIELD_NUMOF][MATCHKIND_NUMOF] = { [PROCFIELD_CMDLINE][MATCHKIND_SUBSTRING] = nentries };
+    CompiledWhitelist *cw = WhitelistAlloc(counts, nentries * 32);
+
+    if (cw == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < nentries; i++)
+    {
+        wchar_t value[32];
+        int len = swprintf(value, _countof(value), L"Game%05u.exe\" -launch", (unsigned)(Random() % 100000));
+        WhitelistAddEntry(cw, PROCFIELD_CMDLINE, MATCHKIND_SUBSTRING, (i % 4 == 0) ? LIST_EXCLUSIVE : LIST_WHITELIST, i + 1, value, len);
+    }
+
+    if (!WhitelistBuildMatchers(cw))
+    {
+        fprintf(stderr, "Failed to build the matchers.\n");
+        exit(1);
+    }
+
+    return cw;
+}
+
+// A command line like the ones Windows processes have, with a quoted path and a few arguments. None of them match MakeSubstringWhitelist's entries.
+static size_t MakeCmdline(wchar_t *buf, size_t size)
+{
+    static const wchar_t *const dirs[] = { L"Program Files", L"Program Files (x86)", L"WINDOWS\\system32", L"Users\\me\\AppData\\Local" };
+    static const wchar_t *const args[] = { L"--type=renderer", L"-ServerName:App.wwa", L"/background", L"--field-trial-handle=1844,i,171",
+        L"--lang=en-US", L"-Embedding", L"--service-sandbox-type=none", L"/prefetch:8" };
+
+    int len = swprintf(buf, size, L"\"C:\\%ls\\Vendor%u\\App%u\\app%u.exe\"", dirs[Random() % _countof(dirs)],
+        (unsigned)(Random() % 1000), (unsigned)(Random() % 1000), (unsigned)(Random() % 1000));
+
+    for (size_t n = Random() % 8; n > 0 && len + 40 < size; n--)
+    {
+        len += swprintf(buf + len, size - len, L" %ls", args[Random() % _countof(args)]);
+    }
+
+    return len;
+}
+
+// xorshift64*, so every run gets the same data.
+static uint64_t Random()
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return rng * 0x2545F4914F6CDD1Dull;
+}
+
+static double ElapsedMs(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+char *GetDateTimeStaticStr()
+{
+    static char str[32];
+    time_t now = time(NULL);
+    strftime(str, sizeof(str), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    return str;
+}
@@ -0,0 +1,360 @@
+// AlwaysShadow - a program for forcing Shadowplay's Instant Replay to stay on.
+// Copyright (C) 2024 Aviv Edery.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Evaluates a whitelist against a snapshot of processes the same way AlwaysShadow does, without WMI or anything else Windows.
+// Prints the decision, the entries that matched, how long parsing and matching took, and the WQL query the processes would be enumerated with.
+//
+// Usage: wleval [-v] [-r repeats] <whitelist> [snapshot]
+//   -v          Print AlwaysShadow's whitelist logs to stderr.
+//   -r repeats  Match the processes this many times for the timings (default 1).
+//
+// The snapshot has one process per line: its name, a tab, then its command line. A line without a tab is a process with no command line.
+// Without a snapshot the processes that are running right now are read from /proc, which isn't there on Windows.
+
+#include "defines.h"
+#include "whitelist.h"
+#include "whitelistfile.h"
+#include "procsource.h"
+#include "wqlplan.h"
+#include <locale.h>     // For reading UTF-8 files.
+#include <stdlib.h>     // For malloc.
+#include <string.h>     // For strchr.
+#include <time.h>       // For timing.
+
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+typedef struct
+{
+    wchar_t *fields[PROCFIELD_NUMOF]; // NULL if the process doesn't have it.
+    size_t lens[PROCFIELD_NUMOF];
+} Process;
+
+typedef struct
+{
+    const CompiledWhitelist *whitelist;
+    const Process *process;
+} MatchCtx;
+
+GlobalCb glbl = { .lock = PTHREAD_MUTEX_INITIALIZER, .loglock = PTHREAD_MUTEX_INITIALIZER };
+
+static char *ReadFile(const char *filename, size_t *size);
+static Process *ReadSnapshot(char *data, size_t size, size_t *nprocesses);
+static wchar_t *Widen(const char *str, size_t *len);
+static Process *ReadRunningProcesses(size_t *nprocesses);
+static wchar_t *CopySpan(WideSpan span, size_t *len);
+static char MatchProcess(CompiledWhitelist *whitelist, const Process *process);
+static void OnMatch(size_t entry, ProcessField field, void *ctx);
+static double ElapsedMs(const struct timespec *start);
+
+int main(int argc, char **argv)
+{
+    int repeats = 1;
+    char isVerbose = FALSE;
+    int argi = 1;
+
+    for (; argi < argc && argv[argi][0] == '-'; argi++)
+    {
+        if (strcmp(argv[argi], "-v") == 0) isVerbose = TRUE;
+        else if (strcmp(argv[argi], "-r") == 0 && argi + 1 < argc && (repeats = atoi(argv[++argi])) > 0) continue;
+        else break;
+    }
+
+    if (argc - argi != 1 && argc - argi != 2)
+    {
+        fprintf(stderr, "Usage: %s [-v] [-r repeats] <whitelist> [snapshot]\n", argv[0]);
+        return 2;
+    }
+
+    // Whitelists and snapshots are read the way AlwaysShadow reads the whitelist, in the user's locale.
+    setlocale(LC_ALL, "");
+    glbl.logfile = isVerbose ? stderr : fopen(NULL_DEVICE, "w");
+
+    size_t wlSize, snapshotSize, nprocesses;
+    char *wlData = ReadFile(argv[argi], &wlSize);
+    char *snapshotData = NULL;
+    struct timespec start;
+
+    if (wlData == NULL || (argc - argi == 2 && (snapshotData = ReadFile(argv[argi + 1], &snapshotSize)) == NULL))
+    {
+        return 2;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Process *processes = snapshotData != NULL ? ReadSnapshot(snapshotData, snapshotSize, &nprocesses) : ReadRunningProcesses(&nprocesses);
+    double readMs = ElapsedMs(&start);
+
+    if (processes == NULL)
+    {
+        fprintf(stderr, "Failed to read the processes.\n");
+        return 2;
+    }
+
+    WhitelistParseError error;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CompiledWhitelist *whitelist = WhitelistParse(wlData, wlSize, &error);
+    double parseMs = ElapsedMs(&start);
+
+    if (whitelist == NULL)
+    {
+        fprintf(stderr, "%s\n", error.isOutOfMemory ? "Failed to load the whitelist because memory ran out." : error.msg);
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (!WhitelistBuildMatchers(whitelist))
+    {
+        fprintf(stderr, "Failed to build the matchers of the whitelist: memory ran out.\n");
+        return 1;
+    }
+
+    double buildMs = ElapsedMs(&start);
+
+    // The first run prints the matches. Unlike AlwaysShadow it goes on past the first whitelisted process, so every matching process is shown.
+    // Each process only shows the first entry it matched of each list though, since matching stops looking once the list is decided.
+    char lists = 0;
+    whitelist->onMatch = OnMatch;
+
+    for (size_t i = 0; i < nprocesses; i++)
+    {
+        lists |= MatchProcess(whitelist, &processes[i]);
+    }
+
+    // The timed runs don't print anything.
+    whitelist->onMatch = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int r = 0; r < repeats; r++)
+    {
+        for (size_t i = 0; i < nprocesses; i++) MatchProcess(whitelist, &processes[i]);
+    }
+
+    double matchMs = ElapsedMs(&start) / repeats;
+
+    // Same as the decision in FixerLoop.
+    if (lists & LIST_WHITELIST) printf("decision: leave Instant Replay alone (a whitelisted process is running)\n");
+    else if (!whitelist->isExclusiveExists) printf("decision: keep Instant Replay on\n");
+    else if (lists & LIST_EXCLUSIVE) printf("decision: keep Instant Replay on (an exclusive process is running)\n");
+    else printf("decision: keep Instant Replay off (no exclusive process is running)\n");
+
+    printf("entries: %lld, processes: %lld (read in %.3f ms)\n", (long long)whitelist->nentries, (long long)nprocesses, readMs);
+    printf("parse: %.3f ms, build: %.3f ms, match: %.3f ms (%.3f us per process, %d runs)\n",
+        parseMs, buildMs, matchMs, nprocesses == 0 ? 0 : matchMs * 1000 / nprocesses, repeats);
+
+    wchar_t *query = WqlPlanQuery(whitelist);
+    printf("query: %ls\n", query != NULL ? query : L"(out of memory)");
+    free(query);
+
+    WhitelistFree(whitelist);
+    return 0;
+}
+
+// Reads a whole file. Returns NULL (after printing why) if it can't be read.
+static char *ReadFile(const char *filename, size_t *size)
+{
+    FILE *file = fopen(filename, "rb");
+    char *data = NULL;
+
+    if (file == NULL)
+    {
+        perror(filename);
+        return NULL;
+    }
+
+    if (fseek(file, 0, SEEK_END) != 0 || (long)(*size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0 ||
+        (data = malloc(*size + 1)) == NULL || fread(data, 1, *size, file) != *size)
+    {
+        perror(filename);
+        free(data);
+        data = NULL;
+    }
+
+    fclose(file);
+    return data;
+}
+
+// Splits the snapshot into processes in place.
+static Process *ReadSnapshot(char *data, size_t size, size_t *nprocesses)
+{
+    size_t capacity = 1;
+    Process *processes = NULL;
+
+    *nprocesses = 0;
+    data[size] = '\0';
+
+    for (char *line = data, *next; line < data + size; line = next)
+    {
+        char *eol = strchr(line, '\n');
+        next = eol == NULL ? data + size : eol + 1;
+        if (eol != NULL) *eol = '\0';
+        if (eol != NULL && eol > line && eol[-1] == '\r') eol[-1] = '\0';
+        if (*line == '\0') continue;
+
+        if (processes == NULL || *nprocesses == capacity)
+        {
+            capacity *= 2;
+            Process *grown = realloc(processes, capacity * sizeof(*processes));
+            if (grown == NULL) return NULL;
+            processes = grown;
+        }
+
+        Process *process = &processes[(*nprocesses)++];
+        char *tab = strchr(line, '\t');
+        if (tab != NULL) *tab = '\0';
+
+        process->fields[PROCFIELD_NAME] = Widen(line, &process->lens[PROCFIELD_NAME]);
+        process->fields[PROCFIELD_CMDLINE] = tab == NULL ? NULL : Widen(tab + 1, &process->lens[PROCFIELD_CMDLINE]);
+    }
+
+    // An empty snapshot still gets a valid pointer.
+    return processes != NULL ? processes : malloc(sizeof(*processes));
+}
+
+static wchar_t *Widen(const char *str, size_t *len)
+{
+    size_t n = mbstowcs(NULL, str, 0);
+    wchar_t *wide;
+
+    if (n == (size_t)-1 || (wide = malloc((n + 1) * sizeof(*wide))) == NULL)
+    {
+        fprintf(stderr, "Skipping a field that can't be converted: %s\n", str);
+        *len = 0;
+        return NULL;
+    }
+
+    mbstowcs(wide, str, n + 1);
+    *len = n;
+    return wide;
+}
+
+// Copies the processes that are running right now out of a process source, so they can be matched again and again.
+static Process *ReadRunningProcesses(size_t *nprocesses)
+{
+#ifdef _WIN32
+    fprintf(stderr, "Reading the running processes isn't supported on Windows, pass a snapshot.\n");
+    return NULL;
+#else
+    ProcessSource *source = ProcfsSourceOpen();
+    size_t capacity = 1 << 8;
+    Process *processes = malloc(capacity * sizeof(*processes));
+    ProcessInfo info;
+    ProcessSourceResult res = PROCSOURCE_ERROR;
+
+    *nprocesses = 0;
+
+    if (source == NULL || processes == NULL || !source->vtbl->begin(source))
+    {
+        goto cleanup;
+    }
+
+    while ((res = source->vtbl->next(source, &info)) == PROCSOURCE_PROCESS)
+    {
+        if (*nprocesses == capacity)
+        {
+            capacity *= 2;
+            Process *grown = realloc(processes, capacity * sizeof(*processes));
+
+            if (grown == NULL)
+            {
+                res = PROCSOURCE_ERROR;
+                break;
+            }
+
+            processes = grown;
+        }
+
+        Process *process = &processes[(*nprocesses)++];
+
+        // begin only promises names, but /proc reads command lines just as well.
+        for (int field = 0; field < PROCFIELD_NUMOF; field++)
+        {
+            source->vtbl->readField(source, &info, field);
+            process->fields[field] = CopySpan(info.fields[field], &process->lens[field]);
+        }
+    }
+
+cleanup:
+    if (source != NULL) source->vtbl->close(source);
+
+    if (res != PROCSOURCE_END)
+    {
+        free(processes);
+        return NULL;
+    }
+
+    return processes;
+#endif
+}
+
+static wchar_t *CopySpan(WideSpan span, size_t *len)
+{
+    wchar_t *copy;
+    *len = 0;
+
+    if (span.str == NULL || (copy = malloc((span.len + 1) * sizeof(*copy))) == NULL)
+    {
+        return NULL;
+    }
+
+    wmemcpy(copy, span.str, span.len);
+    copy[span.len] = L'\0';
+    *len = span.len;
+    return copy;
+}
+
+// Returns the LIST_* flags of the lists the process matched. Fields are trimmed the same way WmiGetProcessField trims them, with WideSpanTrim.
+static char MatchProcess(CompiledWhitelist *whitelist, const Process *process)
+{
+    WideSpan fields[PROCFIELD_NUMOF];
+    MatchCtx ctx = { whitelist, process };
+
+    for (int field = 0; field < PROCFIELD_NUMOF; field++)
+    {
+        fields[field] = process->fields[field] == NULL ? (WideSpan){ NULL, 0 } : WideSpanTrim((WideSpan){ process->fields[field], process->lens[field] });
+    }
+
+    whitelist->onMatchCtx = &ctx;
+    return WhitelistMatch(whitelist, fields, LIST_WHITELIST | LIST_EXCLUSIVE);
+}
+
+static void OnMatch(size_t entry, ProcessField field, void *ctx)
+{
+    const MatchCtx *match = ctx;
+    const CompiledWhitelist *whitelist = match->whitelist;
+    WideSpan value = WhitelistEntryValue(whitelist, entry);
+
+    printf("%s match: line %u: '%.*ls'\n\t%ls: '%.*ls'\n", whitelist->lists[entry] == LIST_EXCLUSIVE ? "exclusive" : "whitelist",
+        whitelist->linenums[entry], (int)value.len, value.str, procfield_str[field], (int)match->process->lens[field], match->process->fields[field]);
+}
+
+static double ElapsedMs(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+char *GetDateTimeStaticStr()
+{
+    static char str[32];
+    time_t now = time(NULL);
+    strftime(str, sizeof(str), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    return str;
+}